@@ -25,5 +25,23 @@ run   dispatch-loop   ./build/test/zcm/dispatch_loop
 run   forking         ./build/test/zcm/forking
 run   forking2        ./build/test/zcm/forking2
 run   flushing        ./build/test/zcm/flushing
+run   queue-policy    ./build/test/zcm/queue_policy
+run   dispatch-pool   ./build/test/zcm/dispatch_pool
+run   resubscribe     ./build/test/zcm/resubscribe
+run   recv-batch      ./build/test/zcm/recv_batch
+run   send-batch      ./build/test/zcm/send_batch
+run   publish-loan    ./build/test/zcm/publish_loan
+run   typed-groups    ./build/test/zcm/typed_groups
+run   stats           ./build/test/zcm/stats
+run   priority        ./build/test/zcm/priority
+run   conflate        ./build/test/zcm/conflate
+run   fileno          ./build/test/zcm/fileno
+run   nonblock-subs   ./build/test/zcm/nonblock_subs
+run   nonblock-budget ./build/test/zcm/nonblock_budget
+run   channel-regex   ./build/test/zcm/channel_regex
+run   callable-subs   ./build/test/zcm/callable_subs
+run   virtual-time    ./build/test/zcm/virtual_time
+run   udpm-fragbufs   ./build/test/zcm/udpm_fragbufs
+run   udpm-reassembly ./build/test/zcm/udpm_reassembly
 run   logging         ./build/test/zcm/logtest
 run   trackers        ./build/test/zcm/trackers
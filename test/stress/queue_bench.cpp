@@ -0,0 +1,145 @@
+// Compares the queues usable by the blocking core (ThreadsafeQueue and SpscQueue)
+// with one producer and one consumer thread passing 1 KB messages.
+//
+// Two runs per queue:
+//   paced:   the producer targets RATE msgs/s and we report push->pop latency
+//   flooded: the producer pushes as fast as it can and we report throughput
+//
+// Usage: queue_bench [num_msgs]
+
+#include "zcm/zcm.h"
+#include "zcm/util/threadsafe_queue.hpp"
+#include "zcm/util/spsc_queue.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+#define MSGSZ 1024
+#define RATE 1000000
+#define QUEUE_SIZE 16
+#define DEFAULT_N 2000000
+
+typedef chrono::steady_clock Clock;
+
+static uint64_t nowNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+static double cpuSec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Mimics the blocking core's Msg: owns a heap copy of the payload
+struct BenchMsg
+{
+    uint64_t sentNs = 0;
+    char *data = nullptr;
+
+    BenchMsg() {}
+    BenchMsg(uint64_t sentNs, const char *src) : sentNs(sentNs), data((char*)malloc(MSGSZ))
+    { memcpy(data, src, MSGSZ); }
+
+    BenchMsg(BenchMsg&& other) : sentNs(other.sentNs), data(other.data)
+    { other.data = nullptr; }
+
+    BenchMsg& operator=(BenchMsg&& other)
+    {
+        swap(sentNs, other.sentNs);
+        swap(data, other.data);
+        return *this;
+    }
+
+    ~BenchMsg() { free(data); }
+};
+
+// Both queues, behind the consumer interface of each
+static bool take(ThreadsafeQueue<BenchMsg>& q, BenchMsg& out)
+{
+    BenchMsg *m = q.top();
+    if (!m) return false;
+    out = move(*m);
+    q.pop();
+    return true;
+}
+
+static bool take(SpscQueue<BenchMsg>& q, BenchMsg& out)
+{
+    return q.pop(out);
+}
+
+template<template<class> class QueueType>
+static void run(const char *name, size_t n, bool paced)
+{
+    QueueType<BenchMsg> q {QUEUE_SIZE};
+    vector<uint32_t> lat;
+    if (paced) lat.reserve(n);
+
+    char payload[MSGSZ];
+    memset(payload, 0xab, sizeof(payload));
+
+    volatile uint64_t sink = 0;
+    double cpu0 = cpuSec();
+    uint64_t start = nowNs();
+
+    thread consumer([&](){
+        BenchMsg m;
+        for (size_t i = 0; i < n; i++) {
+            take(q, m);
+            if (paced) lat.push_back((uint32_t)min<uint64_t>(nowNs() - m.sentNs, UINT32_MAX));
+            sink += m.data[i % MSGSZ];
+        }
+    });
+
+    const uint64_t periodNs = 1000000000ull / RATE;
+    for (size_t i = 0; i < n; i++) {
+        if (paced) {
+            uint64_t due = start + i * periodNs;
+            while (nowNs() < due) {}
+        }
+        q.push(nowNs(), payload);
+    }
+    consumer.join();
+
+    double elapsed = (nowNs() - start) / 1e9;
+    double cpu = cpuSec() - cpu0;
+
+    printf("%-16s %-8s %8.3f Mmsg/s  cpu %5.2fs / wall %5.2fs",
+           name, paced ? "paced" : "flooded", n / elapsed / 1e6, cpu, elapsed);
+    if (paced) {
+        sort(lat.begin(), lat.end());
+        double sum = 0;
+        for (uint32_t l : lat) sum += l;
+        printf("  latency ns: mean %.0f p50 %u p99 %u p99.9 %u max %u",
+               sum / lat.size(), lat[lat.size() / 2], lat[lat.size() * 99 / 100],
+               lat[lat.size() * 999 / 1000], lat.back());
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = DEFAULT_N;
+    if (argc > 1) n = strtoul(argv[1], NULL, 10);
+
+    printf("%zu messages of %d bytes, queue size %d, paced rate %d msgs/s\n",
+           n, MSGSZ, QUEUE_SIZE, RATE);
+
+    run<ThreadsafeQueue>("ThreadsafeQueue", n, true);
+    run<SpscQueue>      ("SpscQueue",       n, true);
+    run<ThreadsafeQueue>("ThreadsafeQueue", n, false);
+    run<SpscQueue>      ("SpscQueue",       n, false);
+
+    return 0;
+}
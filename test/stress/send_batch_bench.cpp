@@ -0,0 +1,173 @@
+// Measures what sendmsg_batch saves the blocking send thread on udpm.
+//
+// Publishes RATE small messages per second for SECONDS, once in bursts of BURST
+// messages and once evenly paced, each with and without the transport's
+// sendmsg_batch. sendmsg() and sendmmsg() are interposed to count the syscalls.
+//
+// Usage: send_batch_bench [url]
+
+#include "zcm/zcm.h"
+#include "zcm/transport.h"
+#include "zcm/transport_registrar.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+#include <atomic>
+#include <chrono>
+#include <thread>
+using namespace std;
+
+#define URL "udpm://239.255.76.67:7667?ttl=0"
+#define CHANNEL "SEND_BATCH_BENCH"
+#define MSGSZ 64
+#define RATE 10000
+#define BURST 100
+#define SECONDS 2
+#define QUEUE_SIZE 256
+
+static atomic<uint64_t> numSyscalls {0};
+
+extern "C" ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+    numSyscalls++;
+    return syscall(SYS_sendmsg, fd, msg, flags);
+}
+
+extern "C" int sendmmsg(int fd, struct mmsghdr *msgs, unsigned int n, int flags)
+{
+    numSyscalls++;
+    return syscall(SYS_sendmmsg, fd, msgs, n, flags);
+}
+
+static double cpuSec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Forwards everything to 'inner', optionally hiding its sendmsg_batch
+struct WrapTrans : public zcm_trans_t
+{
+    zcm_trans_t *inner;
+    static zcm_trans_methods_t methods, batchMethods;
+
+    WrapTrans(zcm_trans_t *inner, bool batch) : inner(inner)
+    {
+        trans_type = ZCM_BLOCKING;
+        vtbl = batch ? &batchMethods : &methods;
+    }
+
+    static zcm_trans_t *in(zcm_trans_t *zt) { return ((WrapTrans*)zt)->inner; }
+
+    static size_t getMtu(zcm_trans_t *zt)
+    { return zcm_trans_get_mtu(in(zt)); }
+
+    static int sendmsg(zcm_trans_t *zt, zcm_msg_t msg)
+    { return zcm_trans_sendmsg(in(zt), msg); }
+
+    static int recvmsgEnable(zcm_trans_t *zt, const char *channel, bool enable)
+    { return zcm_trans_recvmsg_enable(in(zt), channel, enable); }
+
+    static int recvmsg(zcm_trans_t *zt, zcm_msg_t *msg, int timeout)
+    { return zcm_trans_recvmsg(in(zt), msg, timeout); }
+
+    static int sendmsgBatch(zcm_trans_t *zt, zcm_msg_t *msgs, size_t *nmsgs)
+    { return zcm_trans_sendmsg_batch(in(zt), msgs, nmsgs); }
+
+    static void destroy(zcm_trans_t *zt)
+    {
+        zcm_trans_destroy(in(zt));
+        delete (WrapTrans*)zt;
+    }
+};
+
+zcm_trans_methods_t WrapTrans::methods = {
+    &WrapTrans::getMtu,
+    &WrapTrans::sendmsg,
+    &WrapTrans::recvmsgEnable,
+    &WrapTrans::recvmsg,
+    NULL, // update
+    &WrapTrans::destroy,
+};
+
+zcm_trans_methods_t WrapTrans::batchMethods = {
+    &WrapTrans::getMtu,
+    &WrapTrans::sendmsg,
+    &WrapTrans::recvmsgEnable,
+    &WrapTrans::recvmsg,
+    NULL, // update
+    &WrapTrans::destroy,
+    NULL, // recvmsg_lend
+    NULL, // recvmsg_release
+    NULL, // recvmsg_batch
+    &WrapTrans::sendmsgBatch,
+};
+
+static void run(const char *url, bool batch, int burst)
+{
+    zcm_url_t *u = zcm_url_create(url);
+    zcm_trans_create_func *create = zcm_transport_find(zcm_url_protocol(u));
+    zcm_trans_t *inner = create ? create(u) : NULL;
+    zcm_url_destroy(u);
+    if (!inner) {
+        fprintf(stderr, "failed to create a transport for '%s'\n", url);
+        exit(1);
+    }
+    if (batch && !zcm_trans_can_send_batch(inner)) {
+        printf("  %-8s %-10s transport has no sendmsg_batch\n", "batched", "");
+        zcm_trans_destroy(inner);
+        return;
+    }
+
+    zcm_t *zcm = zcm_create_trans(new WrapTrans(inner, batch));
+    if (!zcm || zcm_set_queue_size(zcm, ZCM_SEND_QUEUE, QUEUE_SIZE) != 0) {
+        fprintf(stderr, "failed to create zcm\n");
+        exit(1);
+    }
+
+    char data[MSGSZ];
+    memset(data, 0, sizeof(data));
+
+    int total = RATE * SECONDS;
+    auto period = chrono::microseconds(1000000 * burst / RATE);
+    int failed = 0;
+
+    numSyscalls = 0;
+    double cpu0 = cpuSec();
+    auto next = chrono::steady_clock::now();
+    for (int i = 0; i < total; i += burst) {
+        for (int j = 0; j < burst; j++)
+            if (zcm_publish(zcm, CHANNEL, data, sizeof(data)) != 0)
+                failed++;
+        next += period;
+        this_thread::sleep_until(next);
+    }
+    zcm_flush(zcm);
+    double cpu = cpuSec() - cpu0;
+    uint64_t calls = numSyscalls;
+
+    printf("  %-8s %-10s %6.3f syscalls/msg  %5.1f%% cpu  %d dropped\n",
+           batch ? "batched" : "single", burst == 1 ? "paced" : "bursts",
+           (double)calls / (total - failed), 100 * cpu / SECONDS, failed);
+
+    zcm_destroy(zcm);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *url = argc > 1 ? argv[1] : URL;
+    printf("%d msgs/s of %d bytes for %d s on %s\n", RATE, MSGSZ, SECONDS, url);
+    const int bursts[] = {BURST, 1};
+    for (int burst : bursts) {
+        run(url, false, burst);
+        run(url, true, burst);
+    }
+    return 0;
+}
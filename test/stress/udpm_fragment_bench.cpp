@@ -0,0 +1,105 @@
+// Measures what it costs udpm to publish large, fragmented messages.
+//
+// Sends messages of 1, 10 and 100 MB straight through the transport, once with
+// fragments batched by sendmmsg() and once as if the kernel had no sendmmsg(),
+// which sends a fragment per sendmsg() as udpm always used to. sendmsg() and
+// sendmmsg() are interposed to count the syscalls and to fake the old kernel.
+//
+// Usage: udpm_fragment_bench [url]
+
+#include "zcm/zcm.h"
+#include "zcm/transport.h"
+#include "zcm/transport_registrar.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+#include <atomic>
+#include <vector>
+using namespace std;
+
+#define URL "udpm://239.255.76.67:7667?ttl=0"
+#define CHANNEL "FRAGMENT_BENCH"
+#define MB (1000 * 1000)
+#define TOTAL (200 * MB) // bytes published per size
+
+static atomic<uint64_t> numSyscalls {0};
+static atomic<bool> haveSendmmsg {true};
+
+extern "C" ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+    numSyscalls++;
+    return syscall(SYS_sendmsg, fd, msg, flags);
+}
+
+extern "C" int sendmmsg(int fd, struct mmsghdr *msgs, unsigned int n, int flags)
+{
+    if (!haveSendmmsg) {
+        errno = ENOSYS;
+        return -1;
+    }
+    numSyscalls++;
+    return syscall(SYS_sendmmsg, fd, msgs, n, flags);
+}
+
+static double cpuSec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char *url, size_t size, bool batch)
+{
+    zcm_url_t *u = zcm_url_create(url);
+    zcm_trans_create_func *create = zcm_transport_find(zcm_url_protocol(u));
+    zcm_trans_t *trans = create ? create(u) : NULL;
+    zcm_url_destroy(u);
+    if (!trans) {
+        fprintf(stderr, "failed to create a transport for '%s'\n", url);
+        exit(1);
+    }
+
+    vector<char> data(size);
+    zcm_msg_t msg;
+    msg.utime = 0;
+    msg.channel = CHANNEL;
+    msg.len = size;
+    msg.buf = data.data();
+
+    haveSendmmsg = batch;
+    int reps = TOTAL / size;
+    int failed = 0;
+
+    numSyscalls = 0;
+    double cpu0 = cpuSec();
+    for (int i = 0; i < reps; i++)
+        if (zcm_trans_sendmsg(trans, msg) != ZCM_EOK)
+            failed++;
+    double cpu = cpuSec() - cpu0;
+    uint64_t calls = numSyscalls;
+
+    printf("  %3zu MB  %-8s %8.2f ms cpu/msg  %7.1f syscalls/msg  %d failed\n",
+           size / MB, batch ? "sendmmsg" : "sendmsg",
+           1e3 * cpu / reps, (double)calls / reps, failed);
+
+    zcm_trans_destroy(trans);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *url = argc > 1 ? argv[1] : URL;
+    printf("%d MB of messages per size on %s\n", TOTAL / MB, url);
+    const size_t sizes[] = {1 * MB, 10 * MB, 100 * MB};
+    for (size_t size : sizes) {
+        run(url, size, false);
+        run(url, size, true);
+    }
+    return 0;
+}
@@ -1,8 +1,16 @@
+// Publishes N fragmented messages over udpm to itself, and reports how many
+// made it, at what throughput, and the CPU time it took to send and receive them.
+//
+// Usage: udpm_high_rate_multifrag [num messages]
+
 #include <zcm/zcm.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 #define URL "udpm://239.255.76.67:7667?ttl=0"
 #define CHANNEL "HIGHRATE_TEST"
@@ -16,8 +24,25 @@ static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
     recv_count++;
 }
 
+static double wallSec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double cpuSec()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
 int main(int argc, char *argv[])
 {
+    size_t n = argc > 1 ? (size_t)atol(argv[1]) : N;
+
     char *data = malloc(DATASZ);
     memset(data, 0, DATASZ);
 
@@ -27,16 +52,27 @@ int main(int argc, char *argv[])
     zcm_subscribe(zcm, CHANNEL, handler, NULL);
     zcm_start(zcm);
 
-    for (size_t i = 0; i < N; i++) {
+    double wall = wallSec();
+    double cpu = cpuSec();
+
+    for (size_t i = 0; i < n; i++) {
         zcm_publish(zcm, CHANNEL, data, DATASZ);
         usleep(SLEEPUS);
     }
 
     usleep(100000);
     zcm_stop(zcm);
+
+    wall = wallSec() - wall;
+    cpu = cpuSec() - cpu;
+
     zcm_destroy(zcm);
 
-    printf("Message success: %d/%d\n", (int)recv_count, N);
+    printf("Message success: %d/%d\n", (int)recv_count, (int)n);
+    printf("Throughput: %.1f msg/s, %.1f MB/s received\n",
+           recv_count / wall, recv_count * (double)DATASZ / wall / 1e6);
+    printf("CPU: %.2f s over %.2f s (%.1f%%), %.1f us per message received\n",
+           cpu, wall, 100 * cpu / wall, recv_count ? 1e6 * cpu / recv_count : 0);
 
     free(data);
     return 0;
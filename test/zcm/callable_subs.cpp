@@ -0,0 +1,133 @@
+#include "zcm/zcm-cpp.hpp"
+#include "test_trans.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+using namespace std;
+
+// Stand in for generated types
+struct value_t
+{
+    int value;
+
+    static const char *getTypeName() { return "value_t"; }
+
+    int64_t decode(const void *buf, uint32_t offset, uint32_t maxlen)
+    {
+        memcpy(&value, (const char*)buf + offset, sizeof(value));
+        return sizeof(value);
+    }
+};
+
+// Every callback records which subscription it was called for
+static vector<int> calls;
+
+static void receive(zcm::ZCM& zcm, ScriptTrans *trans, int value)
+{
+    calls.clear();
+    trans->add("VALUE", value);
+    ENSURE(ZCM_EOK == zcm.handleNonblock());
+}
+
+struct Functor
+{
+    int id;
+    void operator()(const zcm::ReceiveBuffer *rbuf, const string& channel,
+                    const value_t *msg) const
+    {
+        calls.push_back(id);
+    }
+};
+
+struct MoveOnly
+{
+    unique_ptr<int> id;
+    void operator()(const zcm::ReceiveBuffer *rbuf, const string& channel,
+                    const value_t *msg) const
+    {
+        calls.push_back(*id);
+    }
+};
+
+static void plainFunction(const zcm::ReceiveBuffer *rbuf, const string& channel, const value_t *msg)
+{
+    calls.push_back(msg->value);
+}
+
+static void test_callables()
+{
+    ScriptTrans *trans = new ScriptTrans(ZCM_NONBLOCKING);
+    zcm::ZCM zcm(trans);
+    ENSURE(zcm.good());
+
+    // Move-only state is moved into the subscription
+    MoveOnly m;
+    m.id.reset(new int(1));
+    ENSURE(zcm.subscribe<value_t>("VALUE", move(m)));
+    ENSURE(!m.id);
+
+    Functor f {2};
+    ENSURE(zcm.subscribe<value_t>("VALUE", f));
+    ENSURE(zcm.subscribe<value_t>("VALUE", Functor {3}));
+    std::function<void (const zcm::ReceiveBuffer*, const string&, const value_t*)> func =
+        [](const zcm::ReceiveBuffer *rbuf, const string& channel, const value_t *msg) {
+            calls.push_back(4);
+        };
+    ENSURE(zcm.subscribe<value_t>("VALUE", func));
+    ENSURE(zcm.subscribe<value_t>("VALUE", plainFunction));
+
+    receive(zcm, trans, 5);
+    ENSURE(calls == vector<int>({1, 2, 3, 4, 5}));
+}
+
+// Unsubscribing in any order keeps the others dispatched in the order they subscribed
+static void test_unsubscribe()
+{
+    ScriptTrans *trans = new ScriptTrans(ZCM_NONBLOCKING);
+    zcm::ZCM zcm(trans);
+    ENSURE(zcm.good());
+
+    vector<zcm::Subscription*> subs;
+    vector<int> expected;
+    for (int i = 0; i < 20; i++) {
+        subs.push_back(zcm.subscribe<value_t>("VALUE", Functor {i}));
+        expected.push_back(i);
+    }
+
+    int order[] = {0, 19, 7, 3, 8, 12, 1, 2, 15, 4, 5, 6, 18, 9, 10, 11, 17, 13};
+    for (int i : order) {
+        zcm.unsubscribe(subs[i]);
+        expected.erase(find(expected.begin(), expected.end(), i));
+        receive(zcm, trans, 0);
+        ENSURE(calls == expected);
+
+        // Joining after others left still goes last
+        zcm::Subscription *sub = zcm.subscribe<value_t>("VALUE", Functor {100});
+        receive(zcm, trans, 0);
+        ENSURE(calls.size() == expected.size() + 1 && calls.back() == 100);
+        zcm.unsubscribe(sub);
+    }
+
+    zcm.unsubscribe(nullptr);
+    zcm.unsubscribe(subs[14]);
+    zcm.unsubscribe(subs[16]);
+    receive(zcm, trans, 0);
+    ENSURE(calls.empty());
+
+    // Subscribing again makes a new group
+    ENSURE(zcm.subscribe<value_t>("VALUE", Functor {200}));
+    receive(zcm, trans, 0);
+    ENSURE(calls == vector<int>({200}));
+}
+
+int main()
+{
+    test_callables();
+    test_unsubscribe();
+    return 0;
+}
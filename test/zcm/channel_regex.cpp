@@ -0,0 +1,86 @@
+#include "zcm/channel_regex.h"
+#include "test_trans.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <regex>
+using namespace std;
+
+static bool matches(const string& pattern, const string& channel)
+{
+    zcm_regex_t re;
+    ENSURE(zcm_regex_compile(&re, pattern.c_str()));
+    return zcm_regex_match(&re, channel.c_str(), channel.size());
+}
+
+// Every pattern has to agree with std::regex, which the blocking core uses
+static void test_against_std()
+{
+    vector<string> patterns = {
+        "POSE", "POSE.*", ".*", ".+", "", "A|B", "A|", "(A|B)*C", "(?:AB)+",
+        "CAM_(LEFT|RIGHT)", "IMU_[0-9]+", "[^_]*_[A-Z]?", "[a-cX-Z-]+", "[\\]A]*",
+        "\\w+\\.\\d", "\\W\\D\\S", "\\s*", "A*?B", "A+?", "(A*)*", "(A|AB)(C|BCD)",
+        "^POSE$", "^.*$", "A^B", "$", "[.]+", "A\\|B", "(((A)))", "(A?)+B",
+        "[\\d_]+", "[^\\w]", "\\[\\]", "a.c", "(|A)B", "(a|b|c|d|e)*e", "[]",
+    };
+    vector<string> channels = {
+        "", "A", "B", "C", "AB", "ABC", "ABCD", "AAB", "BC", "ABBCD", "POSE", "POSE_X",
+        "POS", "POSES", "CAM_LEFT", "CAM_RIGHT", "CAM_", "IMU_12", "IMU_", "IMU_x",
+        "abc", "a\nc", "X-Y", "]A]", "x.1", "x.12", " _ ", "  ", "A|B", "[]", "__1",
+        "!", "ABABAB", "abcde", "dcba", "B_C", "bx_Z",
+    };
+
+    for (auto& p : patterns) {
+        regex expected(p);
+        for (auto& c : channels) {
+            if (matches(p, c) != regex_match(c, expected)) {
+                fprintf(stderr, "'%s' on '%s'\n", p.c_str(), c.c_str());
+                ENSURE(false);
+            }
+        }
+    }
+}
+
+static void test_len()
+{
+    // Only the first 'len' characters are the channel
+    zcm_regex_t re;
+    ENSURE(zcm_regex_compile(&re, "AB*"));
+    ENSURE(zcm_regex_match(&re, "ABBX", 3));
+    ENSURE(!zcm_regex_match(&re, "ABBX", 4));
+    ENSURE(zcm_regex_match(&re, "A", 1));
+}
+
+static void test_unsupported()
+{
+    vector<string> patterns = {
+        "(", ")", "A(B", "A)B", "*A", "A**", "+", "?", "[A", "[]A]", "[Z-A]", "A\\",
+        "\\", "(A\\", "[A\\", "[\\", "[A-\\",
+        "A{2}", "A{1,}", "(?=A)", "(?!A)", "\\1", "\\b", "A|*",
+        string(ZCM_REGEX_MAX_STATES, 'A'),
+        string(1000, '('),
+        "[A][B][C][D][E]",
+    };
+    zcm_regex_t re;
+    for (auto& p : patterns) {
+        // Without any room after the end, so reading past it is caught under ASan
+        char *exact = strdup(p.c_str());
+        ENSURE(exact);
+        if (zcm_regex_compile(&re, exact)) {
+            fprintf(stderr, "'%s' compiled\n", exact);
+            ENSURE(false);
+        }
+        free(exact);
+    }
+}
+
+int main()
+{
+    test_against_std();
+    test_len();
+    test_unsupported();
+    return 0;
+}
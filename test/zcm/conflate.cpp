@@ -0,0 +1,196 @@
+#include "zcm/zcm.h"
+#include "test_trans.hpp"
+
+#include <unistd.h>
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+using namespace std;
+
+#define FLOOD_PERIOD_US 200
+#define SLOW_HANDLER_US 5000
+#define FLOOD_US 300000
+#define OTHER_EVERY 50
+
+static uint64_t utime()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// A blocking transport that receives either a scripted list of messages, the
+// rest of which only once 'released' is set, or, once 'flood' is set, an endless
+// paced stream of SENSOR messages with an OTHER message every OTHER_EVERY of them.
+// Every message carries its index.
+struct FloodTrans : public TestTrans
+{
+    vector<string> channels;
+    atomic<int> next {0};
+    atomic<bool> released {false};
+
+    bool flood = false;
+    uint64_t nextUtime = 0;
+    int value = 0;
+
+    int recvmsg(zcm_msg_t *msg, int timeout) override
+    {
+        int n = next;
+        if (flood) {
+            uint64_t now = utime();
+            if (now < nextUtime)
+                usleep(nextUtime - now);
+            nextUtime = max(now, nextUtime) + FLOOD_PERIOD_US;
+            msg->channel = n % OTHER_EVERY == 0 ? "OTHER" : "SENSOR";
+        } else {
+            if (n == (int)channels.size() || (n == 1 && !released))
+                return idle(timeout);
+            msg->channel = channels[n].c_str();
+        }
+        value = n;
+        msg->utime = 0;
+        msg->len = sizeof(value);
+        msg->buf = (char*)&value;
+        next = n + 1;
+        return ZCM_EOK;
+    }
+};
+
+struct Recorder
+{
+    FloodTrans *trans;
+    vector<int> values;
+};
+
+// Holds up the first message until the recv thread has taken in everything else
+static void recordHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    Recorder *r = (Recorder*)usr;
+    if (r->values.empty() && string(channel) == "OTHER") {
+        r->trans->released = true;
+        while (r->trans->next < (int)r->trans->channels.size()) usleep(1000);
+        usleep(50000);
+    }
+    r->values.push_back(*(int*)rbuf->data);
+}
+
+static const zcm_channel_stats_t *findChannel(const zcm_stats_t& stats, const char *channel)
+{
+    for (uint32_t i = 0; i < stats.nchannels; i++)
+        if (strcmp(stats.channels[i].channel, channel) == 0)
+            return &stats.channels[i];
+    return NULL;
+}
+
+static void test_latest()
+{
+    FloodTrans *trans = new FloodTrans();
+    const char *script[] = {"OTHER", "SENSOR", "SENSOR", "SENSOR", "OTHER", "SENSOR"};
+    for (const char *channel : script)
+        trans->channels.push_back(channel);
+
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    ENSURE(0 == zcm_set_channel_conflate(zcm, "SENSOR", 1));
+
+    Recorder other, sensor;
+    other.trans = sensor.trans = trans;
+    ENSURE(zcm_subscribe(zcm, "OTHER", recordHandler, &other));
+    ENSURE(zcm_subscribe(zcm, "SENSOR", recordHandler, &sensor));
+    for (int i = 0; i < 3; i++)
+        ENSURE(0 == zcm_handle(zcm));
+
+    // Only the newest SENSOR message made it, the OTHER ones all did
+    ENSURE(other.values.size() == 2 && other.values[0] == 0 && other.values[1] == 4);
+    ENSURE(sensor.values.size() == 1 && sensor.values[0] == 5);
+
+    zcm_stats_t stats;
+    ENSURE(0 == zcm_get_stats(zcm, &stats));
+    const zcm_channel_stats_t *s = findChannel(stats, "SENSOR");
+    ENSURE(s);
+    ENSURE(s->received == 4 && s->dispatched == 1);
+    ENSURE(s->dropped[ZCM_DROP_RECV_CONFLATED] == 3);
+    zcm_free_stats(&stats);
+
+    zcm_destroy(zcm);
+}
+
+struct Slow
+{
+    FloodTrans *trans;
+    atomic<int> numCalls {0};
+    atomic<int> maxBehind {0};
+};
+
+static void slowHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    Slow *s = (Slow*)usr;
+    int behind = s->trans->next - *(int*)rbuf->data;
+    if (behind > s->maxBehind)
+        s->maxBehind = behind;
+    s->numCalls++;
+    usleep(SLOW_HANDLER_US);
+}
+
+static void countHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    (*(atomic<int>*)usr)++;
+}
+
+// A slow consumer of a conflated channel holds up neither the transport nor other channels,
+// as long as their dispatch thread has the time to spare between its callbacks
+static void test_slow_consumer()
+{
+    FloodTrans *trans = new FloodTrans();
+    trans->flood = true;
+
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    ENSURE(0 == zcm_set_channel_conflate(zcm, "SENSOR", 1));
+
+    Slow slow;
+    slow.trans = trans;
+    atomic<int> numOther {0};
+    ENSURE(zcm_subscribe(zcm, "SENSOR", slowHandler, &slow));
+    ENSURE(zcm_subscribe(zcm, "OTHER", countHandler, &numOther));
+
+    zcm_start(zcm);
+    usleep(FLOOD_US);
+    zcm_stop(zcm);
+    int numRecv = trans->next;
+    zcm_destroy(zcm);
+
+    // The transport was read at its own pace, far faster than SENSOR was handled
+    ENSURE(numRecv > FLOOD_US / FLOOD_PERIOD_US / 2);
+    ENSURE(slow.numCalls <= FLOOD_US / SLOW_HANDLER_US + 1);
+    ENSURE(numOther >= numRecv / OTHER_EVERY - 2);
+
+    // Every SENSOR callback got a message received during the previous one
+    ENSURE(slow.maxBehind <= 2 * SLOW_HANDLER_US / FLOOD_PERIOD_US);
+}
+
+static void test_invalid()
+{
+    zcm_t *zcm = zcm_create_trans(new FloodTrans());
+    ENSURE(zcm);
+
+    string longName(ZCM_CHANNEL_MAXLEN + 1, 'x');
+    ENSURE(-1 == zcm_set_channel_conflate(zcm, longName.c_str(), 1));
+    ENSURE(ZCM_EINVALID == zcm_errno(zcm));
+    ENSURE(0 == zcm_set_channel_conflate(zcm, "A", 1));
+    ENSURE(0 == zcm_set_channel_conflate(zcm, "A", 0));
+
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_latest();
+    test_slow_consumer();
+    test_invalid();
+    return 0;
+}
@@ -0,0 +1,269 @@
+#include "zcm/zcm.h"
+#include "test_trans.hpp"
+
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+using namespace std;
+
+#define NUM_THREADS 4
+#define NUM_FAST_CHANNELS 8
+#define NUM_SLOW_MSGS 10
+#define NUM_FAST_MSGS 100
+#define SLOW_HANDLER_US 20000
+#define NUM_STUCK_MSGS 20
+#define SMALL_QUEUE_SIZE 4
+#define STUCK_CHANNEL_LIMIT 2
+#define NUM_PACED_MSGS 10
+#define PACE_US 1000
+
+struct ChannelState
+{
+    atomic<int> inflight {0};
+    atomic<int> numRecv {0};
+    atomic<int> lastValue {-1};
+    atomic<bool> overlapped {false};
+    atomic<bool> reordered {false};
+};
+
+static ChannelState slowState;
+static ChannelState fastStates[NUM_FAST_CHANNELS];
+static atomic<int> fastDuringSlow {0};
+
+static void track(ChannelState *s, const zcm_recv_buf_t *rbuf)
+{
+    if (s->inflight++ != 0) s->overlapped = true;
+    int v = *(int*)rbuf->data;
+    if (v != s->lastValue + 1) s->reordered = true;
+    s->lastValue = v;
+    s->numRecv++;
+}
+
+static void slowHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    track(&slowState, rbuf);
+    usleep(SLOW_HANDLER_US);
+    slowState.inflight--;
+}
+
+static void fastHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    ChannelState *s = (ChannelState*)usr;
+    track(s, rbuf);
+    if (slowState.inflight > 0) fastDuringSlow++;
+    s->inflight--;
+}
+
+static bool allReceived()
+{
+    if (slowState.numRecv < NUM_SLOW_MSGS) return false;
+    for (int c = 0; c < NUM_FAST_CHANNELS; c++)
+        if (fastStates[c].numRecv < NUM_FAST_MSGS) return false;
+    return true;
+}
+
+static void test_slow_channel()
+{
+    ScriptTrans *trans = new ScriptTrans();
+    vector<string> fastNames;
+    for (int i = 0; i < NUM_FAST_CHANNELS; i++)
+        fastNames.push_back("FAST" + to_string(i));
+
+    // Interleave the channels so that the slow one would hold everyone up if
+    // all callbacks were dispatched from one thread
+    for (int i = 0; i < NUM_FAST_MSGS; i++) {
+        if (i < NUM_SLOW_MSGS) trans->add("SLOW", i);
+        for (int c = 0; c < NUM_FAST_CHANNELS; c++)
+            trans->add(fastNames[c], i);
+    }
+
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    ENSURE(-1 == zcm_set_dispatch_threads(zcm, 0));
+    ENSURE(0 == zcm_set_dispatch_threads(zcm, NUM_THREADS));
+    // Make the slow channel's backlog fit, so only its own worker waits on it
+    ENSURE(0 == zcm_set_queue_size(zcm, ZCM_RECV_QUEUE, 64));
+
+    zcm_subscribe(zcm, "SLOW", slowHandler, NULL);
+    for (int c = 0; c < NUM_FAST_CHANNELS; c++)
+        zcm_subscribe(zcm, fastNames[c].c_str(), fastHandler, &fastStates[c]);
+
+    zcm_start(zcm);
+    ENSURE(-1 == zcm_set_dispatch_threads(zcm, 1));
+    for (int i = 0; i < 200 && !allReceived(); i++)
+        usleep(10000);
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+
+    ENSURE(slowState.numRecv == NUM_SLOW_MSGS);
+    ENSURE(!slowState.overlapped && !slowState.reordered);
+    for (int c = 0; c < NUM_FAST_CHANNELS; c++) {
+        ENSURE(fastStates[c].numRecv == NUM_FAST_MSGS);
+        ENSURE(!fastStates[c].overlapped && !fastStates[c].reordered);
+    }
+
+    // The fast channels that don't share a worker with the slow one keep
+    // being dispatched while the slow handler is busy
+    ENSURE(fastDuringSlow > 0);
+}
+
+// Hands out its first message, and the rest only once 'open' is set, slowly enough
+// that they never wait in the receive queue, only in those of the workers
+struct GatedTrans : public ScriptTrans
+{
+    atomic<bool> open {false};
+
+    int recvmsg(zcm_msg_t *msg, int timeout) override
+    {
+        if (next == 1 && !open)
+            return idle(timeout);
+        if (next > 0)
+            usleep(PACE_US);
+        return ScriptTrans::recvmsg(msg, timeout);
+    }
+};
+
+// A handler that doesn't return from its first message until released
+struct StuckState
+{
+    atomic<bool> held {false};
+    atomic<bool> released {false};
+    atomic<int> numRecv {0};
+};
+
+static void stuckHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    StuckState *s = (StuckState*)usr;
+    s->numRecv++;
+    s->held = true;
+    while (!s->released)
+        usleep(1000);
+}
+
+static void countHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    (*(atomic<int>*)usr)++;
+}
+
+template <class Pred>
+static bool waitUntil(Pred done)
+{
+    for (int i = 0; i < 200 && !done(); i++)
+        usleep(10000);
+    return done();
+}
+
+static uint64_t numDropped(zcm_t *zcm, const string& channel, zcm_drop_cause cause)
+{
+    zcm_stats_t stats;
+    ENSURE(0 == zcm_get_stats(zcm, &stats));
+    uint64_t ret = 0;
+    for (uint32_t i = 0; i < stats.nchannels; i++)
+        if (channel == stats.channels[i].channel)
+            ret = stats.channels[i].dropped[cause];
+    zcm_free_stats(&stats);
+    return ret;
+}
+
+// A worker stuck on one channel has the receive policy applied to its queue,
+// instead of holding up the channels of the other workers
+static void test_stuck_worker_drops()
+{
+    GatedTrans *trans = new GatedTrans();
+    vector<string> fastNames;
+    for (int i = 0; i < NUM_FAST_CHANNELS; i++)
+        fastNames.push_back("FAST" + to_string(i));
+    for (int i = 0; i < NUM_STUCK_MSGS; i++)
+        trans->add("STUCK", i);
+    for (int i = 0; i < NUM_PACED_MSGS; i++)
+        for (int c = 0; c < NUM_FAST_CHANNELS; c++)
+            trans->add(fastNames[c], i);
+
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    ENSURE(0 == zcm_set_dispatch_threads(zcm, NUM_THREADS));
+    ENSURE(0 == zcm_set_queue_size(zcm, ZCM_RECV_QUEUE, SMALL_QUEUE_SIZE));
+    ENSURE(0 == zcm_set_queue_policy(zcm, ZCM_RECV_QUEUE, ZCM_QUEUE_DROP_OLDEST));
+
+    StuckState stuck;
+    atomic<int> numFast[NUM_FAST_CHANNELS];
+    zcm_subscribe(zcm, "STUCK", stuckHandler, &stuck);
+    for (int c = 0; c < NUM_FAST_CHANNELS; c++) {
+        numFast[c] = 0;
+        zcm_subscribe(zcm, fastNames[c].c_str(), countHandler, &numFast[c]);
+    }
+
+    zcm_start(zcm);
+    ENSURE(waitUntil([&](){ return stuck.held.load(); }));
+    trans->open = true;
+    ENSURE(waitUntil([&](){ return trans->drained.load(); }));
+
+    // The fast channels queued behind the stuck one get dispatched nonetheless
+    auto anyFast = [&](){
+        for (int c = 0; c < NUM_FAST_CHANNELS; c++)
+            if (numFast[c] > 0)
+                return true;
+        return false;
+    };
+    ENSURE(waitUntil(anyFast));
+    ENSURE(stuck.numRecv == 1);
+
+    stuck.released = true;
+    usleep(100000);
+    zcm_stop(zcm);
+
+    // Whatever didn't make it was counted as dropped
+    ENSURE(stuck.numRecv + numDropped(zcm, "STUCK", ZCM_DROP_RECV_QUEUE_FULL) ==
+           NUM_STUCK_MSGS);
+    for (int c = 0; c < NUM_FAST_CHANNELS; c++)
+        ENSURE(numFast[c] + numDropped(zcm, fastNames[c], ZCM_DROP_RECV_QUEUE_FULL) ==
+               NUM_PACED_MSGS);
+    zcm_destroy(zcm);
+}
+
+// Messages waiting for a worker still count towards their channel's limit
+static void test_worker_queue_limit()
+{
+    GatedTrans *trans = new GatedTrans();
+    for (int i = 0; i < NUM_STUCK_MSGS; i++)
+        trans->add("STUCK", i);
+
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    ENSURE(0 == zcm_set_dispatch_threads(zcm, NUM_THREADS));
+    ENSURE(0 == zcm_set_queue_size(zcm, ZCM_RECV_QUEUE, 64));
+    ENSURE(0 == zcm_set_channel_queue_size(zcm, ZCM_RECV_QUEUE, "STUCK",
+                                           STUCK_CHANNEL_LIMIT));
+
+    StuckState stuck;
+    zcm_subscribe(zcm, "STUCK", stuckHandler, &stuck);
+
+    zcm_start(zcm);
+    ENSURE(waitUntil([&](){ return stuck.held.load(); }));
+    trans->open = true;
+    uint64_t numOver = NUM_STUCK_MSGS - 1 - STUCK_CHANNEL_LIMIT;
+    ENSURE(waitUntil([&](){
+        return numDropped(zcm, "STUCK", ZCM_DROP_RECV_CHANNEL_LIMIT) == numOver;
+    }));
+
+    stuck.released = true;
+    ENSURE(waitUntil([&](){ return stuck.numRecv == 1 + STUCK_CHANNEL_LIMIT; }));
+    usleep(100000);
+    zcm_stop(zcm);
+    ENSURE(stuck.numRecv == 1 + STUCK_CHANNEL_LIMIT);
+    ENSURE(numDropped(zcm, "STUCK", ZCM_DROP_RECV_CHANNEL_LIMIT) == numOver);
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_slow_channel();
+    test_stuck_worker_drops();
+    test_worker_queue_limit();
+    return 0;
+}
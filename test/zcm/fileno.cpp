@@ -0,0 +1,161 @@
+#include "zcm/zcm.h"
+#include "test_trans.hpp"
+
+#include <unistd.h>
+#include <poll.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+using namespace std;
+
+// A blocking transport that receives messages on 'channel' as long as fewer than
+// 'avail' were received so far. Every message carries its index.
+struct StepTrans : public TestTrans
+{
+    string channel = "A";
+    atomic<int> avail {0};
+    atomic<int> next {0};
+    int value = 0;
+
+    // Let 'n' more messages in and wait until the recv thread took them all
+    void release(int n)
+    {
+        avail += n;
+        while (next < avail) usleep(1000);
+        usleep(10000);
+    }
+
+    int recvmsg(zcm_msg_t *msg, int timeout) override
+    {
+        int n = next;
+        if (n == avail) {
+            usleep(1000);
+            return ZCM_EAGAIN;
+        }
+        value = n;
+        msg->utime = 0;
+        msg->channel = channel.c_str();
+        msg->len = sizeof(value);
+        msg->buf = (char*)&value;
+        next = n + 1;
+        return ZCM_EOK;
+    }
+};
+
+static bool readable(int fd, int timeoutMs)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    return poll(&pfd, 1, timeoutMs) == 1 && (pfd.revents & POLLIN);
+}
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    ((vector<int>*)usr)->push_back(*(int*)rbuf->data);
+}
+
+static void test_ready()
+{
+    StepTrans *trans = new StepTrans();
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    vector<int> values;
+    ENSURE(zcm_subscribe(zcm, "A", handler, &values));
+
+    int fd = zcm_get_fileno(zcm);
+    ENSURE(fd >= 0);
+    ENSURE(zcm_get_fileno(zcm) == fd);
+    ENSURE(!readable(fd, 20));
+    ENSURE(0 == zcm_handle_ready(zcm, 10));
+
+    // Stays readable until everything was dispatched
+    trans->release(5);
+    ENSURE(readable(fd, 0));
+    ENSURE(2 == zcm_handle_ready(zcm, 2));
+    ENSURE(readable(fd, 0));
+    ENSURE(3 == zcm_handle_ready(zcm, 10));
+    ENSURE(!readable(fd, 0));
+    ENSURE(0 == zcm_handle_ready(zcm, 10));
+
+    trans->release(3);
+    ENSURE(readable(fd, 1000));
+    ENSURE(3 == zcm_handle_ready(zcm, 10));
+    ENSURE(!readable(fd, 0));
+
+    ENSURE(values.size() == 8);
+    for (int i = 0; i < 8; i++)
+        ENSURE(values[i] == i);
+
+    zcm_destroy(zcm);
+}
+
+// Messages received by zcm_handle() before there was a descriptor still make it readable
+static void test_late_fileno()
+{
+    StepTrans *trans = new StepTrans();
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    vector<int> values;
+    ENSURE(zcm_subscribe(zcm, "A", handler, &values));
+
+    trans->avail = 3;
+    ENSURE(0 == zcm_handle(zcm));
+    trans->release(0);
+    int fd = zcm_get_fileno(zcm);
+    ENSURE(fd >= 0);
+    ENSURE(readable(fd, 0));
+    ENSURE(2 == zcm_handle_ready(zcm, 10));
+    ENSURE(!readable(fd, 0));
+    ENSURE(values.size() == 3);
+
+    zcm_destroy(zcm);
+}
+
+static void test_conflated()
+{
+    StepTrans *trans = new StepTrans();
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    ENSURE(0 == zcm_set_channel_conflate(zcm, "A", 1));
+    vector<int> values;
+    ENSURE(zcm_subscribe(zcm, "A", handler, &values));
+
+    int fd = zcm_get_fileno(zcm);
+    ENSURE(fd >= 0);
+    trans->release(4);
+    ENSURE(readable(fd, 0));
+    ENSURE(1 == zcm_handle_ready(zcm, 10));
+    ENSURE(!readable(fd, 0));
+    ENSURE(values.size() == 1 && values[0] == 3);
+
+    zcm_destroy(zcm);
+}
+
+static void test_invalid()
+{
+    zcm_t *zcm = zcm_create_trans(new StepTrans());
+    ENSURE(zcm);
+
+    zcm_start(zcm);
+    ENSURE(-1 == zcm_get_fileno(zcm));
+    ENSURE(ZCM_EINVALID == zcm_errno(zcm));
+    ENSURE(-1 == zcm_handle_ready(zcm, 1));
+    ENSURE(ZCM_EINVALID == zcm_errno(zcm));
+    zcm_stop(zcm);
+
+    ENSURE(zcm_get_fileno(zcm) >= 0);
+    ENSURE(0 == zcm_handle_ready(zcm, 1));
+
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_ready();
+    test_late_fileno();
+    test_conflated();
+    test_invalid();
+    return 0;
+}
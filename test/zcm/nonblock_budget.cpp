@@ -0,0 +1,117 @@
+#include "zcm/zcm-cpp.hpp"
+#include "test_trans.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+using namespace std;
+
+#define NUM_MSGS 25
+#define MAX_BATCH 4
+
+// A nonblocking transport with NUM_MSGS messages ready, which it hands out one
+// at a time or, if 'batch' is set, up to MAX_BATCH at a time
+struct BudgetTrans : public TestTrans
+{
+    int next = 0;
+    int numUpdates = 0;
+    int bufs[MAX_BATCH];
+
+    BudgetTrans(bool batch) : TestTrans(ZCM_NONBLOCKING)
+    {
+        if (batch) useRecvmsgBatch();
+    }
+
+    int recvmsg(zcm_msg_t *msg, int timeout) override
+    {
+        size_t n = 1;
+        return recvmsgBatch(msg, &n, timeout);
+    }
+
+    int recvmsgBatch(zcm_msg_t *msgs, size_t *nmsgs, int timeout) override
+    {
+        size_t n = 0;
+        while (n < *nmsgs && n < MAX_BATCH && next < NUM_MSGS) {
+            bufs[n] = next++;
+            msgs[n].utime = 0;
+            msgs[n].channel = "BUDGET";
+            msgs[n].len = sizeof(int);
+            msgs[n].buf = (char*)&bufs[n];
+            n++;
+        }
+        *nmsgs = n;
+        return n > 0 ? ZCM_EOK : ZCM_EAGAIN;
+    }
+
+    int update() override
+    {
+        numUpdates++;
+        return ZCM_EOK;
+    }
+};
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    ((vector<int>*)usr)->push_back(*(int*)rbuf->data);
+}
+
+static void cppHandler(const zcm::ReceiveBuffer *rbuf, const string& channel, void *usr)
+{
+    handler(rbuf, channel.c_str(), usr);
+}
+
+// A clock that moves 100us ahead every time it is read
+static uint64_t fakeNow(void *usr)
+{
+    uint64_t *now = (uint64_t*)usr;
+    *now += 100;
+    return *now;
+}
+
+static void test_msg_budget(bool batch)
+{
+    BudgetTrans *trans = new BudgetTrans(batch);
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    vector<int> values;
+    ENSURE(zcm_subscribe(zcm, "BUDGET", handler, &values));
+
+    // A batch never goes past the budget
+    ENSURE(3 == zcm_handle_nonblock_budget(zcm, 3, 0, NULL, NULL));
+    ENSURE(10 == zcm_handle_nonblock_budget(zcm, 10, 0, NULL, NULL));
+    ENSURE(NUM_MSGS - 13 == zcm_handle_nonblock_budget(zcm, 0, 0, NULL, NULL));
+    ENSURE(0 == zcm_handle_nonblock_budget(zcm, 0, 0, NULL, NULL));
+
+    ENSURE(values.size() == NUM_MSGS);
+    for (int i = 0; i < NUM_MSGS; i++)
+        ENSURE(values[i] == i);
+
+    zcm_destroy(zcm);
+}
+
+static void test_time_budget()
+{
+    BudgetTrans *trans = new BudgetTrans(true);
+    zcm::ZCM zcm(trans);
+    ENSURE(zcm.good());
+    vector<int> values;
+    ENSURE(zcm.subscribe("BUDGET", cppHandler, &values));
+
+    // The clock is read before the first batch and after each one
+    uint64_t now = 0;
+    ENSURE(3 * MAX_BATCH == zcm.handleNonblock(0, 250, fakeNow, &now));
+    ENSURE(trans->numUpdates == 3);
+    ENSURE(2 == zcm.handleNonblock(2, 1000, fakeNow, &now));
+    ENSURE(NUM_MSGS - 3 * MAX_BATCH - 2 == zcm.handleNonblock(0));
+    ENSURE(values.size() == NUM_MSGS);
+}
+
+int main()
+{
+    test_msg_budget(false);
+    test_msg_budget(true);
+    test_time_budget();
+    return 0;
+}
@@ -0,0 +1,209 @@
+#include "zcm/zcm.h"
+#include "test_trans.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+using namespace std;
+
+// The defaults of ZCM_NONBLOCK_SUBS_MAX and ZCM_NONBLOCK_COMPILED_SUBS_MAX
+#define SUBS_MAX 16
+#define COMPILED_SUBS_MAX 4
+
+// A nonblocking transport that receives whatever was queued with add() and
+// counts how many times each channel was enabled and disabled
+struct EnableTrans : public TestTrans
+{
+    vector<string> channels;
+    size_t next = 0;
+    int value = 0;
+    map<string, int> enabled, disabled;
+
+    EnableTrans() : TestTrans(ZCM_NONBLOCKING) {}
+
+    int recvmsgEnable(const char *channel, bool enable) override
+    {
+        (enable ? enabled : disabled)[channel ? channel : ""]++;
+        return ZCM_EOK;
+    }
+
+    int recvmsg(zcm_msg_t *msg, int timeout) override
+    {
+        if (next == channels.size())
+            return ZCM_EAGAIN;
+        value = (int)next;
+        msg->utime = 0;
+        msg->channel = channels[next].c_str();
+        msg->len = sizeof(value);
+        msg->buf = (char*)&value;
+        next++;
+        return ZCM_EOK;
+    }
+};
+
+// Every callback records which subscription it was called for
+static vector<int> calls;
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    calls.push_back((int)(intptr_t)usr);
+}
+
+static vector<int> dispatch(zcm_t *zcm, EnableTrans *trans, const string& channel)
+{
+    calls.clear();
+    trans->channels.push_back(channel);
+    ENSURE(ZCM_EOK == zcm_handle_nonblock(zcm));
+    ENSURE(ZCM_EOK != zcm_handle_nonblock(zcm));
+    return calls;
+}
+
+static void test_dispatch()
+{
+    EnableTrans *trans = new EnableTrans();
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+
+    ENSURE(zcm_subscribe(zcm, "POSE_ALL.*", handler, (void*)1));
+    ENSURE(zcm_subscribe(zcm, "POSE", handler, (void*)2));
+    zcm_sub_t *imu = zcm_subscribe(zcm, "IMU", handler, (void*)3);
+    ENSURE(imu);
+    zcm_sub_t *pose = zcm_subscribe(zcm, "POSE", handler, (void*)4);
+    ENSURE(pose);
+    ENSURE(zcm_subscribe(zcm, "POSE.*", handler, (void*)5));
+
+    // Exact subscriptions first, each kind in the order they were made
+    ENSURE(dispatch(zcm, trans, "POSE") == vector<int>({2, 4, 5}));
+    ENSURE(dispatch(zcm, trans, "IMU") == vector<int>({3}));
+    ENSURE(dispatch(zcm, trans, "POSE_ALL_X") == vector<int>({1, 5}));
+    ENSURE(dispatch(zcm, trans, "POS").empty());
+    ENSURE(dispatch(zcm, trans, "OTHER").empty());
+
+    // Other regexes are compiled, and like "prefix.*" have to match the whole channel
+    zcm_sub_t *cam = zcm_subscribe(zcm, "CAM_(LEFT|RIGHT)", handler, (void*)6);
+    ENSURE(cam);
+    ENSURE(zcm_subscribe(zcm, "[A-Z_]+_[0-9]+", handler, (void*)7));
+    ENSURE(dispatch(zcm, trans, "CAM_LEFT") == vector<int>({6}));
+    ENSURE(dispatch(zcm, trans, "CAM_LEFTX").empty());
+    ENSURE(dispatch(zcm, trans, "POSE_ALL_12") == vector<int>({1, 5, 7}));
+    ENSURE(dispatch(zcm, trans, "IMU_3") == vector<int>({7}));
+    ENSURE(ZCM_EOK == zcm_unsubscribe(zcm, cam));
+    ENSURE(dispatch(zcm, trans, "CAM_RIGHT").empty());
+
+    // The transport only stops receiving a channel with its last subscription
+    ENSURE(ZCM_EOK == zcm_unsubscribe(zcm, pose));
+    ENSURE(trans->disabled.count("POSE") == 0);
+    ENSURE(dispatch(zcm, trans, "POSE") == vector<int>({2, 5}));
+    ENSURE(ZCM_EINVALID == zcm_unsubscribe(zcm, pose));
+    ENSURE(ZCM_EOK == zcm_unsubscribe(zcm, imu));
+    ENSURE(trans->disabled["IMU"] == 1);
+    ENSURE(dispatch(zcm, trans, "IMU").empty());
+
+    zcm_destroy(zcm);
+}
+
+static void test_limits()
+{
+    EnableTrans *trans = new EnableTrans();
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+
+    string longName(ZCM_CHANNEL_MAXLEN + 1, 'x');
+    ENSURE(!zcm_subscribe(zcm, longName.c_str(), handler, NULL));
+    ENSURE(!zcm_subscribe(zcm, "A(B", handler, NULL));
+    ENSURE(!zcm_subscribe(zcm, "A.{2}", handler, NULL));
+    ENSURE(trans->enabled.empty());
+
+    // Only so many regexes can be compiled at once, while "prefix.*" needs none
+    vector<zcm_sub_t*> regexes;
+    for (int i = 0; i < COMPILED_SUBS_MAX; i++) {
+        regexes.push_back(zcm_subscribe(zcm, ("R" + to_string(i) + "+").c_str(),
+                                        handler, (void*)(intptr_t)(200 + i)));
+        ENSURE(regexes.back());
+    }
+    ENSURE(!zcm_subscribe(zcm, "R+", handler, NULL));
+    zcm_sub_t *prefix = zcm_subscribe(zcm, "R.*", handler, (void*)300);
+    ENSURE(prefix);
+    ENSURE(dispatch(zcm, trans, "R11") == vector<int>({201, 300}));
+    ENSURE(ZCM_EOK == zcm_unsubscribe(zcm, regexes[1]));
+    regexes[1] = zcm_subscribe(zcm, "R+", handler, (void*)204);
+    ENSURE(regexes[1]);
+    ENSURE(dispatch(zcm, trans, "RR") == vector<int>({300, 204}));
+    ENSURE(ZCM_EOK == zcm_unsubscribe(zcm, prefix));
+    for (auto *sub : regexes)
+        ENSURE(ZCM_EOK == zcm_unsubscribe(zcm, sub));
+
+    vector<zcm_sub_t*> subs;
+    for (int i = 0; i < SUBS_MAX; i++) {
+        subs.push_back(zcm_subscribe(zcm, ("CH" + to_string(i)).c_str(), handler,
+                                     (void*)(intptr_t)i));
+        ENSURE(subs.back());
+    }
+    ENSURE(!zcm_subscribe(zcm, "FULL", handler, NULL));
+    ENSURE(trans->enabled.count("FULL") == 0);
+
+    // Room is made by unsubscribing
+    ENSURE(ZCM_EOK == zcm_unsubscribe(zcm, subs[3]));
+    ENSURE(zcm_subscribe(zcm, "FULL", handler, (void*)100));
+    ENSURE(dispatch(zcm, trans, "FULL") == vector<int>({100}));
+    ENSURE(dispatch(zcm, trans, "CH3").empty());
+    ENSURE(dispatch(zcm, trans, "CH4") == vector<int>({4}));
+
+    zcm_destroy(zcm);
+}
+
+// Random subscribing and unsubscribing against a plain list of subscriptions
+static void test_random()
+{
+    EnableTrans *trans = new EnableTrans();
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+
+    struct Sub { string channel; zcm_sub_t *sub; int id; };
+    vector<Sub> model;
+    // Enough channels for the hash table to have clusters, the wildcard one last
+    vector<string> channels = {"A", "AB", "ABC"};
+    for (int i = 0; i < 20; i++)
+        channels.push_back("CH" + to_string(i));
+    channels.push_back("A.*");
+    srand(7);
+
+    for (int round = 0; round < 20000; round++) {
+        if (!model.empty() && (model.size() == SUBS_MAX || rand() % 2)) {
+            size_t i = rand() % model.size();
+            ENSURE(ZCM_EOK == zcm_unsubscribe(zcm, model[i].sub));
+            model.erase(model.begin() + i);
+        } else {
+            string channel = channels[rand() % channels.size()];
+            zcm_sub_t *sub = zcm_subscribe(zcm, channel.c_str(), handler,
+                                           (void*)(intptr_t)round);
+            ENSURE(sub);
+            model.push_back({channel, sub, round});
+        }
+
+        string channel = channels[rand() % (channels.size() - 1)];
+        vector<int> exact, prefix;
+        for (auto& s : model) {
+            if (s.channel == channel)
+                exact.push_back(s.id);
+            else if (s.channel == "A.*" && channel[0] == 'A')
+                prefix.push_back(s.id);
+        }
+        exact.insert(exact.end(), prefix.begin(), prefix.end());
+        ENSURE(dispatch(zcm, trans, channel) == exact);
+    }
+
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_dispatch();
+    test_limits();
+    test_random();
+    return 0;
+}
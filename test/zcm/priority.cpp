@@ -0,0 +1,206 @@
+#include "zcm/zcm.h"
+#include "test_trans.hpp"
+
+#include <unistd.h>
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+using namespace std;
+
+// The flood: 100 kB every ms is 100 MB/s, twice what the bulk handler keeps up with
+#define BULK_SIZE (100 * 1000)
+#define BULK_PERIOD_US 1000
+#define BULK_HANDLER_US 2000
+#define CONTROL_EVERY 10
+#define FLOOD_US 300000
+
+static uint64_t utime()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// A blocking transport that receives either a scripted list of messages, the
+// rest of which only once 'released' is set, or, once 'flood' is set, an endless
+// paced stream of BULK messages with a CONTROL message every CONTROL_EVERY of them
+struct FloodTrans : public TestTrans
+{
+    vector<string> channels;
+    atomic<size_t> next {0};
+    atomic<bool> released {false};
+
+    bool flood = false;
+    uint64_t nextUtime = 0;
+    vector<char> data = vector<char>(BULK_SIZE);
+
+    size_t getMtu() override { return BULK_SIZE; }
+
+    int recvmsg(zcm_msg_t *msg, int timeout) override
+    {
+        size_t n = next;
+        if (flood) {
+            uint64_t now = utime();
+            if (now < nextUtime)
+                usleep(nextUtime - now);
+            nextUtime = max(now, nextUtime) + BULK_PERIOD_US;
+            msg->channel = n % CONTROL_EVERY == 0 ? "CONTROL" : "BULK";
+        } else {
+            if (n == channels.size() || (n == 1 && !released))
+                return idle(timeout);
+            msg->channel = channels[n].c_str();
+        }
+        msg->utime = utime();
+        msg->len = strcmp(msg->channel, "BULK") == 0 ? BULK_SIZE : sizeof(int);
+        msg->buf = data.data();
+        next = n + 1;
+        return ZCM_EOK;
+    }
+};
+
+struct Order
+{
+    FloodTrans *trans;
+    vector<string> channels;
+};
+
+// Holds up the first message until the recv thread has queued everything else
+static void orderHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    Order *o = (Order*)usr;
+    if (o->channels.empty()) {
+        o->trans->released = true;
+        while (o->trans->next < o->trans->channels.size()) usleep(1000);
+        usleep(50000);
+    }
+    o->channels.push_back(channel);
+}
+
+static void test_order()
+{
+    FloodTrans *trans = new FloodTrans();
+    const char *script[] = {"BULK", "BULK", "BULK", "CONTROL", "BULK", "CONTROL", "BULK"};
+    for (const char *channel : script)
+        trans->channels.push_back(channel);
+
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    ENSURE(0 == zcm_set_channel_priority(zcm, "CONTROL", ZCM_PRIORITY_HIGH));
+
+    Order o;
+    o.trans = trans;
+    ENSURE(zcm_subscribe(zcm, "BULK", orderHandler, &o));
+    ENSURE(zcm_subscribe(zcm, "CONTROL", orderHandler, &o));
+    for (size_t i = 0; i < trans->channels.size(); i++)
+        ENSURE(0 == zcm_handle(zcm));
+
+    // Whatever was waiting in the priority lane went first, in order
+    const char *expected[] = {"BULK", "CONTROL", "CONTROL", "BULK", "BULK", "BULK", "BULK"};
+    ENSURE(o.channels.size() == trans->channels.size());
+    for (size_t i = 0; i < o.channels.size(); i++)
+        ENSURE(o.channels[i] == expected[i]);
+
+    zcm_destroy(zcm);
+}
+
+static void bulkHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    usleep(BULK_HANDLER_US);
+}
+
+static void controlHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    uint64_t *maxLatency = (uint64_t*)usr;
+    uint64_t latency = utime() - rbuf->recv_utime;
+    if (latency > *maxLatency)
+        *maxLatency = latency;
+}
+
+// Returns the worst latency of the control messages, from being received to being
+// dispatched, while the bulk channel keeps the receive queue full
+static uint64_t floodLatency(bool priority)
+{
+    FloodTrans *trans = new FloodTrans();
+    trans->flood = true;
+
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    uint64_t maxLatency = 0;
+    ENSURE(zcm_subscribe(zcm, "BULK", bulkHandler, NULL));
+    ENSURE(zcm_subscribe(zcm, "CONTROL", controlHandler, &maxLatency));
+    if (priority)
+        ENSURE(0 == zcm_set_channel_priority(zcm, "CONTROL", ZCM_PRIORITY_HIGH));
+
+    zcm_start(zcm);
+    usleep(FLOOD_US);
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+
+    return maxLatency;
+}
+
+static void test_flood()
+{
+    uint64_t fifo = floodLatency(false);
+    uint64_t prio = floodLatency(true);
+
+    // Behind a full queue of bulk messages a control message waits for all of them,
+    // with its own lane only for the one being dispatched
+    ENSURE(fifo > 8 * BULK_HANDLER_US);
+    ENSURE(prio < 4 * BULK_HANDLER_US);
+}
+
+static void countHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    (*(atomic<int>*)usr)++;
+}
+
+// The consumer switches over to the priority lane while it is waiting
+static void test_switch()
+{
+    FloodTrans *trans = new FloodTrans();
+    trans->flood = true;
+
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    atomic<int> numControl {0};
+    ENSURE(zcm_subscribe(zcm, "CONTROL", countHandler, &numControl));
+
+    zcm_start(zcm);
+    usleep(FLOOD_US / 4);
+    ENSURE(0 == zcm_set_channel_priority(zcm, "CONTROL", ZCM_PRIORITY_HIGH));
+    numControl = 0;
+    usleep(FLOOD_US / 4);
+    ENSURE(numControl > 0);
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+}
+
+static void test_invalid()
+{
+    zcm_t *zcm = zcm_create_trans(new FloodTrans());
+    ENSURE(zcm);
+
+    string longName(ZCM_CHANNEL_MAXLEN + 1, 'x');
+    ENSURE(-1 == zcm_set_channel_priority(zcm, longName.c_str(), ZCM_PRIORITY_HIGH));
+    ENSURE(ZCM_EINVALID == zcm_errno(zcm));
+    ENSURE(-1 == zcm_set_channel_priority(zcm, "A", (zcm_priority)7));
+    ENSURE(ZCM_EINVALID == zcm_errno(zcm));
+    ENSURE(0 == zcm_set_channel_priority(zcm, "A", ZCM_PRIORITY_HIGH));
+    ENSURE(0 == zcm_set_channel_priority(zcm, "A", ZCM_PRIORITY_NORMAL));
+
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_order();
+    test_flood();
+    test_switch();
+    test_invalid();
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include "zcm/zcm-cpp.hpp"
+#include "test_trans.hpp"
+
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <mutex>
+using namespace std;
+
+#define MTU 1024
+
+// A blocking transport that records what it sends
+struct RecordTrans : public TestTrans
+{
+    mutex sentmut;
+    vector<string> channels;
+    vector<string> sent;
+
+    size_t getMtu() override { return MTU; }
+
+    int sendmsg(zcm_msg_t msg) override
+    {
+        unique_lock<mutex> lk(sentmut);
+        channels.push_back(msg.channel);
+        sent.push_back(string(msg.buf, msg.len));
+        return ZCM_EOK;
+    }
+};
+
+// Stands in for a generated type, ZCM::publish() only needs these two
+struct text_t
+{
+    string text;
+
+    int64_t getEncodedSize() const { return text.size(); }
+
+    int64_t encode(void *buf, uint32_t offset, uint32_t maxlen) const
+    {
+        memcpy((char*)buf + offset, text.data(), text.size());
+        return text.size();
+    }
+};
+
+static void test_loans()
+{
+    RecordTrans *trans = new RecordTrans();
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+
+    char *buf = (char*)zcm_publish_loan(zcm, 5);
+    ENSURE(buf);
+    memcpy(buf, "hello", 5);
+    ENSURE(0 == zcm_publish_commit(zcm, "A", buf, 5));
+
+    // Committing less than was asked for
+    buf = (char*)zcm_publish_loan(zcm, 100);
+    ENSURE(buf);
+    memcpy(buf, "bye", 3);
+    ENSURE(0 == zcm_publish_commit(zcm, "B", buf, 3));
+
+    // Buffers are reused instead of allocated again
+    zcm_flush(zcm);
+    buf = (char*)zcm_publish_loan(zcm, 10);
+    ENSURE(buf);
+    zcm_publish_cancel(zcm, buf);
+    char *again = (char*)zcm_publish_loan(zcm, 10);
+    ENSURE(again == buf);
+
+    // A failed commit still hands the buffer back
+    ENSURE(-1 == zcm_publish_commit(zcm, "A", again, MTU + 1));
+    ENSURE(ZCM_EINVALID == zcm_errno(zcm));
+    string longName(ZCM_CHANNEL_MAXLEN + 1, 'x');
+    buf = (char*)zcm_publish_loan(zcm, 10);
+    ENSURE(-1 == zcm_publish_commit(zcm, longName.c_str(), buf, 1));
+
+    ENSURE(NULL == zcm_publish_loan(zcm, MTU + 1));
+    ENSURE(ZCM_EINVALID == zcm_errno(zcm));
+    zcm_flush(zcm);
+
+    unique_lock<mutex> lk(trans->sentmut);
+    ENSURE(trans->sent.size() == 2);
+    ENSURE(trans->channels[0] == "A" && trans->sent[0] == "hello");
+    ENSURE(trans->channels[1] == "B" && trans->sent[1] == "bye");
+    lk.unlock();
+
+    zcm_destroy(zcm);
+}
+
+static void test_typed_publish()
+{
+    RecordTrans *trans = new RecordTrans();
+    zcm::ZCM zcm(trans);
+    ENSURE(zcm.good());
+    ENSURE(0 == zcm.setQueueSize(ZCM_SEND_QUEUE, 128));
+
+    text_t msg;
+    for (int i = 0; i < 100; i++) {
+        msg.text = "msg" + to_string(i);
+        ENSURE(0 == zcm.publish("TEXT", &msg));
+    }
+    zcm.flush();
+
+    unique_lock<mutex> lk(trans->sentmut);
+    ENSURE(trans->sent.size() == 100);
+    for (int i = 0; i < 100; i++)
+        ENSURE(trans->channels[i] == "TEXT" && trans->sent[i] == "msg" + to_string(i));
+}
+
+int main()
+{
+    test_loans();
+    test_typed_publish();
+    return 0;
+}
@@ -0,0 +1,208 @@
+#include "zcm/zcm.h"
+#include "zcm/transport_registrar.h"
+#include "test_trans.hpp"
+
+#include <cstring>
+#include <mutex>
+using namespace std;
+
+// A ScriptTrans whose sendmsg() waits until 'sendOpen' is set
+struct SendTrans : public ScriptTrans
+{
+    atomic<bool> sendOpen {true};
+    mutex sentmut;
+    vector<int> sent;
+
+    int sendmsg(zcm_msg_t msg) override
+    {
+        while (!sendOpen) usleep(1000);
+        unique_lock<mutex> lk(sentmut);
+        sent.push_back(*(int*)msg.buf);
+        return ZCM_EOK;
+    }
+};
+
+struct Received
+{
+    SendTrans *trans;
+    vector<string> channels;
+    vector<int> values;
+
+    vector<int> on(const string& channel) const
+    {
+        vector<int> ret;
+        for (size_t i = 0; i < values.size(); i++)
+            if (channels[i] == channel) ret.push_back(values[i]);
+        return ret;
+    }
+};
+
+// Holds up the first message until the transport ran out of messages, so the
+// receive queue overflows while the callback is busy
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    Received *r = (Received*)usr;
+    while (!r->trans->drained) usleep(1000);
+    r->channels.push_back(channel);
+    r->values.push_back(*(int*)rbuf->data);
+}
+
+static Received receiveAll(SendTrans *trans, zcm_queue_policy policy, uint32_t size,
+                           const char *limitChannel = NULL, uint32_t limit = 0)
+{
+    Received r;
+    r.trans = trans;
+
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    ENSURE(0 == zcm_set_queue_size(zcm, ZCM_RECV_QUEUE, size));
+    ENSURE(0 == zcm_set_queue_policy(zcm, ZCM_RECV_QUEUE, policy));
+    if (limitChannel)
+        ENSURE(0 == zcm_set_channel_queue_size(zcm, ZCM_RECV_QUEUE, limitChannel, limit));
+    zcm_subscribe(zcm, ".*", handler, &r);
+
+    zcm_start(zcm);
+    while (!trans->drained) usleep(1000);
+    usleep(200000);
+    zcm_stop(zcm);
+
+    // The queue can't be resized while it is in use
+    zcm_start(zcm);
+    ENSURE(-1 == zcm_set_queue_size(zcm, ZCM_RECV_QUEUE, size));
+    ENSURE(ZCM_EINVALID == zcm_errno(zcm));
+    zcm_stop(zcm);
+
+    zcm_destroy(zcm);
+    return r;
+}
+
+static void test_recv_drop_oldest()
+{
+    SendTrans *trans = new SendTrans();
+    for (int i = 0; i < 20; i++) trans->add("A", i);
+
+    Received r = receiveAll(trans, ZCM_QUEUE_DROP_OLDEST, 4);
+    vector<int> a = r.on("A");
+    ENSURE(a.size() == 4 || a.size() == 5);
+    for (int i = 0; i < 4; i++)
+        ENSURE(a[a.size() - 4 + i] == 16 + i);
+}
+
+static void test_recv_drop_newest()
+{
+    SendTrans *trans = new SendTrans();
+    for (int i = 0; i < 20; i++) trans->add("A", i);
+
+    Received r = receiveAll(trans, ZCM_QUEUE_DROP_NEWEST, 4);
+    vector<int> a = r.on("A");
+    ENSURE(a.size() == 4 || a.size() == 5);
+    for (size_t i = 0; i < a.size(); i++)
+        ENSURE(a[i] == (int)i);
+}
+
+static void test_recv_keep_latest()
+{
+    SendTrans *trans = new SendTrans();
+    for (int i = 0; i < 10; i++) {
+        trans->add("A", i);
+        trans->add("B", i);
+    }
+
+    Received r = receiveAll(trans, ZCM_QUEUE_KEEP_LATEST, 16);
+    vector<int> a = r.on("A"), b = r.on("B");
+    ENSURE(!a.empty() && !b.empty());
+    ENSURE(a.size() + b.size() <= 3);
+    ENSURE(a.back() == 9);
+    ENSURE(b.back() == 9);
+}
+
+static void test_recv_channel_limit()
+{
+    SendTrans *trans = new SendTrans();
+    for (int i = 0; i < 10; i++) {
+        trans->add("A", i);
+        trans->add("B", i);
+    }
+
+    Received r = receiveAll(trans, ZCM_QUEUE_DROP_OLDEST, 64, "A", 2);
+    vector<int> a = r.on("A"), b = r.on("B");
+    ENSURE(a.size() >= 2 && a.size() <= 3);
+    ENSURE(a[a.size() - 2] == 8 && a[a.size() - 1] == 9);
+    ENSURE(b.size() >= 9);
+    for (size_t i = 0; i < b.size(); i++)
+        ENSURE(b[i] == (int)(10 - b.size() + i));
+}
+
+static vector<int> sendAll(zcm_queue_policy policy, int n, int *numOk)
+{
+    SendTrans *trans = new SendTrans();
+    trans->sendOpen = false;
+
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    ENSURE(0 == zcm_set_queue_size(zcm, ZCM_SEND_QUEUE, 4));
+    ENSURE(0 == zcm_set_queue_policy(zcm, ZCM_SEND_QUEUE, policy));
+
+    *numOk = 0;
+    for (int i = 0; i < n; i++) {
+        if (zcm_publish(zcm, "A", &i, sizeof(i)) == 0)
+            (*numOk)++;
+        else
+            ENSURE(ZCM_EAGAIN == zcm_errno(zcm));
+    }
+
+    // The send queue can't be resized after the first publish
+    ENSURE(-1 == zcm_set_queue_size(zcm, ZCM_SEND_QUEUE, 8));
+
+    trans->sendOpen = true;
+    zcm_flush(zcm);
+    vector<int> sent = trans->sent;
+    zcm_destroy(zcm);
+    return sent;
+}
+
+static void test_send_policies()
+{
+    int numOk;
+
+    vector<int> sent = sendAll(ZCM_QUEUE_DROP_NEWEST, 10, &numOk);
+    ENSURE(numOk == 4 || numOk == 5);
+    ENSURE((int)sent.size() == numOk);
+    for (size_t i = 0; i < sent.size(); i++)
+        ENSURE(sent[i] == (int)i);
+
+    sent = sendAll(ZCM_QUEUE_DROP_OLDEST, 10, &numOk);
+    ENSURE(numOk == 10);
+    ENSURE(sent.size() == 4 || sent.size() == 5);
+    for (int i = 0; i < 4; i++)
+        ENSURE(sent[sent.size() - 4 + i] == 6 + i);
+}
+
+static zcm_trans_t *transport_script_create(zcm_url_t *url)
+{
+    return new SendTrans();
+}
+
+static void test_url_opts()
+{
+    ENSURE(zcm_transport_register("test-script", "", transport_script_create));
+
+    zcm_t *zcm = zcm_create("test-script://?queue_size=4&recv_queue_policy=keep_latest");
+    ENSURE(zcm);
+    zcm_destroy(zcm);
+
+    ENSURE(NULL == zcm_create("test-script://?queue_policy=bogus"));
+    ENSURE(NULL == zcm_create("test-script://?send_queue_size=0"));
+    ENSURE(NULL == zcm_create("test-script://?recv_queue_size=lots"));
+}
+
+int main()
+{
+    test_recv_drop_oldest();
+    test_recv_drop_newest();
+    test_recv_keep_latest();
+    test_recv_channel_limit();
+    test_send_policies();
+    test_url_opts();
+    return 0;
+}
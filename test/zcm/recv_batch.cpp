@@ -0,0 +1,110 @@
+#include "zcm/zcm.h"
+#include "test_trans.hpp"
+
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+using namespace std;
+
+#define NUM_MSGS 1000
+#define MAX_BATCH 7
+
+// A transport that only implements recvmsg_batch(), handing out at most
+// MAX_BATCH of its NUM_MSGS messages per call. Its buffers are overwritten on
+// every call, as the API allows, so reading a message too late is caught.
+struct BatchTrans : public TestTrans
+{
+    int next = 0;
+    int numCalls = 0;
+    int bufs[MAX_BATCH];
+
+    BatchTrans(zcm_type type) : TestTrans(type) { useRecvmsgBatch(); }
+
+    int recvmsg(zcm_msg_t *msg, int timeout) override
+    {
+        ENSURE(false && "recvmsg() must not be used when recvmsg_batch() is available");
+        return ZCM_EAGAIN;
+    }
+
+    int recvmsgBatch(zcm_msg_t *msgs, size_t *nmsgs, int timeout) override
+    {
+        ENSURE(*nmsgs > 0);
+        for (size_t i = 0; i < MAX_BATCH; i++) bufs[i] = -1;
+
+        if (next == NUM_MSGS) {
+            if (timeout > 0) usleep(timeout * 1000);
+            *nmsgs = 0;
+            return ZCM_EAGAIN;
+        }
+
+        numCalls++;
+        size_t n = 0;
+        for (; n < *nmsgs && n < MAX_BATCH && next < NUM_MSGS; n++) {
+            bufs[n] = next++;
+            msgs[n].utime = 0;
+            msgs[n].channel = "BATCH";
+            msgs[n].len = sizeof(int);
+            msgs[n].buf = (char*)&bufs[n];
+        }
+        *nmsgs = n;
+        return ZCM_EOK;
+    }
+};
+
+static atomic<int> numRecv {0};
+static atomic<bool> inOrder {true};
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    if (*(int*)rbuf->data != numRecv) inOrder = false;
+    numRecv++;
+}
+
+static void test_blocking()
+{
+    numRecv = 0;
+    BatchTrans *trans = new BatchTrans(ZCM_BLOCKING);
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    zcm_subscribe(zcm, "BATCH", handler, NULL);
+
+    zcm_start(zcm);
+    for (int i = 0; i < 500 && numRecv < NUM_MSGS; i++)
+        usleep(10000);
+    zcm_stop(zcm);
+
+    ENSURE(numRecv == NUM_MSGS);
+    ENSURE(inOrder);
+    ENSURE(trans->numCalls < NUM_MSGS / 2);
+    zcm_destroy(zcm);
+}
+
+static void test_nonblocking()
+{
+    numRecv = 0;
+    BatchTrans *trans = new BatchTrans(ZCM_NONBLOCKING);
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    zcm_subscribe(zcm, "BATCH", handler, NULL);
+
+    int numHandled = 0;
+    while (zcm_handle_nonblock(zcm) == ZCM_EOK)
+        numHandled++;
+
+    ENSURE(numRecv == NUM_MSGS);
+    ENSURE(inOrder);
+    ENSURE(numHandled == trans->numCalls);
+    ENSURE(numHandled < NUM_MSGS / 2);
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_blocking();
+    test_nonblocking();
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include "zcm/zcm.h"
+#include "test_trans.hpp"
+
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+using namespace std;
+
+#define SLOW_HANDLER_US 500000
+
+struct Counts
+{
+    zcm_sub_t *subA = nullptr;
+    atomic<int> numA {0};
+    atomic<int> numB {0};
+    atomic<bool> slowInflight {false};
+};
+static Counts counts;
+
+static void handlerB(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    counts.numB++;
+}
+
+// Swaps its own subscription for one on "B" from within the callback
+static void handlerA(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    counts.numA++;
+    ENSURE(0 == zcm_unsubscribe(rbuf->zcm, counts.subA));
+    ENSURE(zcm_subscribe(rbuf->zcm, "B", handlerB, NULL));
+}
+
+// Unsubscribes the others of the same message, which then aren't called for it
+static void handlerFirst(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    vector<zcm_sub_t*> *others = (vector<zcm_sub_t*>*)usr;
+    counts.numA++;
+    for (zcm_sub_t *sub : *others)
+        ENSURE(0 == zcm_unsubscribe(rbuf->zcm, sub));
+    others->clear();
+}
+
+static void slowHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    counts.slowInflight = true;
+    usleep(SLOW_HANDLER_US);
+    counts.slowInflight = false;
+}
+
+static void test_reentrant(bool useHandle)
+{
+    counts.numA = 0;
+    counts.numB = 0;
+
+    ScriptTrans *trans = new ScriptTrans();
+    trans->add("A", 0);
+    trans->add("A", 1);
+    trans->add("B", 0);
+
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    counts.subA = zcm_subscribe(zcm, "A", handlerA, NULL);
+    ENSURE(counts.subA);
+
+    if (useHandle) {
+        for (int i = 0; i < 3; i++)
+            ENSURE(0 == zcm_handle(zcm));
+    } else {
+        zcm_start(zcm);
+        for (int i = 0; i < 100 && counts.numB == 0; i++)
+            usleep(10000);
+        zcm_stop(zcm);
+    }
+    zcm_destroy(zcm);
+
+    ENSURE(counts.numA == 1);
+    ENSURE(counts.numB == 1);
+}
+
+static void test_unsubscribe_others()
+{
+    counts.numA = 0;
+    counts.numB = 0;
+
+    ScriptTrans *trans = new ScriptTrans();
+    trans->add("C", 0);
+    trans->add("C", 1);
+
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    vector<zcm_sub_t*> others;
+    ENSURE(zcm_subscribe(zcm, "C", handlerFirst, &others));
+    others.push_back(zcm_subscribe(zcm, "C", handlerB, NULL));
+    others.push_back(zcm_subscribe(zcm, "C.*", handlerB, NULL));
+    ENSURE(others[0] && others[1]);
+
+    for (int i = 0; i < 2; i++)
+        ENSURE(0 == zcm_handle(zcm));
+    zcm_destroy(zcm);
+
+    ENSURE(counts.numA == 2);
+    ENSURE(counts.numB == 0);
+}
+
+// Changing the subscriptions must not wait for a running callback
+static void test_concurrent(uint32_t numThreads)
+{
+    ScriptTrans *trans = new ScriptTrans();
+    trans->add("SLOW", 0);
+
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    ENSURE(0 == zcm_set_dispatch_threads(zcm, numThreads));
+    zcm_subscribe(zcm, ".*", slowHandler, NULL);
+    zcm_start(zcm);
+    while (!counts.slowInflight) usleep(1000);
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < 10; i++) {
+        zcm_sub_t *sub = zcm_subscribe(zcm, "OTHER.*", handlerB, NULL);
+        ENSURE(sub);
+        ENSURE(0 == zcm_unsubscribe(zcm, sub));
+    }
+    auto elapsed = chrono::steady_clock::now() - start;
+    ENSURE(counts.slowInflight);
+    ENSURE(elapsed < chrono::microseconds(SLOW_HANDLER_US / 2));
+
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_reentrant(false);
+    test_reentrant(true);
+    test_unsubscribe_others();
+    test_concurrent(1);
+    test_concurrent(4);
+    return 0;
+}
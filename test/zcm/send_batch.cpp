@@ -0,0 +1,123 @@
+#include "zcm/zcm.h"
+#include "test_trans.hpp"
+
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+using namespace std;
+
+#define NUM_MSGS 100
+
+// A blocking transport that records what it sends. Its sendmsg_batch() waits
+// until 'sendOpen' is set, so messages pile up in the send queue meanwhile
+struct BatchSendTrans : public TestTrans
+{
+    atomic<bool> sendOpen {true};
+    int failAt = -1; // value whose send fails
+
+    mutex sentmut;
+    vector<int> sent;
+    vector<size_t> batches;
+    size_t numSendmsg = 0;
+
+    BatchSendTrans() { useSendmsgBatch(); }
+
+    int sendmsg(zcm_msg_t msg) override
+    {
+        unique_lock<mutex> lk(sentmut);
+        numSendmsg++;
+        sent.push_back(*(int*)msg.buf);
+        return ZCM_EOK;
+    }
+
+    int sendmsgBatch(zcm_msg_t *msgs, size_t *nmsgs) override
+    {
+        while (!sendOpen) usleep(1000);
+        unique_lock<mutex> lk(sentmut);
+        batches.push_back(*nmsgs);
+        for (size_t i = 0; i < *nmsgs; i++) {
+            int v = *(int*)msgs[i].buf;
+            if (v == failAt) {
+                *nmsgs = i;
+                return ZCM_EUNKNOWN;
+            }
+            sent.push_back(v);
+        }
+        return ZCM_EOK;
+    }
+};
+
+static void publishAll(zcm_t *zcm, BatchSendTrans *trans)
+{
+    // Hold the transport up until everything is queued, so the send thread
+    // finds a backlog to hand over at once
+    trans->sendOpen = false;
+    for (int i = 0; i < NUM_MSGS; i++) {
+        const char *channel = (i % 2) ? "A" : "B";
+        ENSURE(0 == zcm_publish(zcm, channel, &i, sizeof(i)));
+    }
+    trans->sendOpen = true;
+    zcm_flush(zcm);
+}
+
+static void test_batches()
+{
+    BatchSendTrans *trans = new BatchSendTrans();
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    ENSURE(0 == zcm_set_queue_size(zcm, ZCM_SEND_QUEUE, 256));
+
+    publishAll(zcm, trans);
+
+    unique_lock<mutex> lk(trans->sentmut);
+    ENSURE(trans->numSendmsg == 0);
+    ENSURE(trans->sent.size() == NUM_MSGS);
+    for (int i = 0; i < NUM_MSGS; i++)
+        ENSURE(trans->sent[i] == i);
+
+    // The first message may be taken before the rest is queued, the others
+    // go out in few large batches
+    size_t total = 0;
+    for (size_t n : trans->batches) total += n;
+    ENSURE(total == NUM_MSGS);
+    ENSURE(trans->batches.size() <= 4);
+    lk.unlock();
+
+    zcm_destroy(zcm);
+}
+
+static void test_failure()
+{
+    BatchSendTrans *trans = new BatchSendTrans();
+    trans->failAt = NUM_MSGS / 2;
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    ENSURE(0 == zcm_set_queue_size(zcm, ZCM_SEND_QUEUE, 256));
+
+    // A failed batch drops what wasn't sent but doesn't hold up the queue
+    publishAll(zcm, trans);
+    int i = NUM_MSGS;
+    ENSURE(0 == zcm_publish(zcm, "A", &i, sizeof(i)));
+    zcm_flush(zcm);
+
+    unique_lock<mutex> lk(trans->sentmut);
+    ENSURE(trans->sent.size() >= NUM_MSGS / 2 + 1);
+    for (int v = 0; v < NUM_MSGS / 2; v++)
+        ENSURE(trans->sent[v] == v);
+    ENSURE(trans->sent.back() == NUM_MSGS);
+    lk.unlock();
+
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_batches();
+    test_failure();
+    return 0;
+}
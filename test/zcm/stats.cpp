@@ -0,0 +1,238 @@
+#include "zcm/zcm.h"
+#include "test_trans.hpp"
+
+#include <unistd.h>
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+using namespace std;
+
+#define RECV_AGE_US 1000
+// Channels that get their own statistics, see zcm_get_stats()
+#define STATS_MAX_CHANNELS 1024
+#define NUM_SHARED_MSGS 50000
+
+static uint64_t utime()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// A blocking transport that receives a scripted list of messages, stamped as
+// received RECV_AGE_US ago. Sending waits until 'sendOpen' is set and fails for
+// messages of 3 bytes.
+struct StatsTrans : public TestTrans
+{
+    atomic<bool> sendOpen {true};
+    atomic<bool> inSend {false};
+
+    vector<string> channels;
+    atomic<size_t> next {0};
+    int value = 0;
+
+    StatsTrans() { useGetStats(); }
+
+    int sendmsg(zcm_msg_t msg) override
+    {
+        inSend = true;
+        while (!sendOpen) usleep(1000);
+        inSend = false;
+        return msg.len == 3 ? ZCM_EUNKNOWN : ZCM_EOK;
+    }
+
+    int recvmsg(zcm_msg_t *msg, int timeout) override
+    {
+        if (next == channels.size())
+            return idle(timeout);
+        msg->utime = utime() - RECV_AGE_US;
+        msg->channel = channels[next].c_str();
+        msg->len = sizeof(value);
+        msg->buf = (char*)&value;
+        next++;
+        return ZCM_EOK;
+    }
+
+    void getStats(zcm_trans_stats_t *stats) override
+    {
+        stats->packets_received = 10;
+        stats->packets_discarded = 2;
+        stats->messages_lost = 1;
+    }
+};
+
+static const zcm_channel_stats_t *findChannel(const zcm_stats_t& stats, const char *channel)
+{
+    for (uint32_t i = 0; i < stats.nchannels; i++)
+        if (strcmp(stats.channels[i].channel, channel) == 0)
+            return &stats.channels[i];
+    return NULL;
+}
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    (*(int*)usr)++;
+}
+
+static void test_send()
+{
+    StatsTrans *trans = new StatsTrans();
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    ENSURE(0 == zcm_set_queue_size(zcm, ZCM_SEND_QUEUE, 4));
+    ENSURE(0 == zcm_set_channel_queue_size(zcm, ZCM_SEND_QUEUE, "L", 1));
+
+    // Hold the send thread up in the transport with the first message
+    int v = 0;
+    trans->sendOpen = false;
+    ENSURE(0 == zcm_publish(zcm, "A", &v, sizeof(v)));
+    while (!trans->inSend) usleep(1000);
+
+    ENSURE(0 == zcm_publish(zcm, "L", &v, sizeof(v)));
+    ENSURE(0 != zcm_publish(zcm, "L", &v, sizeof(v)));
+    for (int i = 0; i < 3; i++)
+        ENSURE(0 == zcm_publish(zcm, "A", &v, sizeof(v)));
+    for (int i = 0; i < 2; i++)
+        ENSURE(0 != zcm_publish(zcm, "A", &v, sizeof(v)));
+    usleep(20000);
+    trans->sendOpen = true;
+    zcm_flush(zcm);
+
+    ENSURE(0 == zcm_publish(zcm, "E", "abc", 3));
+    zcm_flush(zcm);
+
+    zcm_stats_t stats;
+    ENSURE(0 == zcm_get_stats(zcm, &stats));
+    ENSURE(stats.send_queue_high_water == 4);
+    ENSURE(stats.transport.packets_received == 10);
+    ENSURE(stats.transport.packets_discarded == 2);
+    ENSURE(stats.transport.messages_lost == 1);
+    ENSURE(stats.nchannels == 3);
+
+    const zcm_channel_stats_t *a = findChannel(stats, "A");
+    ENSURE(a);
+    ENSURE(a->published == 6 && a->published_bytes == 6 * sizeof(v));
+    ENSURE(a->sent == 4 && a->sent_bytes == 4 * sizeof(v));
+    ENSURE(a->dropped[ZCM_DROP_SEND_QUEUE_FULL] == 2);
+    ENSURE(a->dropped[ZCM_DROP_SEND_CHANNEL_LIMIT] == 0);
+    ENSURE(a->send_latency.count == 4);
+    ENSURE(a->send_latency.max_us >= 20000);
+    ENSURE(zcm_histogram_percentile(&a->send_latency, 100) >= a->send_latency.max_us);
+    ENSURE(a->received == 0 && a->dispatched == 0);
+    ENSURE(a->dispatch_latency.count == 0);
+    ENSURE(zcm_histogram_percentile(&a->dispatch_latency, 50) == 0);
+
+    const zcm_channel_stats_t *l = findChannel(stats, "L");
+    ENSURE(l);
+    ENSURE(l->published == 2 && l->sent == 1);
+    ENSURE(l->dropped[ZCM_DROP_SEND_CHANNEL_LIMIT] == 1);
+    ENSURE(l->dropped[ZCM_DROP_SEND_QUEUE_FULL] == 0);
+
+    const zcm_channel_stats_t *e = findChannel(stats, "E");
+    ENSURE(e);
+    ENSURE(e->published == 1 && e->sent == 0);
+    ENSURE(e->dropped[ZCM_DROP_SEND_ERROR] == 1);
+
+    zcm_free_stats(&stats);
+    ENSURE(stats.channels == NULL && stats.nchannels == 0);
+    zcm_destroy(zcm);
+}
+
+static void test_recv()
+{
+    StatsTrans *trans = new StatsTrans();
+    for (int i = 0; i < 10; i++)
+        trans->channels.push_back(i % 2 ? "R" : "UNSUBSCRIBED");
+
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    int numRecv = 0;
+    ENSURE(zcm_subscribe(zcm, "R", handler, &numRecv));
+    for (int i = 0; i < 10; i++)
+        ENSURE(0 == zcm_handle(zcm));
+    ENSURE(numRecv == 5);
+
+    zcm_stats_t stats;
+    ENSURE(0 == zcm_get_stats(zcm, &stats));
+    ENSURE(stats.recv_queue_high_water >= 1);
+
+    const zcm_channel_stats_t *r = findChannel(stats, "R");
+    ENSURE(r);
+    ENSURE(r->received == 5 && r->received_bytes == 5 * sizeof(int));
+    ENSURE(r->dispatched == 5);
+    ENSURE(r->dispatch_latency.count == 5);
+    ENSURE(r->dispatch_latency.sum_us >= 5 * RECV_AGE_US);
+    uint64_t p50 = zcm_histogram_percentile(&r->dispatch_latency, 50);
+    ENSURE(p50 >= RECV_AGE_US && p50 <= r->dispatch_latency.max_us);
+
+    const zcm_channel_stats_t *u = findChannel(stats, "UNSUBSCRIBED");
+    ENSURE(u);
+    ENSURE(u->received == 5 && u->dispatched == 0);
+    ENSURE(u->dispatch_latency.count == 0);
+
+    zcm_free_stats(&stats);
+    zcm_destroy(zcm);
+}
+
+struct Shared
+{
+    StatsTrans *trans;
+    atomic<int> numRecv {0};
+};
+
+// Holds every worker up until all messages are queued, so they then race each other
+static void sharedHandler(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+{
+    Shared *s = (Shared*)usr;
+    while (s->trans->next < s->trans->channels.size()) usleep(1000);
+    if (channel[0] == 'X')
+        s->numRecv++;
+}
+
+// The channels past the first STATS_MAX_CHANNELS share the counters of "", which
+// every dispatch worker writes to
+static void test_shared_channel_stats()
+{
+    StatsTrans *trans = new StatsTrans();
+    for (int i = 0; i < STATS_MAX_CHANNELS; i++)
+        trans->channels.push_back("C" + to_string(i));
+    for (int i = 0; i < NUM_SHARED_MSGS; i++)
+        trans->channels.push_back("X" + to_string(i % 64));
+
+    zcm_t *zcm = zcm_create_trans(trans);
+    ENSURE(zcm);
+    ENSURE(0 == zcm_set_dispatch_threads(zcm, 4));
+    ENSURE(0 == zcm_set_queue_size(zcm, ZCM_RECV_QUEUE, 2 * NUM_SHARED_MSGS));
+    Shared s;
+    s.trans = trans;
+    ENSURE(zcm_subscribe(zcm, ".*", sharedHandler, &s));
+    zcm_start(zcm);
+    while (trans->next < trans->channels.size()) usleep(1000);
+    usleep(200000);
+    zcm_stop(zcm);
+    int numRecv = s.numRecv;
+
+    zcm_stats_t stats;
+    ENSURE(0 == zcm_get_stats(zcm, &stats));
+    ENSURE(stats.nchannels == STATS_MAX_CHANNELS + 1);
+    const zcm_channel_stats_t *shared = findChannel(stats, "");
+    ENSURE(shared);
+    ENSURE(numRecv > 0);
+    ENSURE(shared->dispatched == (uint64_t)numRecv);
+    ENSURE(shared->dispatch_latency.count == (uint64_t)numRecv);
+
+    zcm_free_stats(&stats);
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_send();
+    test_recv();
+    test_shared_channel_stats();
+    return 0;
+}
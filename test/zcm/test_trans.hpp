@@ -0,0 +1,117 @@
+#pragma once
+
+#include "zcm/transport.h"
+
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#define ENSURE(v) do {\
+  if (!(v)) { \
+      fprintf(stderr, "ENSURE: failed for '" #v "' at %s:%d\n", __FILE__, __LINE__); \
+    exit(1);                                          \
+  }\
+} while(0)
+
+// A transport for tests to script by overriding only the methods they care about.
+// Left alone, it sends nothing anywhere and never receives anything. The optional
+// methods stay out of its vtbl until a subclass turns them on with use*()
+struct TestTrans : public zcm_trans_t
+{
+    TestTrans(zcm_type type = ZCM_BLOCKING)
+    {
+        trans_type = type;
+        vtbl = &methods;
+        methods = zcm_trans_methods_t();
+        methods.get_mtu = &TestTrans::getMtuFwd;
+        methods.sendmsg = &TestTrans::sendmsgFwd;
+        methods.recvmsg_enable = &TestTrans::recvmsgEnableFwd;
+        methods.recvmsg = &TestTrans::recvmsgFwd;
+        // Like the real transports, only the nonblocking ones have an update()
+        if (type == ZCM_NONBLOCKING)
+            methods.update = &TestTrans::updateFwd;
+        methods.destroy = &TestTrans::destroyFwd;
+    }
+    virtual ~TestTrans() {}
+
+    virtual size_t getMtu() { return 1024; }
+    virtual int sendmsg(zcm_msg_t msg) { return ZCM_EOK; }
+    virtual int recvmsgEnable(const char *channel, bool enable) { return ZCM_EOK; }
+    virtual int recvmsg(zcm_msg_t *msg, int timeout) { return idle(timeout); }
+    virtual int update() { return ZCM_EOK; }
+    virtual int recvmsgBatch(zcm_msg_t *msgs, size_t *nmsgs, int timeout)
+    {
+        *nmsgs = 0;
+        return idle(timeout);
+    }
+    virtual int sendmsgBatch(zcm_msg_t *msgs, size_t *nmsgs) { return ZCM_EOK; }
+    virtual void getStats(zcm_trans_stats_t *stats) {}
+
+  protected:
+    // What a transport with nothing to receive returns, after waiting if it blocks
+    int idle(int timeout)
+    {
+        if (trans_type == ZCM_BLOCKING && timeout > 0)
+            usleep(timeout * 1000);
+        return ZCM_EAGAIN;
+    }
+
+    void useRecvmsgBatch() { methods.recvmsg_batch = &TestTrans::recvmsgBatchFwd; }
+    void useSendmsgBatch() { methods.sendmsg_batch = &TestTrans::sendmsgBatchFwd; }
+    void useGetStats() { methods.get_stats = &TestTrans::getStatsFwd; }
+
+  private:
+    zcm_trans_methods_t methods;
+
+    static TestTrans *cast(zcm_trans_t *zt) { return static_cast<TestTrans*>(zt); }
+
+    static size_t getMtuFwd(zcm_trans_t *zt) { return cast(zt)->getMtu(); }
+    static int sendmsgFwd(zcm_trans_t *zt, zcm_msg_t msg) { return cast(zt)->sendmsg(msg); }
+    static int recvmsgEnableFwd(zcm_trans_t *zt, const char *channel, bool enable)
+    { return cast(zt)->recvmsgEnable(channel, enable); }
+    static int recvmsgFwd(zcm_trans_t *zt, zcm_msg_t *msg, int timeout)
+    { return cast(zt)->recvmsg(msg, timeout); }
+    static int updateFwd(zcm_trans_t *zt) { return cast(zt)->update(); }
+    static void destroyFwd(zcm_trans_t *zt) { delete cast(zt); }
+    static int recvmsgBatchFwd(zcm_trans_t *zt, zcm_msg_t *msgs, size_t *nmsgs, int timeout)
+    { return cast(zt)->recvmsgBatch(msgs, nmsgs, timeout); }
+    static int sendmsgBatchFwd(zcm_trans_t *zt, zcm_msg_t *msgs, size_t *nmsgs)
+    { return cast(zt)->sendmsgBatch(msgs, nmsgs); }
+    static void getStatsFwd(zcm_trans_t *zt, zcm_trans_stats_t *stats)
+    { cast(zt)->getStats(stats); }
+};
+
+// A transport that receives the messages added to it as fast as it can, each an int
+// on its channel, and then sets 'drained'
+struct ScriptTrans : public TestTrans
+{
+    std::vector<std::string> channels;
+    std::vector<int> values;
+    size_t next = 0;
+    std::atomic<bool> drained {false};
+
+    ScriptTrans(zcm_type type = ZCM_BLOCKING) : TestTrans(type) {}
+
+    void add(const std::string& channel, int value)
+    {
+        channels.push_back(channel);
+        values.push_back(value);
+    }
+
+    int recvmsg(zcm_msg_t *msg, int timeout) override
+    {
+        if (next == values.size()) {
+            drained = true;
+            return idle(timeout);
+        }
+        msg->utime = 0;
+        msg->channel = channels[next].c_str();
+        msg->len = sizeof(int);
+        msg->buf = (char*)&values[next];
+        next++;
+        return ZCM_EOK;
+    }
+};
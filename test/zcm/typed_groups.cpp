@@ -0,0 +1,253 @@
+#include "zcm/zcm-cpp.hpp"
+#include "test_trans.hpp"
+
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+using namespace std;
+
+#define NUM_MSGS 10
+#define NUM_RUNNING_MSGS 1000
+
+// Stand in for generated types, counting how often they are decoded
+template <int N>
+struct counted_t
+{
+    static int numDecodes;
+    int value;
+
+    static const char *getTypeName() { return "counted_t"; }
+
+    int64_t decode(const void *buf, uint32_t offset, uint32_t maxlen)
+    {
+        numDecodes++;
+        memcpy(&value, (const char*)buf + offset, sizeof(value));
+        return sizeof(value);
+    }
+};
+template <int N> int counted_t<N>::numDecodes = 0;
+
+typedef counted_t<0> a_t;
+typedef counted_t<1> b_t;
+
+struct Counter
+{
+    int numRecv = 0;
+    int sum = 0;
+
+    void handle(const zcm::ReceiveBuffer *rbuf, const string& channel, const a_t *msg)
+    {
+        numRecv++;
+        sum += msg->value;
+    }
+};
+
+static int numRaw = 0;
+static void rawHandler(const zcm::ReceiveBuffer *rbuf, const string& channel, void *usr)
+{
+    numRaw++;
+}
+
+static void typedHandler(const zcm::ReceiveBuffer *rbuf, const string& channel,
+                         const a_t *msg, void *usr)
+{
+    Counter *c = (Counter*)usr;
+    c->numRecv++;
+    c->sum += msg->value;
+}
+
+// Subscriptions are looked up when a message is dispatched, not when received
+static void handleAll(zcm::ZCM& zcm)
+{
+    for (int i = 0; i < NUM_MSGS; i++)
+        ENSURE(0 == zcm.handle());
+}
+
+static void test_groups()
+{
+    ScriptTrans *trans = new ScriptTrans();
+    const char *channels[] = {"POSE", "POSE", "OTHER"};
+    for (const char *channel : channels)
+        for (int i = 0; i < NUM_MSGS; i++)
+            trans->add(channel, i);
+
+    zcm::ZCM zcm(trans);
+    ENSURE(zcm.good());
+
+    Counter c1, c2, c3, c4;
+    zcm::Subscription *s1 = zcm.subscribe("POSE", typedHandler, &c1);
+    zcm.subscribe("POSE", &Counter::handle, &c2);
+    zcm.subscribe<a_t>("POSE", [&](const zcm::ReceiveBuffer *rbuf, const string& channel,
+                                   const a_t *msg) {
+        c3.numRecv++;
+        c3.sum += msg->value;
+    });
+    zcm.subscribe("POSE", rawHandler, NULL);
+    int numB = 0;
+    zcm.subscribe<b_t>("POSE", [&](const zcm::ReceiveBuffer *rbuf, const string& channel,
+                                   const b_t *msg) { numB++; });
+
+    // Three subscribers of one type decode once, the raw one doesn't decode at all
+    handleAll(zcm);
+    ENSURE(a_t::numDecodes == NUM_MSGS);
+    ENSURE(b_t::numDecodes == NUM_MSGS);
+    ENSURE(numRaw == NUM_MSGS && numB == NUM_MSGS);
+    ENSURE(c1.numRecv == NUM_MSGS && c2.numRecv == NUM_MSGS && c3.numRecv == NUM_MSGS);
+    ENSURE(c1.sum == NUM_MSGS * (NUM_MSGS - 1) / 2);
+    ENSURE(c1.sum == c2.sum && c2.sum == c3.sum);
+
+    // Leaving the group keeps the others going, joining it from a callback works
+    zcm.unsubscribe(s1);
+    bool joined = false;
+    zcm.subscribe<a_t>("POSE", [&](const zcm::ReceiveBuffer *rbuf, const string& channel,
+                                   const a_t *msg) {
+        if (!joined) {
+            zcm.subscribe("POSE", typedHandler, &c4);
+            joined = true;
+        }
+    });
+    handleAll(zcm);
+    ENSURE(a_t::numDecodes == 2 * NUM_MSGS);
+    ENSURE(c1.numRecv == NUM_MSGS);
+    ENSURE(c2.numRecv == 2 * NUM_MSGS);
+    ENSURE(c4.numRecv == NUM_MSGS - 1);
+
+    // Other channels get their own group
+    Counter c5;
+    zcm.subscribe("OTHER", typedHandler, &c5);
+    handleAll(zcm);
+    ENSURE(c5.numRecv == NUM_MSGS);
+    ENSURE(c2.numRecv == 2 * NUM_MSGS);
+    ENSURE(a_t::numDecodes == 3 * NUM_MSGS);
+}
+
+// Callbacks may unsubscribe anyone, even the rest of their group or the last of another
+static void test_unsubscribe_from_callback()
+{
+    ScriptTrans *trans = new ScriptTrans();
+    for (int i = 0; i < NUM_MSGS; i++)
+        trans->add("POSE", i);
+
+    zcm::ZCM zcm(trans);
+    ENSURE(zcm.good());
+
+    int numFirst = 0, numOthers = 0;
+    vector<zcm::Subscription*> others;
+    zcm::Subscription *first = nullptr;
+    first = zcm.subscribe<a_t>("POSE", [&](const zcm::ReceiveBuffer *rbuf,
+                                           const string& channel, const a_t *msg) {
+        numFirst++;
+        for (zcm::Subscription *sub : others)
+            zcm.unsubscribe(sub);
+        others.clear();
+        // The second message leaves the group empty
+        if (numFirst == 2)
+            zcm.unsubscribe(first);
+    });
+    auto other = [&](const zcm::ReceiveBuffer *rbuf, const string& channel, const a_t *msg) {
+        numOthers++;
+    };
+    others.push_back(zcm.subscribe<a_t>("POSE", other));
+    others.push_back(zcm.subscribe<a_t>("POSE", other));
+    others.push_back(zcm.subscribe<b_t>("POSE", [&](const zcm::ReceiveBuffer *rbuf,
+                                                    const string& channel, const b_t *msg) {
+        numOthers++;
+    }));
+
+    for (int i = 0; i < 3; i++)
+        ENSURE(0 == zcm.handle());
+    ENSURE(numFirst == 2);
+    ENSURE(numOthers == 0);
+
+    // The group is gone, a new one takes its place
+    Counter c;
+    zcm.subscribe("POSE", typedHandler, &c);
+    for (int i = 3; i < NUM_MSGS; i++)
+        ENSURE(0 == zcm.handle());
+    ENSURE(c.numRecv == NUM_MSGS - 3);
+    ENSURE(numFirst == 2);
+}
+
+// Callbacks on the dispatch thread and other threads share the groups and the list
+static void test_subscribe_while_running()
+{
+    ScriptTrans *trans = new ScriptTrans();
+    for (int i = 0; i < NUM_RUNNING_MSGS; i++)
+        trans->add("POSE", i);
+
+    zcm::ZCM zcm(trans);
+    ENSURE(zcm.good());
+
+    Counter c;
+    zcm.subscribe("POSE", typedHandler, &c);
+    atomic<int> numDispatched {0};
+    zcm.subscribe<a_t>("POSE", [&](const zcm::ReceiveBuffer *rbuf, const string& channel,
+                                   const a_t *msg) {
+        Counter tmp;
+        zcm.unsubscribe(zcm.subscribe("POSE", typedHandler, &tmp));
+        zcm.unsubscribe(zcm.subscribe("OTHER", typedHandler, &tmp));
+        numDispatched++;
+    });
+
+    // Receiving blocks rather than drops by default, so every message gets here
+    zcm.start();
+    Counter tmp;
+    while (numDispatched < NUM_RUNNING_MSGS) {
+        zcm.unsubscribe(zcm.subscribe("POSE", typedHandler, &tmp));
+        zcm.unsubscribe(zcm.subscribe("OTHER", typedHandler, &tmp));
+    }
+    zcm.stop();
+
+    ENSURE(c.numRecv == NUM_RUNNING_MSGS);
+    ENSURE(c.sum == NUM_RUNNING_MSGS * (NUM_RUNNING_MSGS - 1) / 2);
+}
+
+// Messages a pattern matches on other channels are dispatched by other threads meanwhile
+static void test_pattern_across_threads()
+{
+    ScriptTrans *trans = new ScriptTrans();
+    // On different dispatch threads, as the channels hash to them
+    trans->add("POSE_A", 1);
+    trans->add("POSE_B", 2);
+
+    zcm::ZCM zcm(trans);
+    ENSURE(zcm.good());
+    ENSURE(0 == zcm.setDispatchThreads(2));
+
+    atomic<bool> handledB {false};
+    atomic<int> numRecv {0};
+    int valueA = 0;
+    zcm.subscribe<a_t>("POSE_.*", [&](const zcm::ReceiveBuffer *rbuf, const string& channel,
+                                      const a_t *msg) {
+        if (channel == "POSE_A") {
+            for (int i = 0; i < 200 && !handledB; i++)
+                usleep(10000);
+            valueA = msg->value;
+        } else {
+            handledB = true;
+        }
+        numRecv++;
+    });
+
+    zcm.start();
+    for (int i = 0; i < 200 && numRecv < 2; i++)
+        usleep(10000);
+    zcm.stop();
+
+    ENSURE(handledB);
+    ENSURE(numRecv == 2);
+    ENSURE(valueA == 1);
+}
+
+int main()
+{
+    test_groups();
+    test_unsubscribe_from_callback();
+    test_subscribe_while_running();
+    test_pattern_across_threads();
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "zcm/transport/udpm/buffers.hpp"
+#include "test_trans.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+using namespace std;
+
+#define NUM_SENDERS 200
+
+static struct sockaddr_in sender(int i)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(0x0a000000 + i / 4);
+    addr.sin_port = htons(7000 + i % 4);
+    return addr;
+}
+
+// Evicts what it takes to stay in budget, like the transport does
+static FragBuf *add(MessagePool& pool, const struct sockaddr_in *from, u32 seqno, u32 size)
+{
+    while (FragBuf *old = pool.overBudgetFragBuf())
+        pool.removeFragBuf(old);
+    return pool.addFragBuf(from, seqno, size, 1);
+}
+
+static void test_lookup()
+{
+    MessagePool pool(1 << 24, 1000);
+
+    // Two messages in flight from every sender
+    vector<FragBuf*> fbufs;
+    for (int i = 0; i < NUM_SENDERS; i++) {
+        struct sockaddr_in from = sender(i);
+        fbufs.push_back(add(pool, &from, 10, 100));
+        fbufs.push_back(add(pool, &from, 11, 100));
+    }
+
+    for (int i = 0; i < NUM_SENDERS; i++) {
+        struct sockaddr_in from = sender(i);
+        ENSURE(pool.lookupFragBuf(&from, 10) == fbufs[2 * i]);
+        ENSURE(pool.lookupFragBuf(&from, 11) == fbufs[2 * i + 1]);
+        ENSURE(pool.lookupFragBuf(&from, 12) == nullptr);
+        ENSURE(fbufs[2 * i]->msg_seqno == 10);
+        ENSURE(fbufs[2 * i]->from.sin_port == from.sin_port);
+        ENSURE(fbufs[2 * i]->msg_size == 100 && fbufs[2 * i]->fragments_remaining == 1);
+    }
+
+    struct sockaddr_in from = sender(7);
+    pool.removeFragBuf(fbufs[14]);
+    ENSURE(pool.lookupFragBuf(&from, 10) == nullptr);
+    ENSURE(pool.lookupFragBuf(&from, 11) == fbufs[15]);
+}
+
+static void test_eviction()
+{
+    // Room for 4 buffers, going over evicts the least recently used
+    MessagePool pool(1 << 24, 3);
+
+    vector<FragBuf*> fbufs;
+    vector<struct sockaddr_in> froms;
+    for (int i = 0; i < 4; i++) {
+        froms.push_back(sender(i));
+        fbufs.push_back(add(pool, &froms[i], 0, 100));
+    }
+
+    // Receiving a fragment keeps the first one around
+    ENSURE(pool.lookupFragBuf(&froms[0], 0) == fbufs[0]);
+
+    struct sockaddr_in from = sender(4);
+    add(pool, &from, 0, 100);
+    ENSURE(pool.lookupFragBuf(&froms[1], 0) == nullptr);
+    ENSURE(pool.lookupFragBuf(&froms[0], 0) == fbufs[0]);
+    ENSURE(pool.lookupFragBuf(&froms[2], 0) == fbufs[2]);
+    ENSURE(pool.lookupFragBuf(&froms[3], 0) == fbufs[3]);
+
+    // Now 4 is the least recently used
+    from = sender(5);
+    add(pool, &from, 0, 100);
+    from = sender(4);
+    ENSURE(pool.lookupFragBuf(&from, 0) == nullptr);
+    ENSURE(pool.lookupFragBuf(&froms[0], 0) == fbufs[0]);
+
+    // Going over in size evicts too, but never the new buffer
+    MessagePool small(1000, 1000);
+    FragBuf *a = add(small, &froms[0], 0, 600);
+    FragBuf *b = add(small, &froms[1], 0, 600);
+    FragBuf *c = add(small, &froms[2], 0, 600);
+    ENSURE(small.lookupFragBuf(&froms[0], 0) == nullptr);
+    ENSURE(small.lookupFragBuf(&froms[1], 0) == b);
+    ENSURE(small.lookupFragBuf(&froms[2], 0) == c);
+    (void)a;
+}
+
+int main()
+{
+    test_lookup();
+    test_eviction();
+    return 0;
+}
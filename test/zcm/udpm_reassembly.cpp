@@ -0,0 +1,264 @@
+#include "zcm/zcm.h"
+#include "zcm/transport/udpm/buffers.hpp"
+#include "test_trans.hpp"
+
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+using namespace std;
+
+#define IP "239.255.76.67"
+#define PORT 7671
+#define URL "udpm://239.255.76.67:7671?ttl=0"
+#define FRAGSZ 100
+
+// Packets are made by hand, so they can be sent in any order
+typedef vector<char> Datagram;
+
+static Datagram shortPacket(u32 seqno, const string& channel, const string& data)
+{
+    MsgHeaderShort hdr;
+    hdr.setMagic(ZCM_MAGIC_SHORT);
+    hdr.setMsgSeqno(seqno);
+    Datagram pkt((char*)&hdr, (char*)(&hdr + 1));
+    pkt.insert(pkt.end(), channel.begin(), channel.end());
+    pkt.push_back('\0');
+    pkt.insert(pkt.end(), data.begin(), data.end());
+    return pkt;
+}
+
+static vector<Datagram> fragments(u32 seqno, const string& channel, const string& data)
+{
+    string payload = channel + '\0' + data;
+    u16 nfrags = (payload.size() + FRAGSZ - 1) / FRAGSZ;
+
+    vector<Datagram> pkts;
+    for (u16 i = 0; i < nfrags; i++) {
+        MsgHeaderLong hdr;
+        hdr.magic = htonl(ZCM_MAGIC_LONG);
+        hdr.msg_seqno = htonl(seqno);
+        hdr.msg_size = htonl(data.size());
+        // Note: offsets are into the data, which starts after the channel
+        hdr.fragment_offset = htonl(i == 0 ? 0 : i * FRAGSZ - (channel.size() + 1));
+        hdr.fragment_no = htons(i);
+        hdr.fragments_in_msg = htons(nfrags);
+
+        Datagram pkt((char*)&hdr, (char*)(&hdr + 1));
+        size_t end = min(payload.size(), (size_t)(i + 1) * FRAGSZ);
+        pkt.insert(pkt.end(), payload.begin() + i * FRAGSZ, payload.begin() + end);
+        pkts.push_back(pkt);
+    }
+    return pkts;
+}
+
+static string pattern(size_t len, char seed)
+{
+    string s(len, 0);
+    for (size_t i = 0; i < len; i++)
+        s[i] = seed + i % 23;
+    return s;
+}
+
+struct Receiver
+{
+    mutex lk;
+    vector<pair<string, string>> msgs;
+
+    static void handle(const zcm_recv_buf_t *rbuf, const char *channel, void *usr)
+    {
+        Receiver *r = (Receiver*)usr;
+        unique_lock<mutex> lk(r->lk);
+        r->msgs.emplace_back(channel, string((char*)rbuf->data, rbuf->data_size));
+    }
+
+    vector<pair<string, string>> waitFor(size_t n)
+    {
+        auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+        while (chrono::steady_clock::now() < deadline) {
+            {
+                unique_lock<mutex> lk(this->lk);
+                if (msgs.size() >= n) break;
+            }
+            usleep(1000);
+        }
+        usleep(50000); // and nothing more
+        unique_lock<mutex> lk(this->lk);
+        auto ret = msgs;
+        msgs.clear();
+        return ret;
+    }
+};
+
+struct DatagramSender
+{
+    int fd;
+    struct sockaddr_in dest;
+
+    DatagramSender()
+    {
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        ENSURE(fd >= 0);
+        u8 ttl = 0;
+        ENSURE(0 == setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)));
+        memset(&dest, 0, sizeof(dest));
+        dest.sin_family = AF_INET;
+        inet_aton(IP, &dest.sin_addr);
+        // Note: udpm uses the port of the url as is, without htons()
+        dest.sin_port = PORT;
+    }
+
+    ~DatagramSender() { close(fd); }
+
+    u16 port()
+    {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        ENSURE(0 == getsockname(fd, (struct sockaddr*)&addr, &len));
+        return ntohs(addr.sin_port);
+    }
+
+    void send(const Datagram& pkt)
+    {
+        ENSURE((ssize_t)pkt.size() ==
+               sendto(fd, pkt.data(), pkt.size(), 0, (struct sockaddr*)&dest, sizeof(dest)));
+    }
+};
+
+static zcm_trans_stats_t transportStats(zcm_t *zcm)
+{
+    zcm_stats_t stats;
+    ENSURE(0 == zcm_get_stats(zcm, &stats));
+    zcm_trans_stats_t ret = stats.transport;
+    zcm_free_stats(&stats);
+    // Only the totals, the senders went with the rest
+    ret.nsenders = 0;
+    ret.senders = NULL;
+    return ret;
+}
+
+// The counters of whoever sends from 'port'
+static zcm_sender_stats_t senderStats(zcm_t *zcm, u16 port)
+{
+    zcm_stats_t stats;
+    ENSURE(0 == zcm_get_stats(zcm, &stats));
+    string suffix = ":" + to_string(port);
+    zcm_sender_stats_t ret;
+    int found = 0;
+    for (uint32_t i = 0; i < stats.transport.nsenders; i++) {
+        string address = stats.transport.senders[i].address;
+        if (address.size() > suffix.size() &&
+            address.compare(address.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            ret = stats.transport.senders[i];
+            found++;
+        }
+    }
+    zcm_free_stats(&stats);
+    ENSURE(found == 1);
+    return ret;
+}
+
+static uint64_t messagesLost(zcm_t *zcm)
+{
+    return transportStats(zcm).messages_lost;
+}
+
+int main()
+{
+    zcm_t *zcm = zcm_create(URL);
+    ENSURE(zcm);
+    Receiver r;
+    zcm_subscribe(zcm, ".*", &Receiver::handle, &r);
+    zcm_start(zcm);
+
+    DatagramSender s;
+    s.send(shortPacket(0, "PING", "hello"));
+    ENSURE(r.waitFor(1).size() == 1);
+
+    // Two messages interleaved, their fragments backwards and some twice
+    string a = pattern(1000, 'a'), b = pattern(777, 'A');
+    vector<Datagram> fa = fragments(1, "BIG_A", a), fb = fragments(2, "BIG_B", b);
+    reverse(fa.begin(), fa.end());
+    reverse(fb.begin(), fb.end());
+    for (size_t i = 0; i < max(fa.size(), fb.size()); i++) {
+        if (i < fb.size()) s.send(fb[i]);
+        if (i < fa.size()) s.send(fa[i]);
+        if (i % 3 == 0 && i < fa.size()) s.send(fa[i]);
+    }
+    auto msgs = r.waitFor(2);
+    ENSURE(msgs.size() == 2);
+    ENSURE(msgs[0] == make_pair(string("BIG_B"), b));
+    ENSURE(msgs[1] == make_pair(string("BIG_A"), a));
+    ENSURE(messagesLost(zcm) == 0);
+    zcm_sender_stats_t ss = senderStats(zcm, s.port());
+    ENSURE(ss.messages_lost == 0);
+    ENSURE(ss.fragments_reordered == fa.size() - 1 + fb.size() - 1);
+    ENSURE(ss.fragments_duplicated > 0);
+
+    // A message missing a fragment stays in flight while newer ones arrive
+    vector<Datagram> fc = fragments(3, "BIG_C", pattern(500, '0'));
+    fc.erase(fc.begin() + 2);
+    for (auto& p : fc) s.send(p);
+    for (auto& p : fragments(4, "BIG_D", pattern(500, '1'))) s.send(p);
+    msgs = r.waitFor(1);
+    ENSURE(msgs.size() == 1 && msgs[0].first == "BIG_D");
+    ENSURE(messagesLost(zcm) == 0);
+
+    // Until it's out of the reassembly window, and skipping ahead loses what was skipped
+    s.send(shortPacket(68, "SHORT", "x"));
+    ENSURE(r.waitFor(1).size() == 1);
+    ENSURE(messagesLost(zcm) == 1 + 63);
+
+    // Unless it turns up after all
+    for (auto& p : fragments(61, "BIG_F", pattern(300, '2'))) s.send(p);
+    s.send(shortPacket(6, "SHORT", "y"));
+    msgs = r.waitFor(2);
+    ENSURE(msgs.size() == 2 && msgs[0].first == "BIG_F" && msgs[1].first == "SHORT");
+    ENSURE(messagesLost(zcm) == 1 + 61);
+
+    // Though large ones can only be reassembled while in the window
+    for (auto& p : fragments(7, "BIG_G", pattern(300, '3'))) s.send(p);
+    ENSURE(r.waitFor(1).empty());
+    ENSURE(messagesLost(zcm) == 1 + 61);
+
+    // And the fragments of a done message start nothing
+    for (auto& p : fragments(61, "BIG_F", pattern(300, '2'))) s.send(p);
+    s.send(fc[0]);
+    ENSURE(r.waitFor(1).empty());
+    ENSURE(messagesLost(zcm) == 1 + 61);
+
+    // Fragments of two senders taking turns, some received in place and some not
+    zcm_trans_stats_t before = transportStats(zcm);
+    DatagramSender s2;
+    s2.send(shortPacket(0, "PING", "hello"));
+    ENSURE(r.waitFor(1).size() == 1);
+    string g = pattern(5000, 'g'), h = pattern(4321, 'h');
+    vector<Datagram> fg = fragments(69, "BIG_G", g), fh = fragments(1, "BIG_H", h);
+    for (size_t i = 0; i < fh.size() + 10; i++) {
+        if (i < fg.size()) s.send(fg[i]);
+        if (i % 4 == 3) usleep(1000);
+        if (i >= 10) s2.send(fh[i - 10]);
+    }
+    msgs = r.waitFor(2);
+    ENSURE(msgs.size() == 2);
+    sort(msgs.begin(), msgs.end());
+    ENSURE(msgs[0] == make_pair(string("BIG_G"), g));
+    ENSURE(msgs[1] == make_pair(string("BIG_H"), h));
+    zcm_trans_stats_t after = transportStats(zcm);
+    ENSURE(after.messages_lost == 1 + 61);
+    ENSURE(after.fragments_placed > before.fragments_placed);
+    ENSURE(after.fragments_misplaced > before.fragments_misplaced);
+
+    // Each sender has its own share of the losses
+    ENSURE(senderStats(zcm, s.port()).messages_lost == 1 + 61);
+    ENSURE(senderStats(zcm, s2.port()).messages_lost == 0);
+
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include "zcm/zcm-cpp.hpp"
+#include "test_trans.hpp"
+
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+using namespace std;
+
+// Hours apart, so that pacing playback in real time would never finish
+#define GAP_US (3600ULL * 1000 * 1000)
+
+// A blocking transport that receives messages on "TICK" with the scripted utimes,
+// and remembers the utimes of what was sent
+struct TickTrans : public TestTrans
+{
+    vector<uint64_t> utimes;
+    size_t next = 0;
+    vector<uint64_t> sent;
+
+    int sendmsg(zcm_msg_t msg) override
+    {
+        sent.push_back(msg.utime);
+        return ZCM_EOK;
+    }
+
+    int recvmsg(zcm_msg_t *msg, int timeout) override
+    {
+        if (next == utimes.size()) {
+            usleep(1000);
+            return ZCM_EAGAIN;
+        }
+        msg->utime = utimes[next++];
+        msg->channel = "TICK";
+        msg->len = 0;
+        msg->buf = (char*)"";
+        return ZCM_EOK;
+    }
+};
+
+struct Recorder
+{
+    zcm::ZCM *zcm;
+    vector<uint64_t> clock;
+    atomic<size_t> numRecv {0};
+    bool echo = false;
+
+    void handle(const zcm::ReceiveBuffer *rbuf, const string& channel)
+    {
+        clock.push_back(zcm->getUtime());
+        numRecv++;
+        if (echo)
+            zcm->publish("ECHO", "", 0);
+    }
+};
+
+static void test_clock()
+{
+    TickTrans *trans = new TickTrans();
+    trans->utimes = {GAP_US, 3 * GAP_US, 2 * GAP_US, 0, 5 * GAP_US};
+    zcm::ZCM zcm(trans);
+    ENSURE(zcm.good());
+    ENSURE(0 == zcm.setVirtualTime(true));
+    ENSURE(0 == zcm.getUtime());
+
+    Recorder r;
+    r.zcm = &zcm;
+    r.echo = true;
+    zcm.subscribe("TICK", &Recorder::handle, &r);
+
+    // The clock only moves forward, and not for messages without a time
+    for (size_t i = 0; i < trans->utimes.size(); i++)
+        ENSURE(0 == zcm.handle());
+    ENSURE(r.clock == vector<uint64_t>({GAP_US, 3 * GAP_US, 3 * GAP_US, 3 * GAP_US, 5 * GAP_US}));
+    ENSURE(zcm.getUtime() == 5 * GAP_US);
+
+    // Published messages carry the virtual time
+    zcm.flush();
+    ENSURE(trans->sent == r.clock);
+
+    // Can't be changed once dispatching
+    ENSURE(-1 == zcm.setVirtualTime(false));
+    ENSURE(ZCM_EINVALID == zcm.err());
+}
+
+static void test_real_time()
+{
+    TickTrans *trans = new TickTrans();
+    trans->utimes = {GAP_US};
+    zcm::ZCM zcm(trans);
+    ENSURE(zcm.good());
+
+    Recorder r;
+    r.zcm = &zcm;
+    zcm.subscribe("TICK", &Recorder::handle, &r);
+    ENSURE(0 == zcm.handle());
+    ENSURE(r.clock.size() == 1 && r.clock[0] > 100 * GAP_US);
+}
+
+// A log of events hours apart replays right away
+static void test_file_replay()
+{
+    char path[] = "/tmp/zcm-virtual-time-XXXXXX";
+    int fd = mkstemp(path);
+    ENSURE(fd >= 0);
+    close(fd);
+
+    const int numEvents = 5;
+    {
+        zcm::LogFile log(path, "w");
+        ENSURE(log.good());
+        for (int i = 0; i < numEvents; i++) {
+            zcm::LogEvent le;
+            le.eventnum = i;
+            le.timestamp = (i + 1) * GAP_US;
+            le.channel = "TICK";
+            le.datalen = 0;
+            le.data = (char*)"";
+            ENSURE(0 == log.writeEvent(&le));
+        }
+    }
+
+    auto start = chrono::steady_clock::now();
+    zcm::ZCM zcm(string("file://") + path + "?virtual_time=1");
+    ENSURE(zcm.good());
+    Recorder r;
+    r.zcm = &zcm;
+    zcm.subscribe("TICK", &Recorder::handle, &r);
+    zcm.start();
+    while (r.numRecv < (size_t)numEvents &&
+           chrono::steady_clock::now() - start < chrono::seconds(10))
+        usleep(1000);
+    zcm.stop();
+
+    ENSURE(r.clock.size() == (size_t)numEvents);
+    for (int i = 0; i < numEvents; i++)
+        ENSURE(r.clock[i] == (i + 1) * GAP_US);
+    unlink(path);
+}
+
+int main()
+{
+    test_clock();
+    test_real_time();
+    test_file_replay();
+    return 0;
+}
@@ -2,33 +2,354 @@
 #include "zcm/zcm_private.h"
 #include "zcm/blocking.h"
 #include "zcm/transport.h"
-#include "zcm/util/threadsafe_queue.hpp"
+#include "zcm/util/spsc_queue.hpp"
+#include "zcm/util/channel_matcher.hpp"
 #include "zcm/util/debug.h"
 
 #include "util/TimeUtil.hpp"
 
 #include <unistd.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 #include <cassert>
+#include <cerrno>
 #include <cstring>
 
 #include <unordered_map>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
-#include <regex>
 using namespace std;
 
 #define RECV_TIMEOUT 100
+#define RECV_BATCH_MAX 32
+#define SEND_BATCH_MAX 64
+
+// Free buffers kept per size class of the publish pool
+#define LOAN_POOL_MAX_FREE 64
+
+// Channels that get their own statistics, the rest are accounted together
+#define STATS_MAX_CHANNELS 1024
+
+struct ChanState;
+
+// A counter with a single writer at a time, so incrementing it needs no atomic
+// read-modify-write. Readers on other threads see a recent value.
+struct StatCounter
+{
+    atomic<uint64_t> v {0};
+
+    void add(uint64_t n)
+    {
+        v.store(v.load(memory_order_relaxed) + n, memory_order_relaxed);
+    }
+
+    void raise(uint64_t n)
+    {
+        if (n > v.load(memory_order_relaxed))
+            v.store(n, memory_order_relaxed);
+    }
+
+    uint64_t get() const { return v.load(memory_order_relaxed); }
+};
+
+// A counter that several threads may write at once
+struct SharedStatCounter
+{
+    atomic<uint64_t> v {0};
+
+    void add(uint64_t n)
+    {
+        v.fetch_add(n, memory_order_relaxed);
+    }
+
+    void raise(uint64_t n)
+    {
+        uint64_t cur = v.load(memory_order_relaxed);
+        while (n > cur && !v.compare_exchange_weak(cur, n, memory_order_relaxed)) {}
+    }
+
+    uint64_t get() const { return v.load(memory_order_relaxed); }
+};
+
+template <class Counter>
+struct Histogram
+{
+    Counter count, sumUs, maxUs;
+    Counter buckets[ZCM_HISTOGRAM_BUCKETS];
+
+    void record(uint64_t us)
+    {
+        count.add(1);
+        sumUs.add(us);
+        maxUs.raise(us);
+        buckets[zcm_histogram_bucket(us)].add(1);
+    }
+
+    void copyTo(zcm_histogram_t *h) const
+    {
+        h->count = count.get();
+        h->sum_us = sumUs.get();
+        h->max_us = maxUs.get();
+        for (size_t i = 0; i < ZCM_HISTOGRAM_BUCKETS; i++)
+            h->buckets[i] = buckets[i].get();
+    }
+};
+
+// The statistics of one channel. Every group of counters sits on its own cache
+// lines and, but for the dispatch counters, is only written by one thread at a time.
+struct ChannelStats
+{
+    static constexpr size_t CACHELINE = 64;
+
+    string channel;
+
+    // Written by the publisher, under 'pubmut'
+    StatCounter published, publishedBytes;
+    StatCounter sendQueueFull, sendChannelLimit;
+    char pad0[CACHELINE];
+
+    // Written by the send thread
+    StatCounter sent, sentBytes, sendError;
+    Histogram<StatCounter> sendLatency;
+    char pad1[CACHELINE];
+
+    // Written by the recv thread
+    StatCounter received, receivedBytes;
+    StatCounter recvQueueFull, recvChannelLimit, recvConflated;
+    char pad2[CACHELINE];
+
+    // Written by the thread feeding the dispatch workers
+    StatCounter workerQueueFull;
+    char pad3[CACHELINE];
+
+    // Written by the dispatch workers, several of which share the counters of
+    // the channels past STATS_MAX_CHANNELS
+    SharedStatCounter dispatched;
+    Histogram<SharedStatCounter> dispatchLatency;
+
+    ChannelStats(const string& channel) : channel(channel) {}
+
+    void copyTo(zcm_channel_stats_t *s) const
+    {
+        memset(s, 0, sizeof(*s));
+        strncpy(s->channel, channel.c_str(), ZCM_CHANNEL_MAXLEN);
+        s->published       = published.get();
+        s->published_bytes = publishedBytes.get();
+        s->sent            = sent.get();
+        s->sent_bytes      = sentBytes.get();
+        s->received        = received.get();
+        s->received_bytes  = receivedBytes.get();
+        s->dispatched      = dispatched.get();
+        s->dropped[ZCM_DROP_SEND_QUEUE_FULL]    = sendQueueFull.get();
+        s->dropped[ZCM_DROP_SEND_CHANNEL_LIMIT] = sendChannelLimit.get();
+        s->dropped[ZCM_DROP_SEND_ERROR]         = sendError.get();
+        s->dropped[ZCM_DROP_RECV_QUEUE_FULL]    = recvQueueFull.get() + workerQueueFull.get();
+        s->dropped[ZCM_DROP_RECV_CHANNEL_LIMIT] = recvChannelLimit.get();
+        s->dropped[ZCM_DROP_RECV_CONFLATED]     = recvConflated.get();
+        sendLatency.copyTo(&s->send_latency);
+        dispatchLatency.copyTo(&s->dispatch_latency);
+    }
+};
+
+// A thread's own view of the channels' statistics, see zcm_blocking::statsFor()
+typedef unordered_map<string, ChannelStats*> StatsCache;
+
+// A publish buffer and the channel it goes out on, allocated as one block
+struct LoanBlock
+{
+    uint64_t cap;
+    char channel[ZCM_CHANNEL_MAXLEN + 1];
+
+    char *data() { return (char*)(this + 1); }
+    static LoanBlock *of(char *data) { return (LoanBlock*)data - 1; }
+};
+
+// Recycles the buffers of published messages, so that once warmed up
+// publishing doesn't allocate. Buffers are grouped by power of two sizes.
+class LoanPool
+{
+    static constexpr size_t MIN_CLASS = 8; // 256 bytes
+    static constexpr size_t NUM_CLASSES = 33;
+
+    mutex mut;
+    vector<LoanBlock*> freeBlocks[NUM_CLASSES];
+
+    static size_t sizeClass(size_t len)
+    {
+        size_t c = MIN_CLASS;
+        while (((size_t)1 << c) < len) c++;
+        return c;
+    }
+
+  public:
+    LoanPool() {}
+
+    ~LoanPool()
+    {
+        for (auto& blocks : freeBlocks)
+            for (LoanBlock *b : blocks)
+                free(b);
+    }
+
+    // Returns a buffer of at least 'len' bytes
+    char *get(uint32_t len)
+    {
+        size_t c = sizeClass(len);
+        {
+            unique_lock<mutex> lk(mut);
+            if (!freeBlocks[c].empty()) {
+                LoanBlock *b = freeBlocks[c].back();
+                freeBlocks[c].pop_back();
+                return b->data();
+            }
+        }
+        LoanBlock *b = (LoanBlock*)malloc(sizeof(LoanBlock) + ((size_t)1 << c));
+        b->cap = (size_t)1 << c;
+        return b->data();
+    }
+
+    // Give back a buffer returned by get()
+    void put(char *data)
+    {
+        LoanBlock *b = LoanBlock::of(data);
+        size_t c = sizeClass(b->cap);
+        {
+            unique_lock<mutex> lk(mut);
+            if (freeBlocks[c].size() < LOAN_POOL_MAX_FREE) {
+                freeBlocks[c].push_back(b);
+                return;
+            }
+        }
+        free(b);
+    }
+
+  private:
+    LoanPool(const LoanPool&) = delete;
+    LoanPool& operator=(const LoanPool&) = delete;
+};
+
+// A file descriptor that is readable while received messages wait to be dispatched,
+// see zcm_get_fileno(). An eventfd where there is one, otherwise a pipe. The recv
+// thread only writes to it when it isn't readable yet, so a busy channel costs one
+// syscall per batch the consumer drains rather than one per message.
+class ReadyFd
+{
+    int rfd = -1;
+    atomic<int> wfd {-1};
+    atomic<bool> raised {false};
+
+  public:
+    ReadyFd() {}
+
+    ~ReadyFd()
+    {
+        int fd = wfd.load(memory_order_relaxed);
+        if (fd >= 0 && fd != rfd)
+            close(fd);
+        if (rfd >= 0)
+            close(rfd);
+    }
+
+    bool isOpen() const { return rfd >= 0; }
+
+    // Returns the descriptor to poll, or -1 on failure
+    int open()
+    {
+        if (rfd >= 0)
+            return rfd;
+#ifdef __linux__
+        int fds[2];
+        fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fds[0] < 0)
+            return -1;
+#else
+        int fds[2];
+        if (pipe(fds) != 0)
+            return -1;
+        for (int fd : fds) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+#endif
+        rfd = fds[0];
+        wfd.store(fds[1], memory_order_release);
+        return rfd;
+    }
+
+    // Make it readable, if it is open. Called after a message was queued.
+    void raise()
+    {
+        int fd = wfd.load(memory_order_acquire);
+        if (fd < 0)
+            return;
+        // Note: pairs with the fence in lower(), either we see it lowered
+        //       or the consumer sees the message we just queued
+        atomic_thread_fence(memory_order_seq_cst);
+        if (raised.load(memory_order_relaxed) || raised.exchange(true))
+            return;
+#ifdef __linux__
+        uint64_t one = 1;
+        ssize_t ret = write(fd, &one, sizeof(one));
+#else
+        char one = 1;
+        ssize_t ret = write(fd, &one, sizeof(one));
+#endif
+        (void)ret;
+    }
+
+    // Make it unreadable. Only called by the consumer, which must check for
+    // queued messages afterwards and raise() it again if there are any
+    void lower()
+    {
+        if (!raised.load(memory_order_relaxed))
+            return;
+#ifdef __linux__
+        uint64_t count;
+        ssize_t ret = read(rfd, &count, sizeof(count));
+        (void)ret;
+#else
+        char buf[64];
+        while (read(rfd, buf, sizeof(buf)) > 0) {}
+#endif
+        raised.store(false, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+
+  private:
+    ReadyFd(const ReadyFd&) = delete;
+    ReadyFd& operator=(const ReadyFd&) = delete;
+};
 
 // A C++ class that manages a zcm_msg_t*
 struct Msg
 {
     zcm_msg_t msg;
 
+    // The transport that lent us this message or nullptr if we own a copy
+    zcm_trans_t *lender = nullptr;
+
+    // The pool 'msg.buf' goes back to, the channel then lives in the same block
+    LoanPool *pool = nullptr;
+
+    // Per-channel queue bookkeeping, only set when the queue tracks channels
+    ChanState *chan = nullptr;
+    uint64_t chanSeq = 0;
+
+    // Where to account for this message
+    ChannelStats *stats = nullptr;
+
+    Msg() { memset(&msg, 0, sizeof(msg)); }
+
     // NOTE: copy the provided data into this object
     Msg(uint64_t utime, const char *channel, size_t len, const char *buf)
     {
@@ -41,13 +362,43 @@ struct Msg
 
     Msg(zcm_msg_t *msg) : Msg(msg->utime, msg->channel, msg->len, msg->buf) {}
 
+    // NOTE: take ownership of a message lent by the transport, no copy is made
+    Msg(zcm_msg_t *msg, zcm_trans_t *lender) : msg(*msg), lender(lender) {}
+
+    // NOTE: take ownership of a buffer from 'pool', its block already holds the channel
+    Msg(uint64_t utime, size_t len, char *buf, LoanPool *pool) : pool(pool)
+    {
+        msg.utime = utime;
+        msg.channel = LoanBlock::of(buf)->channel;
+        msg.len = len;
+        msg.buf = buf;
+    }
+
+    // NOTE: moving only hands over ownership, the data is never copied
+    Msg(Msg&& other) : msg(other.msg), lender(other.lender), pool(other.pool),
+                       chan(other.chan), chanSeq(other.chanSeq), stats(other.stats)
+    {
+        other.forget();
+    }
+
+    Msg& operator=(Msg&& other)
+    {
+        if (this != &other) {
+            release();
+            msg = other.msg;
+            lender = other.lender;
+            pool = other.pool;
+            chan = other.chan;
+            chanSeq = other.chanSeq;
+            stats = other.stats;
+            other.forget();
+        }
+        return *this;
+    }
+
     ~Msg()
     {
-        if (msg.channel)
-            free((void*)msg.channel);
-        if (msg.buf)
-            free((void*)msg.buf);
-        memset(&msg, 0, sizeof(msg));
+        release();
     }
 
     zcm_msg_t *get()
@@ -56,11 +407,316 @@ struct Msg
     }
 
   private:
-    // Disable all copying and moving
+    void release()
+    {
+        if (lender) {
+            zcm_trans_recvmsg_release(lender, &msg);
+        } else if (pool) {
+            if (msg.buf)
+                pool->put(msg.buf);
+        } else {
+            if (msg.channel)
+                free((void*)msg.channel);
+            if (msg.buf)
+                free((void*)msg.buf);
+        }
+        forget();
+    }
+
+    void forget()
+    {
+        memset(&msg, 0, sizeof(msg));
+        lender = nullptr;
+        pool = nullptr;
+        chan = nullptr;
+        chanSeq = 0;
+        stats = nullptr;
+    }
+
+    // Disable all copying
     Msg(const Msg& other) = delete;
-    Msg(Msg&& other) = delete;
     Msg& operator=(const Msg& other) = delete;
-    Msg& operator=(Msg&& other) = delete;
+};
+
+// Per-channel counters used to bound how many messages of a channel are queued.
+// Messages of a channel leave the queue in the order they were pushed, so the
+// oldest queued message of a channel has sequence number 'popped + 1'.
+struct ChanState
+{
+    atomic<uint32_t> limit  {0}; // 0 means only the queue capacity applies
+    atomic<uint64_t> pushed {0}; // sequence number of the last message pushed
+    atomic<uint64_t> popped {0}; // number of messages that have left the queue
+    atomic<uint64_t> floor  {0}; // messages with a sequence <= floor are stale
+};
+
+// Wraps a queue of Msg with an overflow policy and optional per-channel limits.
+// push() has a single producer at a time (the publisher under pubmut or the recv
+// thread) and pop() a single consumer, but the producer may evict queued messages.
+class MsgQueue
+{
+    unique_ptr<SpscQueue<Msg>> queue;
+    atomic<int> policy;
+
+    // Guards the insertion of new channels and 'chanLimits'. Only the producer
+    // inserts into 'chans', so it may look them up without taking the lock.
+    mutex chanmut;
+    unordered_map<string, unique_ptr<ChanState>> chans;
+    unordered_map<string, uint32_t> chanLimits;
+    atomic<bool> trackChans {false};
+
+    // Used by flush() to know when everything pushed has been dealt with
+    atomic<uint64_t> numPushed {0};
+    atomic<uint64_t> numDone {0};
+    atomic<int> wakeupNum {0};
+    EventCount doneEc;
+
+    atomic<uint64_t> numDropped {0};
+    StatCounter highWater;
+
+    // Which of a channel's counters get the drops of this queue
+    StatCounter ChannelStats::*fullDrops;
+    StatCounter ChannelStats::*limitDrops;
+
+    void countDrop(Msg& m, StatCounter ChannelStats::*cause)
+    {
+        numDropped++;
+        if (m.stats)
+            (m.stats->*cause).add(1);
+    }
+
+    ChanState *lookupChan(const char *channel)
+    {
+        auto it = chans.find(channel);
+        if (it != chans.end())
+            return it->second.get();
+
+        unique_lock<mutex> lk(chanmut);
+        ChanState *cs = new ChanState();
+        auto lit = chanLimits.find(channel);
+        if (lit != chanLimits.end())
+            cs->limit = lit->second;
+        chans.emplace(channel, unique_ptr<ChanState>(cs));
+        return cs;
+    }
+
+    // True if a newer message of the same channel made this one obsolete
+    static bool isStale(const Msg& m)
+    {
+        return m.chan && m.chanSeq <= m.chan->floor.load(memory_order_acquire);
+    }
+
+    // Account for a message that leaves the queue without being handled
+    void drop(Msg& m)
+    {
+        // Stale messages were already counted when they were marked
+        if (!isStale(m))
+            countDrop(m, fullDrops);
+        if (m.chan)
+            m.chan->popped.fetch_add(1, memory_order_acq_rel);
+        done();
+    }
+
+  public:
+    MsgQueue(size_t size, zcm_queue_policy policy,
+             StatCounter ChannelStats::*fullDrops, StatCounter ChannelStats::*limitDrops) :
+        queue(new SpscQueue<Msg>(size)), policy(policy),
+        fullDrops(fullDrops), limitDrops(limitDrops) {}
+
+    // Requires that no other thread is using the queue.
+    // Queued messages are kept as long as they fit
+    void setSize(size_t size)
+    {
+        SpscQueue<Msg> *q = new SpscQueue<Msg>(size);
+        Msg m;
+        while (queue->tryPop(m)) {
+            if (!q->tryPush(std::move(m)))
+                drop(m);
+        }
+        queue.reset(q);
+    }
+
+    void setPolicy(zcm_queue_policy p)
+    {
+        if (p == ZCM_QUEUE_KEEP_LATEST)
+            trackChans = true;
+        policy = p;
+    }
+
+    zcm_queue_policy getPolicy() const
+    {
+        return (zcm_queue_policy)policy.load(memory_order_relaxed);
+    }
+
+    void setChannelSize(const string& channel, uint32_t size)
+    {
+        unique_lock<mutex> lk(chanmut);
+        chanLimits[channel] = size;
+        auto it = chans.find(channel);
+        if (it != chans.end())
+            it->second->limit = size;
+        if (size > 0)
+            trackChans = true;
+    }
+
+    // Returns ZCM_EOK if queued, ZCM_EAGAIN if dropped by the policy
+    // and ZCM_EINTR if woken up by forceWakeups() while blocking.
+    // When the message isn't queued, 'm' still owns it.
+    int push(Msg& m)
+    {
+        int p = policy.load(memory_order_relaxed);
+
+        ChanState *cs = nullptr;
+        if (trackChans.load(memory_order_relaxed)) {
+            cs = lookupChan(m.msg.channel);
+            uint64_t pushed = cs->pushed.load(memory_order_relaxed);
+            uint32_t limit = p == ZCM_QUEUE_KEEP_LATEST ? 1 : cs->limit.load(memory_order_relaxed);
+            if (limit > 0) {
+                uint64_t gone = max(cs->popped.load(memory_order_acquire),
+                                    cs->floor.load(memory_order_relaxed));
+                if (pushed - gone >= limit) {
+                    countDrop(m, limitDrops);
+                    if (p == ZCM_QUEUE_BLOCK || p == ZCM_QUEUE_DROP_NEWEST)
+                        return ZCM_EAGAIN;
+                    // Mark the channel's oldest queued message as stale
+                    cs->floor.store(gone + 1, memory_order_release);
+                }
+            }
+            m.chan = cs;
+            m.chanSeq = pushed + 1;
+        }
+
+        switch (p) {
+            case ZCM_QUEUE_BLOCK: {
+                if (!queue->push(std::move(m)))
+                    return ZCM_EINTR;
+            } break;
+            case ZCM_QUEUE_DROP_NEWEST: {
+                if (!queue->tryPush(std::move(m))) {
+                    countDrop(m, fullDrops);
+                    return ZCM_EAGAIN;
+                }
+            } break;
+            default: {
+                while (!queue->tryPush(std::move(m))) {
+                    // The slot may only be busy because the consumer is moving out of it
+                    if (queue->hasFreeSpace()) {
+                        this_thread::yield();
+                        continue;
+                    }
+                    Msg victim;
+                    if (queue->tryPop(victim))
+                        drop(victim);
+                }
+            } break;
+        }
+
+        if (cs)
+            cs->pushed.fetch_add(1, memory_order_release);
+        numPushed.fetch_add(1, memory_order_relaxed);
+        highWater.raise(queue->size());
+        return ZCM_EOK;
+    }
+
+    // Wait for a message and move it into 'out', skipping stale ones
+    // Returns false if woken up by forceWakeups()
+    // The caller must accept() the message before using it, and call done() once
+    // it is finished with it
+    bool pop(Msg& out)
+    {
+        while (queue->pop(out)) {
+            if (!isStale(out))
+                return true;
+            accept(out);
+        }
+        return false;
+    }
+
+    bool hasMessage()
+    {
+        return queue->hasMessage();
+    }
+
+    // Same as pop() but returns false right away if the queue is empty
+    bool tryPop(Msg& out)
+    {
+        while (queue->tryPop(out)) {
+            if (!isStale(out))
+                return true;
+            accept(out);
+        }
+        return false;
+    }
+
+    // Account for a popped message leaving for good, right before it is used. Until
+    // then it counts against its channel's limit, wherever it waits in the meantime.
+    // Returns false if it went stale, it is then done with and must be skipped
+    bool accept(Msg& m)
+    {
+        if (!m.chan)
+            return true;
+        m.chan->popped.fetch_add(1, memory_order_acq_rel);
+        if (!isStale(m))
+            return true;
+        done();
+        return false;
+    }
+
+    void done()
+    {
+        numDone.fetch_add(1, memory_order_release);
+        doneEc.notify();
+    }
+
+    // Wait until every message pushed so far has been handled or dropped
+    // Returns early if woken up by forceWakeups()
+    void waitForDone()
+    {
+        uint64_t target = numPushed.load(memory_order_relaxed);
+        int localWakeupNum = wakeupNum.load(memory_order_acquire);
+        auto ready = [&](){
+            return numDone.load(memory_order_acquire) >= target ||
+                   wakeupNum.load(memory_order_acquire) != localWakeupNum;
+        };
+        while (!ready()) {
+            uint32_t key = doneEc.prepareWait();
+            if (ready()) {
+                doneEc.cancelWait();
+                break;
+            }
+            doneEc.wait(key);
+        }
+    }
+
+    // Force all blocked threads to wakeup and return from
+    // whichever methods are blocking them
+    void forceWakeups()
+    {
+        wakeupNum.fetch_add(1, memory_order_acq_rel);
+        queue->forceWakeups();
+        doneEc.notify();
+    }
+
+    // Requires that no other thread is using the queue
+    void clear()
+    {
+        queue->clear();
+    }
+
+    size_t getCapacity() const
+    {
+        return queue->getCapacity();
+    }
+
+    uint64_t getNumDropped() const
+    {
+        return numDropped.load(memory_order_relaxed);
+    }
+
+    // The most messages that were queued at once
+    uint64_t getHighWater() const
+    {
+        return highWater.get();
+    }
 };
 
 static bool isRegexChannel(const string& channel)
@@ -78,11 +734,82 @@ static bool isRegexChannel(const string& channel)
     return false;
 }
 
+// The zcm_sub_t handed out by the blocking core
+struct BlockingSub : public zcm_sub_t
+{
+    // Set by unsubscribe(). A message that was already matched with the subscription
+    // skips it, so a callback may unsubscribe the others of the same message.
+    atomic<bool> removed {false};
+
+    static BlockingSub *cast(zcm_sub_t *sub) { return static_cast<BlockingSub*>(sub); }
+};
+
 struct zcm_blocking
 {
   private:
     using SubList = vector<zcm_sub_t*>;
 
+    // An immutable snapshot of every subscription. subscribe() and unsubscribe()
+    // copy the current table, modify the copy and swap it in, so that dispatching
+    // never needs a lock and callbacks may subscribe and unsubscribe themselves.
+    struct SubTable
+    {
+        unordered_map<string, SubList> subs;
+        ChannelMatcher<zcm_sub_t*> subRegex;
+        uint64_t version = 0;
+    };
+
+    // A replaced SubTable and the subscriptions its successor removed, freed
+    // once no dispatching thread can still be reading them
+    struct Retired
+    {
+        unique_ptr<const SubTable> table;
+        SubList subs;
+    };
+
+    // Every subscription a channel is dispatched to, filled on the first message
+    // of each channel so that the regex subscriptions are only matched once per
+    // channel. Each dispatching thread keeps its own.
+    struct SubCache
+    {
+        unordered_map<string, SubList> lists;
+        uint64_t version = 0; // of the SubTable the lists were built from
+    };
+
+    // Where the recv thread puts the messages of a channel
+    enum Lane { LANE_FIFO, LANE_PRIORITY, LANE_LATEST };
+
+    // What setChannelPriority() and setChannelConflate() asked for a channel
+    struct Route
+    {
+        bool high = false;
+        bool conflate = false;
+    };
+
+    // The recv thread's copy of the lanes of the channels it came across, dropped
+    // whenever the routes change
+    struct RouteCache
+    {
+        unordered_map<string, Lane> lanes;
+        uint64_t version = 0; // of 'routes' when it was filled
+    };
+
+    // The newest message of a conflated channel, it is queued in 'freshSlots'
+    // from when it is stored until the consumer takes it
+    struct Slot
+    {
+        Msg msg;
+        bool fresh = false;
+    };
+
+    // What a dispatching thread needs: the hazard pointer announcing which
+    // SubTable it is reading, and its cache
+    struct Dispatcher
+    {
+        atomic<const SubTable*> hazard {nullptr};
+        SubCache cache;
+    };
+
   public:
     zcm_blocking(zcm_t *z, zcm_trans_t *zt_);
     ~zcm_blocking();
@@ -92,20 +819,83 @@ struct zcm_blocking
     void stop();
 
     int publish(const string& channel, const char *data, uint32_t len);
+    char *publishLoan(uint32_t len);
+    int publishCommit(const char *channel, char *buf, uint32_t len);
+    void publishCancel(char *buf);
     zcm_sub_t *subscribe(const string& channel, zcm_msg_handler_t cb, void *usr);
     int unsubscribe(zcm_sub_t *sub);
     int handle();
+    int getFileno(int *fd);
+    int handleReady(uint32_t maxMsgs, uint32_t *numHandled);
     void flush();
 
+    int setQueueSize(zcm_queue queue, uint32_t size);
+    int setQueuePolicy(zcm_queue queue, zcm_queue_policy policy);
+    int setChannelQueueSize(zcm_queue queue, const string& channel, uint32_t size);
+    int setChannelPriority(const string& channel, zcm_priority priority);
+    int setChannelConflate(const string& channel, bool conflate);
+    int setDispatchThreads(uint32_t n);
+    int setVirtualTime(bool enable);
+    uint64_t now();
+
+    int getStats(zcm_stats_t *out);
+
 private:
     void sendThreadFunc();
     void recvThreadFunc();
     void handleThreadFunc();
 
-    void dispatchMsg(zcm_msg_t *msg);
+    // A received message on its way to a dispatch worker, with the receive lane it
+    // was taken out of (nullptr for a slot), which it is accepted from by the worker
+    struct Job
+    {
+        Msg m;
+        MsgQueue *from = nullptr;
+
+        Job() {}
+        Job(Msg&& m, MsgQueue *from) : m(std::move(m)), from(from) {}
+    };
+
+    // One dispatch worker: messages are routed to it by channel so that
+    // a channel's callbacks always run in order on the same thread
+    struct Worker
+    {
+        SpscQueue<Job> queue;
+        Dispatcher dispatcher;
+        thread thr;
+
+        Worker(size_t size) : queue(size) {}
+    };
+
+    void startWorkers();
+    void stopWorkers();
+    void wakeWorkers();
+    void workerThreadFunc(Worker *w);
+    void feedWorker(Msg& m, MsgQueue *from);
+    void discardJob(Msg& m, MsgQueue *from, bool full);
+
+    const SubTable *acquireSubs(Dispatcher& d);
+    void publishSubs(SubTable *next, zcm_sub_t *removed);
+    void reclaimSubs();
+
+    const SubList& findSubs(const SubTable *t, const char *channel, SubCache& cache);
+    void dispatchMsg(Msg& m, Dispatcher& d);
+    void handleMsg(Msg& m, MsgQueue *from);
     int handleOneMessage();
+    bool startHandling();
+
+    ChannelStats *statsFor(const char *channel, StatsCache& cache);
+
+    Lane laneFor(const char *channel, RouteCache& cache);
+    void setRoute(const string& channel, const Route& r);
+    void putLatest(Msg& m);
+    bool takeLatest(Msg& m);
+    bool hasReadyMsgs();
+    bool tryPopLanes(Msg& m, MsgQueue*& from);
+    bool popLanes(Msg& m, int localWakeupNum, MsgQueue*& from);
+    void settleReadyFd();
+    void wakeRecvQueues();
 
-    bool deleteSubEntry(zcm_sub_t *sub, size_t nentriesleft);
     bool deleteFromSubList(SubList& slist, zcm_sub_t *sub);
 
 private:
@@ -118,10 +908,11 @@ private:
 
     zcm_t *z;
     zcm_trans_t *zt;
-    unordered_map<string, SubList> subs;
-    SubList subRegex;
     size_t mtu;
 
+    // True when the transport can lend us its receive buffers
+    bool lendRecv;
+
     Mode_t mode = MODE_NONE;
 
     thread sendThread;
@@ -135,19 +926,76 @@ private:
     std::atomic<bool> sendRunning   {false}; // operates on the sendQueue
     std::atomic<bool> recvRunning   {false}; // operates on the recvQueue
     std::atomic<bool> handleRunning {false}; // operates on the recvQueue
+    std::atomic<bool> workersRunning {false}; // operates on the workers' queues
+
+    // Note: declared before the queues, whose messages may hold its buffers
+    LoanPool loans;
+
+    // Note: entries are only ever added, under 'statsmut', so messages may point at them
+    //       for as long as the zcm exists. 'pubStatsCache' is only touched under 'pubmut'
+    mutex statsmut;
+    unordered_map<string, unique_ptr<ChannelStats>> stats;
+    StatsCache pubStatsCache;
 
     static constexpr size_t QUEUE_SIZE = 16;
-    ThreadsafeQueue<Msg> sendQueue {QUEUE_SIZE};
-    ThreadsafeQueue<Msg> recvQueue {QUEUE_SIZE};
+    // Note: both queues have exactly one producer and one consumer thread at a time:
+    //       sendQueue is pushed under 'pubmut' and popped by the send thread, recvQueue
+    //       is pushed by the recv thread and popped by whoever is handling messages
+    MsgQueue sendQueue {QUEUE_SIZE, ZCM_QUEUE_DROP_NEWEST,
+                        &ChannelStats::sendQueueFull, &ChannelStats::sendChannelLimit};
+    MsgQueue recvQueue {QUEUE_SIZE, ZCM_QUEUE_BLOCK,
+                        &ChannelStats::recvQueueFull, &ChannelStats::recvChannelLimit};
+
+    // Received messages of high priority channels skip the recvQueue through their own
+    // lane, with the same producer and consumer, while those of conflated channels only
+    // ever wait in their channel's slot. Once 'lanes' is set, which is never undone, the
+    // consumer waits for any lane on 'laneEc' instead of on the recvQueue alone.
+    // Note: 'routes' is only touched under 'routemut', bumping 'routeVersion' tells the
+    //       recv thread to forget what it cached. 'slots' and 'freshSlots' are only
+    //       touched under 'slotmut'
+    MsgQueue prioQueue {QUEUE_SIZE, ZCM_QUEUE_BLOCK,
+                        &ChannelStats::recvQueueFull, &ChannelStats::recvChannelLimit};
+    atomic<bool> lanes {false};
+    atomic<int> laneWakeupNum {0};
+    EventCount laneEc;
+    mutex routemut;
+    unordered_map<string, Route> routes;
+    atomic<uint64_t> routeVersion {0};
+    mutex slotmut;
+    unordered_map<string, unique_ptr<Slot>> slots;
+    deque<Slot*> freshSlots;
+    atomic<size_t> numFresh {0};
+    bool latestTurn = false; // only used by the consumer
+
+    // Only opened by getFileno(), raised by the recv thread and lowered by handleReady()
+    ReadyFd readyFd;
+
+    // Only used by run() and start(), handle() always dispatches on the calling thread
+    // Note: 'workers' is only resized under 'submut'
+    size_t numDispatchThreads = 1;
+    vector<unique_ptr<Worker>> workers;
+
+    // Used when dispatching without workers
+    Dispatcher handleDispatcher;
+
+    // Only changed while not dispatching. The virtual clock is only moved forward, by
+    // whichever thread dispatches a message of a later time
+    atomic<bool> virtualTime {false};
+    atomic<uint64_t> virtualNow {0};
+
+    // Note: 'subTable' is only replaced, and 'retired' only touched, under 'submut'
+    atomic<const SubTable*> subTable {new SubTable()};
+    vector<Retired> retired;
 
     mutex pubmut;
     mutex submut;
 };
 
-zcm_blocking_t::zcm_blocking(zcm_t *z, zcm_trans_t *zt_)
+zcm_blocking_t::zcm_blocking(zcm_t *z, zcm_trans_t *zt_) : z(z)
 {
     zt = zt_;
     mtu = zcm_trans_get_mtu(zt);
+    lendRecv = zcm_trans_can_lend(zt);
 }
 
 zcm_blocking_t::~zcm_blocking()
@@ -155,18 +1003,31 @@ zcm_blocking_t::~zcm_blocking()
     // Shutdown all threads
     stop();
 
+    // Messages still queued might be on loan from the transport, so
+    // they must be handed back before the transport goes away
+    recvQueue.clear();
+    prioQueue.clear();
+    freshSlots.clear();
+    slots.clear();
+
     // Destroy the transport
     zcm_trans_destroy(zt);
 
     // Need to delete all subs
-    for (auto& it : subs) {
+    const SubTable *t = subTable.load();
+    for (auto& it : t->subs) {
         for (auto& sub : it.second) {
-            delete sub;
+            delete BlockingSub::cast(sub);
         }
     }
-    for (auto& sub : subRegex) {
-        delete (regex *) sub->regexobj;
-        delete sub;
+    for (auto& sub : t->subRegex.getAll()) {
+        delete BlockingSub::cast(sub);
+    }
+    delete t;
+    for (auto& r : retired) {
+        for (auto& sub : r.subs) {
+            delete BlockingSub::cast(sub);
+        }
     }
 }
 
@@ -206,7 +1067,9 @@ void zcm_blocking_t::stop()
     if (mode == MODE_RUN || mode == MODE_SPAWN) {
         if (handleRunning) {
             handleRunning = false;
-            recvQueue.forceWakeups();
+            wakeRecvQueues();
+            // The handle thread might be waiting on a busy worker
+            wakeWorkers();
             if (mode == MODE_SPAWN)
                 handleThread.join();
         }
@@ -216,7 +1079,7 @@ void zcm_blocking_t::stop()
     else if (mode == MODE_HANDLE) {
         if (recvRunning) {
             recvRunning = false;
-            recvQueue.forceWakeups();
+            wakeRecvQueues();
             recvThread.join();
         }
     }
@@ -232,45 +1095,73 @@ void zcm_blocking_t::stop()
     mode = MODE_NONE;
 }
 
-// Note: We use a lock on publish() to make sure it can be
-// called concurrently. Without the lock, there is a potential
-// race to block on sendQueue.push()
 int zcm_blocking_t::publish(const string& channel, const char *data, uint32_t len)
 {
-    // Check the validity of the request
-    if (len > mtu) return ZCM_EINVALID;
-    if (channel.size() > ZCM_CHANNEL_MAXLEN) return ZCM_EINVALID;
+    char *buf = publishLoan(len);
+    if (!buf) return ZCM_EINVALID;
+    memcpy(buf, data, len);
+    return publishCommit(channel.c_str(), buf, len);
+}
 
-    unique_lock<mutex> lk(pubmut);
+char *zcm_blocking_t::publishLoan(uint32_t len)
+{
+    if (len > mtu) return nullptr;
+    return loans.get(len);
+}
 
-    // If needed: spawn the send thread
+// Note: We use a lock on publishCommit() to make sure it can be
+// called concurrently. Without the lock, there would be multiple
+// producers on sendQueue, which only supports a single producer
+int zcm_blocking_t::publishCommit(const char *channel, char *buf, uint32_t len)
+{
+    // Check the validity of the request
+    LoanBlock *b = LoanBlock::of(buf);
+    size_t channelLen = strlen(channel);
+    if (len > mtu || len > b->cap || channelLen > ZCM_CHANNEL_MAXLEN) {
+        loans.put(buf);
+        return ZCM_EINVALID;
+    }
+    memcpy(b->channel, channel, channelLen + 1);
+
+    unique_lock<mutex> lk(pubmut);
+
+    // If needed: spawn the send thread
     if (!sendRunning) {
         sendRunning = true;
         sendThread = thread{&zcm_blocking::sendThreadFunc, this};
     }
 
-    // TODO: publish should allow dropping of old messages
-    if (!sendQueue.hasFreeSpace()) {
+    // Note: push returns ZCM_EINTR if it was forcefully woken up, which means zcm is
+    //       shutting down, or ZCM_EAGAIN if the queue's policy dropped the message.
+    //       Either way 'm' gives the buffer back to the pool.
+    Msg m(now(), len, buf, &loans);
+    m.stats = statsFor(channel, pubStatsCache);
+    m.stats->published.add(1);
+    m.stats->publishedBytes.add(len);
+    int ret = sendQueue.push(m);
+    if (ret == ZCM_EAGAIN)
         ZCM_DEBUG("sendQueue has no free space");
-        return ZCM_EAGAIN;
-    }
+    return ret;
+}
 
-    // Note: push only fails if it was forcefully woken up, which means zcm is shutting down
-    bool success = sendQueue.push(TimeUtil::utime(), channel.c_str(), len, data);
-    return success ? ZCM_EOK : ZCM_EINTR;
+void zcm_blocking_t::publishCancel(char *buf)
+{
+    loans.put(buf);
 }
 
 // Note: We use a lock on subscribe() to make sure it can be
-// called concurrently. Without the lock, there is a race
-// on modifying and reading the 'subs' and 'subRegex' containers
+// called concurrently. Without the lock, concurrent calls
+// would each copy the same 'subTable' and one would get lost.
+// Dispatching never takes this lock, so callbacks may subscribe.
 zcm_sub_t *zcm_blocking_t::subscribe(const string& channel, zcm_msg_handler_t cb, void *usr)
 {
     unique_lock<mutex> lk(submut);
     int rc;
 
+    const SubTable *cur = subTable.load();
     bool regex = isRegexChannel(channel);
     if (regex) {
-        if (subRegex.size() == 0) {
+        if (cur->subRegex.size() == 0) {
             rc = zcm_trans_recvmsg_enable(zt, NULL, true);
         } else {
             rc = ZCM_EOK;
@@ -284,58 +1175,81 @@ zcm_sub_t *zcm_blocking_t::subscribe(const string& channel, zcm_msg_handler_t cb
         return nullptr;
     }
 
-    zcm_sub_t *sub = new zcm_sub_t();
+    zcm_sub_t *sub = new BlockingSub();
     ZCM_ASSERT(sub);
     strncpy(sub->channel, channel.c_str(), sizeof(sub->channel)/sizeof(sub->channel[0]));
     sub->regex = regex;
     sub->regexobj = nullptr;
     sub->callback = cb;
     sub->usr = usr;
+
+    SubTable *next = new SubTable(*cur);
     if (regex) {
-        sub->regexobj = (void *) new std::regex(sub->channel);
-        ZCM_ASSERT(sub->regexobj);
-        subRegex.push_back(sub);
+        next->subRegex.add(sub, sub->channel);
     } else {
-        subs[channel].push_back(sub);
+        next->subs[channel].push_back(sub);
     }
+    publishSubs(next, nullptr);
 
     return sub;
 }
 
-// Note: We use a lock on unsubscribe() to make sure it can be
-// called concurrently. Without the lock, there is a race
-// on modifying and reading the 'subs' and 'subRegex' containers
+// Note: We use a lock on unsubscribe() for the same reasons as subscribe().
+// A callback that is already running on another dispatch thread may still
+// finish after this returns, but it won't be called for any later message.
 int zcm_blocking_t::unsubscribe(zcm_sub_t *sub)
 {
     unique_lock<mutex> lk(submut);
 
+    SubTable *next = new SubTable(*subTable.load());
     bool success = true;
     if (sub->regex) {
-        success = deleteFromSubList(subRegex, sub);
+        success = next->subRegex.remove(sub);
     } else {
-        auto it = subs.find(sub->channel);
-        if (it == subs.end()) {
+        auto it = next->subs.find(sub->channel);
+        if (it == next->subs.end()) {
             ZCM_DEBUG("failed to find the subscription channel in unsubscribe()");
+            delete next;
             return -1;
         }
 
         SubList& slist = it->second;
         success = deleteFromSubList(slist, sub);
+        if (slist.empty())
+            next->subs.erase(it);
     }
 
     if (!success) {
         ZCM_DEBUG("failed to find the subscription entry in unsubscribe()");
+        delete next;
+        return -1;
+    }
+
+    int rc = ZCM_EOK;
+    if (!sub->regex) {
+        rc = zcm_trans_recvmsg_enable(zt, sub->channel, false);
+    } else if (next->subRegex.size() == 0) {
+        rc = zcm_trans_recvmsg_enable(zt, NULL, false);
+    }
+
+    // Note: 'sub' is freed once no dispatching thread can be using it anymore
+    BlockingSub::cast(sub)->removed.store(true, memory_order_relaxed);
+    publishSubs(next, sub);
+
+    if (rc != ZCM_EOK) {
+        ZCM_DEBUG("zcm_trans_recvmsg_enable() didn't return ZCM_EOK: %d", rc);
         return -1;
     }
 
     return 0;
 }
 
-int zcm_blocking_t::handle()
+// Returns false if messages are dispatched by run() or start() instead
+bool zcm_blocking_t::startHandling()
 {
     if (mode != MODE_NONE && mode != MODE_HANDLE) {
         ZCM_DEBUG("Err: call to handle() when 'mode != MODE_SNODE && mode != MODE_HANDLE'");
-        return -1;
+        return false;
     }
 
     // If this is the first time handle() is called, we need to start the recv thread
@@ -346,46 +1260,287 @@ int zcm_blocking_t::handle()
         mode = MODE_HANDLE;
     }
 
+    return true;
+}
+
+int zcm_blocking_t::handle()
+{
+    if (!startHandling())
+        return -1;
     return handleOneMessage();
 }
 
+int zcm_blocking_t::getFileno(int *fd)
+{
+    if (!startHandling())
+        return ZCM_EINVALID;
+
+    bool opened = readyFd.isOpen();
+    *fd = readyFd.open();
+    if (*fd < 0) {
+        ZCM_DEBUG("failed to open the ready descriptor: %s", strerror(errno));
+        return ZCM_EUNKNOWN;
+    }
+    // Messages may have been queued before there was anything to raise
+    if (!opened && hasReadyMsgs())
+        readyFd.raise();
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::handleReady(uint32_t maxMsgs, uint32_t *numHandled)
+{
+    *numHandled = 0;
+    if (!startHandling())
+        return ZCM_EINVALID;
+
+    Msg m;
+    MsgQueue *from;
+    while (*numHandled < maxMsgs && tryPopLanes(m, from)) {
+        handleMsg(m, from);
+        (*numHandled)++;
+    }
+    settleReadyFd();
+    return ZCM_EOK;
+}
+
 void zcm_blocking_t::flush()
 {
     unique_lock<mutex> lk(pubmut);
-    sendQueue.waitForEmpty();
+    if (sendRunning)
+        sendQueue.waitForDone();
+}
+
+int zcm_blocking_t::setQueueSize(zcm_queue queue, uint32_t size)
+{
+    if (size == 0) return ZCM_EINVALID;
+
+    if (queue & ZCM_SEND_QUEUE) {
+        unique_lock<mutex> lk(pubmut);
+        if (sendRunning) {
+            ZCM_DEBUG("Err: the send queue can't be resized after the first publish()");
+            return ZCM_EINVALID;
+        }
+        sendQueue.setSize(size);
+    }
+
+    if (queue & ZCM_RECV_QUEUE) {
+        if (mode != MODE_NONE) {
+            ZCM_DEBUG("Err: the recv queue can't be resized while messages are being handled");
+            return ZCM_EINVALID;
+        }
+        recvQueue.setSize(size);
+        prioQueue.setSize(size);
+    }
+
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setQueuePolicy(zcm_queue queue, zcm_queue_policy policy)
+{
+    if (policy < ZCM_QUEUE_BLOCK || policy > ZCM_QUEUE_KEEP_LATEST) return ZCM_EINVALID;
+
+    if (queue & ZCM_SEND_QUEUE) sendQueue.setPolicy(policy);
+    if (queue & ZCM_RECV_QUEUE) {
+        recvQueue.setPolicy(policy);
+        prioQueue.setPolicy(policy);
+    }
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setDispatchThreads(uint32_t n)
+{
+    if (n == 0) return ZCM_EINVALID;
+    if (mode != MODE_NONE) {
+        ZCM_DEBUG("Err: the number of dispatch threads can't be changed while running");
+        return ZCM_EINVALID;
+    }
+    numDispatchThreads = n;
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setVirtualTime(bool enable)
+{
+    if (mode != MODE_NONE) {
+        ZCM_DEBUG("Err: virtual time can't be changed while running");
+        return ZCM_EINVALID;
+    }
+    virtualTime = enable;
+    return ZCM_EOK;
+}
+
+uint64_t zcm_blocking_t::now()
+{
+    return virtualTime ? virtualNow.load() : TimeUtil::utime();
+}
+
+int zcm_blocking_t::setChannelQueueSize(zcm_queue queue, const string& channel, uint32_t size)
+{
+    if (channel.size() > ZCM_CHANNEL_MAXLEN) return ZCM_EINVALID;
+
+    if (queue & ZCM_SEND_QUEUE) sendQueue.setChannelSize(channel, size);
+    if (queue & ZCM_RECV_QUEUE) {
+        recvQueue.setChannelSize(channel, size);
+        prioQueue.setChannelSize(channel, size);
+    }
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setChannelPriority(const string& channel, zcm_priority priority)
+{
+    if (channel.size() > ZCM_CHANNEL_MAXLEN) return ZCM_EINVALID;
+    if (priority != ZCM_PRIORITY_NORMAL && priority != ZCM_PRIORITY_HIGH) return ZCM_EINVALID;
+
+    unique_lock<mutex> lk(routemut);
+    Route r = routes[channel];
+    r.high = priority == ZCM_PRIORITY_HIGH;
+    setRoute(channel, r);
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setChannelConflate(const string& channel, bool conflate)
+{
+    if (channel.size() > ZCM_CHANNEL_MAXLEN) return ZCM_EINVALID;
+
+    unique_lock<mutex> lk(routemut);
+    Route r = routes[channel];
+    r.conflate = conflate;
+    setRoute(channel, r);
+    return ZCM_EOK;
+}
+
+// Requires that 'routemut' is held
+void zcm_blocking_t::setRoute(const string& channel, const Route& r)
+{
+    if (!r.high && !r.conflate)
+        routes.erase(channel);
+    else
+        routes[channel] = r;
+    routeVersion.fetch_add(1, memory_order_release);
+
+    // The consumer may be waiting on the recvQueue alone, get it to wait on every lane
+    if ((r.high || r.conflate) && !lanes.exchange(true))
+        recvQueue.forceWakeups();
+}
+
+// Account for a message the send thread is done with
+static void countSent(const Msg& m, uint64_t now, bool sent)
+{
+    ChannelStats *s = m.stats;
+    if (!s)
+        return;
+    if (!sent) {
+        s->sendError.add(1);
+        return;
+    }
+    s->sent.add(1);
+    s->sentBytes.add(m.msg.len);
+    s->sendLatency.record(now > m.msg.utime ? now - m.msg.utime : 0);
 }
 
 void zcm_blocking_t::sendThreadFunc()
 {
+    bool batch = zcm_trans_can_send_batch(zt);
+    vector<Msg> pending;
+    vector<zcm_msg_t> msgs;
+    pending.reserve(SEND_BATCH_MAX);
+    msgs.reserve(SEND_BATCH_MAX);
+
     while (sendRunning) {
-        Msg *m = sendQueue.top();
+        Msg m;
         // If the Queue was forcibly woken-up, recheck the
         // running condition, and then retry.
-        if (m == nullptr)
+        if (!sendQueue.pop(m) || !sendQueue.accept(m))
             continue;
 
-        zcm_msg_t *msg = m->get();
-        int ret = zcm_trans_sendmsg(zt, *msg);
+        if (!batch) {
+            int ret = zcm_trans_sendmsg(zt, *m.get());
+            if (ret != ZCM_EOK)
+                ZCM_DEBUG("zcm_trans_sendmsg() failed to return EOK.. dropping the msg!");
+            countSent(m, now(), ret == ZCM_EOK);
+            sendQueue.done();
+            continue;
+        }
+
+        // Hand everything that is queued by now to the transport at once
+        pending.push_back(std::move(m));
+        while (pending.size() < SEND_BATCH_MAX) {
+            Msg next;
+            if (!sendQueue.tryPop(next))
+                break;
+            if (sendQueue.accept(next))
+                pending.push_back(std::move(next));
+        }
+        for (auto& p : pending)
+            msgs.push_back(*p.get());
+
+        size_t nmsgs = msgs.size();
+        int ret = zcm_trans_sendmsg_batch(zt, msgs.data(), &nmsgs);
         if (ret != ZCM_EOK)
-            ZCM_DEBUG("zcm_trans_sendmsg() failed to return EOK.. dropping the msg!");
-        sendQueue.pop();
+            ZCM_DEBUG("zcm_trans_sendmsg_batch() failed to return EOK.. dropping %zu msgs!",
+                      msgs.size() - nmsgs);
+
+        uint64_t sentUtime = now();
+        for (size_t i = 0; i < pending.size(); i++) {
+            countSent(pending[i], sentUtime, i < nmsgs);
+            sendQueue.done();
+        }
+        pending.clear();
+        msgs.clear();
     }
 }
 
 void zcm_blocking_t::recvThreadFunc()
 {
+    zcm_msg_t msgs[RECV_BATCH_MAX];
+    bool batch = zcm_trans_can_recv_batch(zt);
+    StatsCache statsCache;
+    RouteCache routeCache;
+
     while (recvRunning) {
-        zcm_msg_t msg;
-        int rc = zcm_trans_recvmsg(zt, &msg, RECV_TIMEOUT);
-        if (rc == ZCM_EOK) {
-            bool success;
-            do {
-                // Note: push only fails if it was forcefully woken up. In such a case, we
-                //       need to re-check the running condition; however, if we are still
-                //       running, we want to still push the same message, necessitating the
-                //       addition conditional on running.
-                success = recvQueue.push(&msg);
-            } while(!success && recvRunning);
+        size_t nmsgs = 1;
+        int rc;
+        if (batch) {
+            nmsgs = RECV_BATCH_MAX;
+            rc = zcm_trans_recvmsg_batch(zt, msgs, &nmsgs, RECV_TIMEOUT);
+        } else {
+            rc = lendRecv ? zcm_trans_recvmsg_lend(zt, &msgs[0], RECV_TIMEOUT)
+                          : zcm_trans_recvmsg(zt, &msgs[0], RECV_TIMEOUT);
+        }
+        if (rc != ZCM_EOK)
+            continue;
+
+        for (size_t i = 0; i < nmsgs; i++) {
+            // Note: a lent message is handed straight to the queue, so the payload
+            //       reaches dispatchMsg() without being copied. If the queue drops
+            //       it instead, the loan is given back when 'm' goes out of scope.
+            //       That includes the rest of a batch once we stop running.
+            Msg m = lendRecv ? Msg(&msgs[i], zt) : Msg(&msgs[i]);
+            if (!recvRunning)
+                continue;
+            m.stats = statsFor(m.msg.channel, statsCache);
+            m.stats->received.add(1);
+            m.stats->receivedBytes.add(m.msg.len);
+            bool routed = lanes.load(memory_order_acquire);
+            Lane lane = routed ? laneFor(m.msg.channel, routeCache) : LANE_FIFO;
+            if (lane == LANE_LATEST) {
+                putLatest(m);
+            } else {
+                MsgQueue& q = lane == LANE_PRIORITY ? prioQueue : recvQueue;
+                int ret;
+                do {
+                    // Note: push only fails with ZCM_EINTR if it was forcefully woken up. In
+                    //       such a case, we need to re-check the running condition; however, if
+                    //       we are still running, we want to still push the same message,
+                    //       necessitating the addition conditional on running.
+                    ret = q.push(m);
+                } while(ret == ZCM_EINTR && recvRunning);
+            }
+            // Note: 'lanes' is read again, as the consumer may have switched over to
+            //       waiting on 'laneEc' while the message was being queued. The fence
+            //       in the queue's own notify orders that read after the push.
+            if (routed || lanes.load(memory_order_acquire))
+                laneEc.notify();
+            readyFd.raise();
         }
     }
 }
@@ -396,75 +1551,471 @@ void zcm_blocking_t::handleThreadFunc()
     recvRunning = true;
     recvThread = thread{&zcm_blocking::recvThreadFunc, this};
 
+    if (numDispatchThreads > 1)
+        startWorkers();
+
     // Become the handle thread
     while (handleRunning)
         handleOneMessage();
 
+    stopWorkers();
+
     // Shutdown recv thread
     recvRunning = false;
-    recvQueue.forceWakeups();
+    wakeRecvQueues();
     recvThread.join();
 }
 
-void zcm_blocking_t::dispatchMsg(zcm_msg_t *msg)
+void zcm_blocking_t::startWorkers()
+{
+    unique_lock<mutex> lk(submut);
+    workersRunning = true;
+    for (size_t i = 0; i < numDispatchThreads; i++) {
+        Worker *w = new Worker(recvQueue.getCapacity());
+        workers.emplace_back(w);
+        w->thr = thread{&zcm_blocking::workerThreadFunc, this, w};
+    }
+}
+
+void zcm_blocking_t::stopWorkers()
+{
+    // Note: 'submut' can't be held while joining, a callback might be
+    //       waiting on it to subscribe
+    workersRunning = false;
+    for (auto& w : workers) {
+        w->queue.forceWakeups();
+        w->thr.join();
+    }
+
+    unique_lock<mutex> lk(submut);
+    // Note: any message still queued for a worker is dropped here
+    for (auto& w : workers) {
+        Job j;
+        while (w->queue.tryPop(j))
+            discardJob(j.m, j.from, false);
+    }
+    workers.clear();
+}
+
+void zcm_blocking_t::wakeWorkers()
+{
+    unique_lock<mutex> lk(submut);
+    for (auto& w : workers)
+        w->queue.forceWakeups();
+}
+
+void zcm_blocking_t::workerThreadFunc(Worker *w)
 {
+    while (workersRunning) {
+        Job j;
+        // If the Queue was forcibly woken-up, recheck the
+        // running condition, and then retry.
+        if (!w->queue.pop(j))
+            continue;
+        // A newer message of its channel may have made it obsolete while it waited
+        if (j.from && !j.from->accept(j.m))
+            continue;
+        dispatchMsg(j.m, w->dispatcher);
+        if (j.from)
+            j.from->done();
+    }
+}
+
+// Announce through the hazard pointer of 'd' that the current SubTable is in use
+// Returns the table, which stays valid until the hazard pointer is cleared
+const zcm_blocking_t::SubTable *zcm_blocking_t::acquireSubs(Dispatcher& d)
+{
+    const SubTable *t = subTable.load();
+    while (true) {
+        d.hazard.store(t);
+        // If the table was swapped before our hazard pointer was visible,
+        // reclaimSubs() may not have seen it and 't' may be gone
+        const SubTable *now = subTable.load();
+        if (now == t) return t;
+        t = now;
+    }
+}
+
+// Swap in 'next' and retire the current table along with 'removed', if any
+// Requires that 'submut' is held
+void zcm_blocking_t::publishSubs(SubTable *next, zcm_sub_t *removed)
+{
+    const SubTable *prev = subTable.load();
+    next->version = prev->version + 1;
+    subTable.store(next);
+
+    Retired r;
+    r.table.reset(prev);
+    if (removed) r.subs.push_back(removed);
+    retired.push_back(std::move(r));
+
+    reclaimSubs();
+}
+
+// Free the retired tables, oldest first, until one is still being read. A
+// subscription removed from a table is in every older table, so it can only be
+// freed along with the newest of them.
+// Requires that 'submut' is held
+void zcm_blocking_t::reclaimSubs()
+{
+    vector<const SubTable*> inUse;
+    inUse.push_back(handleDispatcher.hazard.load());
+    for (auto& w : workers)
+        inUse.push_back(w->dispatcher.hazard.load());
+
+    size_t n = 0;
+    for (; n < retired.size(); n++) {
+        const SubTable *t = retired[n].table.get();
+        if (find(inUse.begin(), inUse.end(), t) != inUse.end())
+            break;
+        for (zcm_sub_t *sub : retired[n].subs)
+            delete BlockingSub::cast(sub);
+    }
+    retired.erase(retired.begin(), retired.begin() + n);
+}
+
+// FNV-1a, only used to spread channels over the dispatch workers
+static size_t channelHash(const char *channel)
+{
+    size_t h = 2166136261u;
+    for (; *channel; channel++) {
+        h ^= (unsigned char)*channel;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Requires that 't' is protected by the hazard pointer of the cache's Dispatcher
+const zcm_blocking_t::SubList& zcm_blocking_t::findSubs(const SubTable *t, const char *channel,
+                                                        SubCache& cache)
+{
+    // Plenty for any real system, only there to bound the memory
+    // used when channel names are generated on the fly
+    static constexpr size_t MAX_CACHED_CHANNELS = 1024;
+
+    if (cache.version != t->version) {
+        cache.lists.clear();
+        cache.version = t->version;
+    }
+
+    auto it = cache.lists.find(channel);
+    if (it != cache.lists.end())
+        return it->second;
+
+    if (cache.lists.size() >= MAX_CACHED_CHANNELS)
+        cache.lists.clear();
+
+    SubList& slist = cache.lists[channel];
+    auto sit = t->subs.find(channel);
+    if (sit != t->subs.end())
+        slist = sit->second;
+    t->subRegex.match(channel, slist);
+    return slist;
+}
+
+void zcm_blocking_t::dispatchMsg(Msg& m, Dispatcher& d)
+{
+    zcm_msg_t *msg = m.get();
     zcm_recv_buf_t rbuf;
     rbuf.recv_utime = msg->utime;
     rbuf.zcm = z;
     rbuf.data = (char*)msg->buf;
     rbuf.data_size = msg->len;
 
-    // Note: We use a lock on dispatch to ensure there is not
-    // a race on modifying and reading the 'subs' container.
-    // This means users cannot call zcm_subscribe or
-    // zcm_unsubscribe from a callback without deadlocking.
-    {
-        unique_lock<mutex> lk(submut);
+    if (virtualTime) {
+        uint64_t t = virtualNow.load();
+        while (t < msg->utime && !virtualNow.compare_exchange_weak(t, msg->utime)) {}
+    }
 
-        // dispatch to a non regex channel
-        auto it = subs.find(msg->channel);
-        if (it != subs.end()) {
-            for (zcm_sub_t *sub : it->second) {
-                sub->callback(&rbuf, msg->channel, sub->usr);
-            }
+    // Note: We don't lock anything on dispatch. The subscriptions are read from
+    // a snapshot that subscribe() and unsubscribe() replace rather than modify,
+    // so users may call zcm_subscribe or zcm_unsubscribe from a callback.
+    // A message is dispatched to the subscriptions it was matched with, even if
+    // one of its callbacks subscribes, but not to those that were unsubscribed since.
+    const SubTable *t = acquireSubs(d);
+
+    // dispatch to the non regex subscriptions first, then to the regex ones
+    const SubList& subs = findSubs(t, msg->channel, d.cache);
+    for (zcm_sub_t *sub : subs) {
+        if (BlockingSub::cast(sub)->removed.load(memory_order_relaxed))
+            continue;
+        sub->callback(&rbuf, msg->channel, sub->usr);
+    }
+
+    // Note: transports that don't timestamp their messages leave utime at 0
+    if (!subs.empty() && m.stats) {
+        m.stats->dispatched.add(1);
+        if (msg->utime != 0) {
+            uint64_t dispatchUtime = now();
+            m.stats->dispatchLatency.record(dispatchUtime > msg->utime ?
+                                            dispatchUtime - msg->utime : 0);
         }
+    }
 
-        // dispatch to any regex channels
-        for (zcm_sub_t *sub : subRegex) {
-            regex *r = (regex *)sub->regexobj;
-            if (regex_match(msg->channel, *r)) {
-                sub->callback(&rbuf, msg->channel, sub->usr);
-            }
+    d.hazard.store(nullptr);
+}
+
+// Look up the statistics of 'channel' in the calling thread's own 'cache' first,
+// so the shared registry is only locked the first time a thread sees a channel
+ChannelStats *zcm_blocking_t::statsFor(const char *channel, StatsCache& cache)
+{
+    auto it = cache.find(channel);
+    if (it != cache.end())
+        return it->second;
+
+    unique_lock<mutex> lk(statsmut);
+    auto sit = stats.find(channel);
+    if (sit == stats.end()) {
+        // Past the limit, new channels are accounted together under ""
+        string name = stats.size() < STATS_MAX_CHANNELS ? channel : "";
+        sit = stats.find(name);
+        if (sit == stats.end())
+            sit = stats.emplace(name, unique_ptr<ChannelStats>(new ChannelStats(name))).first;
+    }
+    ChannelStats *cs = sit->second.get();
+    lk.unlock();
+
+    cache.emplace(channel, cs);
+    return cs;
+}
+
+int zcm_blocking_t::getStats(zcm_stats_t *out)
+{
+    out->send_queue_high_water = sendQueue.getHighWater();
+    out->recv_queue_high_water = max(recvQueue.getHighWater(), prioQueue.getHighWater());
+    zcm_trans_get_stats(zt, &out->transport);
+
+    unique_lock<mutex> lk(statsmut);
+    out->nchannels = stats.size();
+    out->channels = NULL;
+    if (out->nchannels == 0)
+        return ZCM_EOK;
+    out->channels = (zcm_channel_stats_t*)malloc(out->nchannels * sizeof(zcm_channel_stats_t));
+    if (!out->channels) {
+        zcm_free_stats(out);
+        return ZCM_EUNKNOWN;
+    }
+    size_t i = 0;
+    for (auto& it : stats)
+        it.second->copyTo(&out->channels[i++]);
+    return ZCM_EOK;
+}
+
+zcm_blocking_t::Lane zcm_blocking_t::laneFor(const char *channel, RouteCache& cache)
+{
+    // Plenty for any real system, see findSubs()
+    static constexpr size_t MAX_CACHED_CHANNELS = 1024;
+
+    uint64_t version = routeVersion.load(memory_order_acquire);
+    if (cache.version != version) {
+        cache.lanes.clear();
+        cache.version = version;
+    }
+
+    auto it = cache.lanes.find(channel);
+    if (it != cache.lanes.end())
+        return it->second;
+
+    unique_lock<mutex> lk(routemut);
+    Lane lane = LANE_FIFO;
+    auto rit = routes.find(channel);
+    if (rit != routes.end())
+        lane = rit->second.conflate ? LANE_LATEST : rit->second.high ? LANE_PRIORITY : LANE_FIFO;
+    lk.unlock();
+
+    if (cache.lanes.size() >= MAX_CACHED_CHANNELS)
+        cache.lanes.clear();
+    cache.lanes.emplace(channel, lane);
+    return lane;
+}
+
+// Store 'm' in its channel's slot, replacing the message there if it wasn't taken yet
+void zcm_blocking_t::putLatest(Msg& m)
+{
+    // Note: declared first so the replaced message is given back after unlocking
+    Msg old;
+
+    unique_lock<mutex> lk(slotmut);
+    unique_ptr<Slot>& slot = slots[m.msg.channel];
+    if (!slot)
+        slot.reset(new Slot());
+
+    old = std::move(slot->msg);
+    slot->msg = std::move(m);
+    if (slot->fresh) {
+        if (old.stats)
+            old.stats->recvConflated.add(1);
+        return;
+    }
+    slot->fresh = true;
+    freshSlots.push_back(slot.get());
+    numFresh.fetch_add(1, memory_order_release);
+}
+
+// Take the message of the slot that has been fresh the longest, if any
+bool zcm_blocking_t::takeLatest(Msg& m)
+{
+    if (numFresh.load(memory_order_acquire) == 0)
+        return false;
+
+    unique_lock<mutex> lk(slotmut);
+    if (freshSlots.empty())
+        return false;
+    Slot *slot = freshSlots.front();
+    freshSlots.pop_front();
+    numFresh.fetch_sub(1, memory_order_relaxed);
+    slot->fresh = false;
+    m = std::move(slot->msg);
+    return true;
+}
+
+// True if any receive lane holds a message
+bool zcm_blocking_t::hasReadyMsgs()
+{
+    return prioQueue.hasMessage() || recvQueue.hasMessage() ||
+           numFresh.load(memory_order_acquire) > 0;
+}
+
+// Same as popLanes() but returns false right away if every lane is empty
+bool zcm_blocking_t::tryPopLanes(Msg& m, MsgQueue*& from)
+{
+    from = &prioQueue;
+    if (prioQueue.tryPop(m)) return true;
+
+    latestTurn = !latestTurn;
+    from = nullptr;
+    if (latestTurn && takeLatest(m)) return true;
+    from = &recvQueue;
+    if (recvQueue.tryPop(m)) return true;
+    from = nullptr;
+    if (!latestTurn && takeLatest(m)) return true;
+    return false;
+}
+
+// Wait for a message in any receive lane. The priority lane always goes first, the
+// slots of conflated channels and the recvQueue take turns so neither starves.
+// Sets 'from' to the queue the message came from, or nullptr for a slot
+// Returns false if woken up by wakeRecvQueues() after 'localWakeupNum' was sampled
+bool zcm_blocking_t::popLanes(Msg& m, int localWakeupNum, MsgQueue*& from)
+{
+    auto ready = [&](){
+        return hasReadyMsgs() ||
+               laneWakeupNum.load(memory_order_acquire) != localWakeupNum;
+    };
+
+    while (true) {
+        if (tryPopLanes(m, from)) return true;
+
+        if (laneWakeupNum.load(memory_order_acquire) != localWakeupNum) return false;
+
+        uint32_t key = laneEc.prepareWait();
+        if (ready()) {
+            laneEc.cancelWait();
+            continue;
         }
+        laneEc.wait(key);
     }
 }
 
+// Leave the ready descriptor readable only while messages are waiting
+void zcm_blocking_t::settleReadyFd()
+{
+    if (!readyFd.isOpen() || hasReadyMsgs())
+        return;
+    readyFd.lower();
+    // The recv thread may have queued another message before we lowered it
+    if (hasReadyMsgs())
+        readyFd.raise();
+}
+
+// Force everything waiting on the receive lanes to wakeup
+void zcm_blocking_t::wakeRecvQueues()
+{
+    recvQueue.forceWakeups();
+    prioQueue.forceWakeups();
+    laneWakeupNum.fetch_add(1, memory_order_acq_rel);
+    laneEc.notify();
+}
+
 int zcm_blocking_t::handleOneMessage()
 {
-    Msg *m = recvQueue.top();
+    Msg m;
+    MsgQueue *lane = &recvQueue;
+    bool popped = false;
+    int localWakeupNum = laneWakeupNum.load(memory_order_acquire);
+
     // If the Queue was forcibly woken-up, recheck the
     // running condition, and then retry.
-    if (m == nullptr)
+    if (!lanes.load(memory_order_acquire)) {
+        popped = recvQueue.pop(m);
+        // Unless it was only to switch over to waiting on every lane
+        if (!popped && !lanes.load(memory_order_acquire))
+            return -1;
+    }
+    if (!popped && !popLanes(m, localWakeupNum, lane))
         return -1;
 
-    dispatchMsg(m->get());
-    recvQueue.pop();
+    handleMsg(m, lane);
     return 0;
 }
 
-bool zcm_blocking_t::deleteSubEntry(zcm_sub_t *sub, size_t nentriesleft)
+// Queue a message for the worker of its channel. A worker that is a whole queue
+// behind gets the receive policy applied: only ZCM_QUEUE_BLOCK waits for room, the
+// others drop a message of that worker rather than hold up every other worker
+void zcm_blocking_t::feedWorker(Msg& m, MsgQueue *from)
 {
-    int rc = ZCM_EOK;
-    if (sub->regex) {
-        delete (std::regex *) sub->regexobj;
-        if (nentriesleft == 0) {
-            rc = zcm_trans_recvmsg_enable(zt, NULL, false);
-        }
-    } else {
-        rc = zcm_trans_recvmsg_enable(zt, sub->channel, false);
+    Worker *w = workers[channelHash(m.msg.channel) % workers.size()].get();
+    switch (recvQueue.getPolicy()) {
+        case ZCM_QUEUE_BLOCK: {
+            // Note: push only fails if the worker was forcefully woken up, which
+            //       means we are shutting down and the message may be dropped
+            if (!w->queue.push(std::move(m), from))
+                discardJob(m, from, false);
+        } break;
+        case ZCM_QUEUE_DROP_NEWEST: {
+            if (!w->queue.tryPush(std::move(m), from))
+                discardJob(m, from, true);
+        } break;
+        default: {
+            while (!w->queue.tryPush(std::move(m), from)) {
+                // The slot may only be busy because the worker is moving out of it
+                if (w->queue.hasFreeSpace()) {
+                    this_thread::yield();
+                    continue;
+                }
+                Job victim;
+                if (w->queue.tryPop(victim))
+                    discardJob(victim.m, victim.from, true);
+            }
+        } break;
+    }
+}
+
+// Account for a message on its way to a worker that won't be dispatched, as a drop
+// if its worker's queue was 'full'
+void zcm_blocking_t::discardJob(Msg& m, MsgQueue *from, bool full)
+{
+    // Stale messages were already counted when they were marked
+    if (from && !from->accept(m))
+        return;
+    if (full && m.stats)
+        m.stats->workerQueueFull.add(1);
+    if (from)
+        from->done();
+}
+
+// Dispatch a message taken out of the receive lane 'from', or out of a slot if nullptr
+void zcm_blocking_t::handleMsg(Msg& m, MsgQueue *from)
+{
+    if (!workers.empty()) {
+        feedWorker(m, from);
+        return;
     }
-    delete sub;
-    return rc == ZCM_EOK;
+    if (from && !from->accept(m))
+        return;
+    dispatchMsg(m, handleDispatcher);
+    if (from)
+        from->done();
 }
 
 bool zcm_blocking_t::deleteFromSubList(SubList& slist, zcm_sub_t *sub)
@@ -475,8 +2026,7 @@ bool zcm_blocking_t::deleteFromSubList(SubList& slist, zcm_sub_t *sub)
             size_t last = slist.size()-1;
             slist[i] = slist[last];
             slist.resize(last);
-            // delete the element
-            return deleteSubEntry(sub, slist.size());
+            return true;
         }
     }
     return false;
@@ -500,6 +2050,21 @@ int zcm_blocking_publish(zcm_blocking_t *zcm, const char *channel, const char *d
     return zcm->publish(channel, data, len);
 }
 
+char *zcm_blocking_publish_loan(zcm_blocking_t *zcm, uint32_t len)
+{
+    return zcm->publishLoan(len);
+}
+
+int zcm_blocking_publish_commit(zcm_blocking_t *zcm, const char *channel, char *buf, uint32_t len)
+{
+    return zcm->publishCommit(channel, buf, len);
+}
+
+void zcm_blocking_publish_cancel(zcm_blocking_t *zcm, char *buf)
+{
+    zcm->publishCancel(buf);
+}
+
 zcm_sub_t *zcm_blocking_subscribe(zcm_blocking_t *zcm, const char *channel, zcm_msg_handler_t cb,
                                   void *usr)
 {
@@ -516,6 +2081,44 @@ void zcm_blocking_flush(zcm_blocking_t *zcm)
     zcm->flush();
 }
 
+int zcm_blocking_set_queue_size(zcm_blocking_t *zcm, enum zcm_queue queue, uint32_t size)
+{
+    return zcm->setQueueSize(queue, size);
+}
+
+int zcm_blocking_set_queue_policy(zcm_blocking_t *zcm, enum zcm_queue queue,
+                                  enum zcm_queue_policy policy)
+{
+    return zcm->setQueuePolicy(queue, policy);
+}
+
+int zcm_blocking_set_channel_priority(zcm_blocking_t *zcm, const char *channel,
+                                      enum zcm_priority priority)
+{
+    return zcm->setChannelPriority(channel, priority);
+}
+
+int zcm_blocking_set_channel_conflate(zcm_blocking_t *zcm, const char *channel, int conflate)
+{
+    return zcm->setChannelConflate(channel, conflate != 0);
+}
+
+int zcm_blocking_set_dispatch_threads(zcm_blocking_t *zcm, uint32_t n)
+{
+    return zcm->setDispatchThreads(n);
+}
+
+int zcm_blocking_get_stats(zcm_blocking_t *zcm, zcm_stats_t *stats)
+{
+    return zcm->getStats(stats);
+}
+
+int zcm_blocking_set_channel_queue_size(zcm_blocking_t *zcm, enum zcm_queue queue,
+                                        const char *channel, uint32_t size)
+{
+    return zcm->setChannelQueueSize(queue, channel, size);
+}
+
 void zcm_blocking_run(zcm_blocking_t *zcm)
 {
     zcm->run();
@@ -536,4 +2139,24 @@ int zcm_blocking_handle(zcm_blocking_t *zcm)
     return zcm->handle();
 }
 
+int zcm_blocking_set_virtual_time(zcm_blocking_t *zcm, int enable)
+{
+    return zcm->setVirtualTime(enable != 0);
+}
+
+uint64_t zcm_blocking_get_utime(zcm_blocking_t *zcm)
+{
+    return zcm->now();
+}
+
+int zcm_blocking_get_fileno(zcm_blocking_t *zcm, int *fd)
+{
+    return zcm->getFileno(fd);
+}
+
+int zcm_blocking_handle_ready(zcm_blocking_t *zcm, uint32_t max_msgs, uint32_t *num_handled)
+{
+    return zcm->handleReady(max_msgs, num_handled);
+}
+
 }
@@ -14,16 +14,36 @@ void            zcm_blocking_destroy(zcm_blocking_t *zcm);
 
 int        zcm_blocking_publish(zcm_blocking_t *zcm, const char *channel, const char *data,
                                 uint32_t len);
+char      *zcm_blocking_publish_loan(zcm_blocking_t *zcm, uint32_t len);
+int        zcm_blocking_publish_commit(zcm_blocking_t *zcm, const char *channel, char *buf,
+                                       uint32_t len);
+void       zcm_blocking_publish_cancel(zcm_blocking_t *zcm, char *buf);
 zcm_sub_t *zcm_blocking_subscribe(zcm_blocking_t *zcm, const char *channel, zcm_msg_handler_t cb,
                                   void *usr);
 int        zcm_blocking_unsubscribe(zcm_blocking_t *zcm, zcm_sub_t *sub);
 
 void zcm_blocking_flush(zcm_blocking_t *zcm);
 
+int zcm_blocking_set_queue_size(zcm_blocking_t *zcm, enum zcm_queue queue, uint32_t size);
+int zcm_blocking_set_queue_policy(zcm_blocking_t *zcm, enum zcm_queue queue,
+                                  enum zcm_queue_policy policy);
+int zcm_blocking_set_channel_queue_size(zcm_blocking_t *zcm, enum zcm_queue queue,
+                                        const char *channel, uint32_t size);
+int zcm_blocking_set_channel_priority(zcm_blocking_t *zcm, const char *channel,
+                                      enum zcm_priority priority);
+int zcm_blocking_set_channel_conflate(zcm_blocking_t *zcm, const char *channel, int conflate);
+int zcm_blocking_set_dispatch_threads(zcm_blocking_t *zcm, uint32_t n);
+int zcm_blocking_set_virtual_time(zcm_blocking_t *zcm, int enable);
+uint64_t zcm_blocking_get_utime(zcm_blocking_t *zcm);
+
+int zcm_blocking_get_stats(zcm_blocking_t *zcm, zcm_stats_t *stats);
+
 void   zcm_blocking_run(zcm_blocking_t *zcm);
 void   zcm_blocking_start(zcm_blocking_t *zcm);
 void   zcm_blocking_stop(zcm_blocking_t *zcm);
 int    zcm_blocking_handle(zcm_blocking_t *zcm);
+int    zcm_blocking_get_fileno(zcm_blocking_t *zcm, int *fd);
+int    zcm_blocking_handle_ready(zcm_blocking_t *zcm, uint32_t max_msgs, uint32_t *num_handled);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,442 @@
+#include "zcm/channel_regex.h"
+
+#include <string.h>
+
+/* The NFA is built with Thompson's construction: every fragment of the pattern
+   compiles to a start state and a list of the arrows left dangling out of it,
+   which get patched to point at whatever follows. The list is threaded through
+   the dangling 'out' and 'out1' fields themselves, so building needs no memory
+   besides the states. */
+
+enum {
+    OP_CHAR,  /* consumes 'arg' */
+    OP_ANY,   /* consumes anything but a line terminator */
+    OP_CLASS, /* consumes a character of class 'arg' */
+    OP_SPLIT, /* continues with both 'out' and 'out1' */
+    OP_EMPTY, /* continues with 'out' */
+    OP_BOL,   /* continues with 'out' at the start of the channel */
+    OP_EOL,   /* continues with 'out' at the end of the channel */
+    OP_MATCH
+};
+
+#define NIL 0xffff
+
+/* A dangling arrow is its state's index times two, plus one for 'out1' */
+typedef struct
+{
+    uint16_t start;
+    uint16_t out;
+} frag_t;
+
+typedef struct
+{
+    zcm_regex_t *re;
+    const char *p;
+    size_t depth;
+    bool err;
+} parser_t;
+
+static const frag_t NO_FRAG = { 0, NIL };
+
+static uint16_t *arrow(zcm_regex_t *re, uint16_t a)
+{
+    return (a & 1) ? &re->states[a >> 1].out1 : &re->states[a >> 1].out;
+}
+
+static void patch(zcm_regex_t *re, uint16_t list, uint16_t s)
+{
+    uint16_t next;
+    while (list != NIL) {
+        next = *arrow(re, list);
+        *arrow(re, list) = s;
+        list = next;
+    }
+}
+
+static uint16_t append(zcm_regex_t *re, uint16_t l1, uint16_t l2)
+{
+    uint16_t a = l1;
+    if (l1 == NIL) return l2;
+    while (*arrow(re, a) != NIL)
+        a = *arrow(re, a);
+    *arrow(re, a) = l2;
+    return l1;
+}
+
+/* Returns the fragment of a new state whose 'out' dangles, except for a split
+   which continues with 'out' and whose 'out1' dangles */
+static frag_t newState(parser_t *ps, uint8_t op, uint8_t arg, uint16_t out)
+{
+    zcm_regex_t *re = ps->re;
+    zcm_regex_state_t *st;
+    frag_t f;
+
+    if (ps->err || re->nstates == ZCM_REGEX_MAX_STATES) {
+        ps->err = true;
+        return NO_FRAG;
+    }
+    f.start = re->nstates++;
+    st = &re->states[f.start];
+    st->op = op;
+    st->arg = arg;
+    st->out1 = NIL;
+    if (op == OP_SPLIT) {
+        st->out = out;
+        f.out = (uint16_t)(f.start * 2 + 1);
+    } else {
+        st->out = NIL;
+        f.out = (uint16_t)(f.start * 2);
+    }
+    return f;
+}
+
+static void setBit(uint8_t *bits, unsigned c)
+{
+    bits[c >> 3] |= (uint8_t)(1 << (c & 7));
+}
+
+static bool isWordChar(unsigned c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_';
+}
+
+/* Adds the characters of the class escape 'c' (as in "\d") to 'bits'
+   Returns false if 'c' isn't one */
+static bool addEscapeClass(uint8_t *bits, char c)
+{
+    unsigned i;
+    bool in;
+    switch (c) {
+        case 'd': case 'D': case 'w': case 'W': case 's': case 'S': break;
+        default: return false;
+    }
+    for (i = 0; i < 256; ++i) {
+        switch (c) {
+            case 'd': case 'D': in = i >= '0' && i <= '9'; break;
+            case 'w': case 'W': in = isWordChar(i); break;
+            default: in = i == ' ' || (i >= '\t' && i <= '\r'); break;
+        }
+        if (in == (c >= 'a'))
+            setBit(bits, i);
+    }
+    return true;
+}
+
+/* Parses the character escaped by "\c", which isn't a class escape
+   Returns -1 if it isn't supported */
+static int escapedChar(char c)
+{
+    switch (c) {
+        case 't': return '\t';
+        case 'n': return '\n';
+        case 'v': return '\v';
+        case 'f': return '\f';
+        case 'r': return '\r';
+        case '0': return '\0';
+        case '\0': return -1;
+    }
+    /* Other letters and digits are assertions, backreferences or unicode */
+    if (isWordChar((unsigned char)c)) return -1;
+    return (unsigned char)c;
+}
+
+/* Parses a character of a bracket expression into its value, or -1 if it
+   was a class escape that was added to 'bits' */
+static int classChar(parser_t *ps, uint8_t *bits)
+{
+    int c = (unsigned char)*ps->p++;
+    if (c != '\\') return c;
+
+    /* A trailing backslash escapes nothing, don't step past the end */
+    c = *ps->p;
+    if (c == '\0') {
+        ps->err = true;
+        return -1;
+    }
+    ps->p++;
+    if (addEscapeClass(bits, (char)c)) return -1;
+    if (c == 'b') return '\b';
+    c = escapedChar((char)c);
+    if (c < 0) ps->err = true;
+    return c;
+}
+
+static frag_t newClass(parser_t *ps, uint8_t **bits)
+{
+    zcm_regex_t *re = ps->re;
+    if (re->nclasses == ZCM_REGEX_MAX_CLASSES) {
+        ps->err = true;
+        return NO_FRAG;
+    }
+    *bits = re->classes[re->nclasses];
+    memset(*bits, 0, 32);
+    return newState(ps, OP_CLASS, re->nclasses++, NIL);
+}
+
+/* Parses the rest of a bracket expression, after the '[' */
+static frag_t parseBracket(parser_t *ps)
+{
+    uint8_t *bits;
+    bool negate;
+    int lo, hi, c;
+    size_t i;
+    frag_t f = newClass(ps, &bits);
+    if (ps->err) return f;
+
+    negate = *ps->p == '^';
+    if (negate) ps->p++;
+
+    while (*ps->p != ']') {
+        if (*ps->p == '\0') {
+            ps->err = true;
+            return f;
+        }
+        lo = classChar(ps, bits);
+        if (ps->err) return f;
+        if (lo < 0) continue;
+
+        hi = lo;
+        if (ps->p[0] == '-' && ps->p[1] != ']' && ps->p[1] != '\0') {
+            ps->p++;
+            hi = classChar(ps, bits);
+            if (ps->err || hi < lo) {
+                ps->err = true;
+                return f;
+            }
+        }
+        for (c = lo; c <= hi; ++c)
+            setBit(bits, (unsigned)c);
+    }
+    ps->p++;
+
+    if (negate)
+        for (i = 0; i < 32; ++i)
+            bits[i] = (uint8_t)~bits[i];
+    return f;
+}
+
+static frag_t parseAlt(parser_t *ps);
+
+static frag_t parseAtom(parser_t *ps)
+{
+    char c = *ps->p++;
+    uint8_t *bits;
+    int e;
+    frag_t f;
+
+    switch (c) {
+        case '(': {
+            /* Non-capturing groups are the same to us, lookaheads aren't supported */
+            if (ps->p[0] == '?') {
+                if (ps->p[1] != ':') break;
+                ps->p += 2;
+            }
+            if (++ps->depth > ZCM_REGEX_MAX_STATES) break;
+            f = parseAlt(ps);
+            ps->depth--;
+            if (ps->err || *ps->p != ')') break;
+            ps->p++;
+            return f;
+        }
+        case '.': return newState(ps, OP_ANY, 0, NIL);
+        case '^': return newState(ps, OP_BOL, 0, NIL);
+        case '$': return newState(ps, OP_EOL, 0, NIL);
+        case '[': return parseBracket(ps);
+        case '\\': {
+            c = *ps->p;
+            if (c == '\0') break;
+            ps->p++;
+            switch (c) {
+                case 'd': case 'D': case 'w': case 'W': case 's': case 'S': {
+                    f = newClass(ps, &bits);
+                    if (!ps->err) addEscapeClass(bits, c);
+                    return f;
+                }
+            }
+            e = escapedChar(c);
+            if (e < 0) break;
+            return newState(ps, OP_CHAR, (uint8_t)e, NIL);
+        }
+        /* Nothing to repeat, unbalanced, counted repetition */
+        case '*': case '+': case '?': case ')': case '{': case '}': case ']': case '\0':
+            break;
+        default:
+            return newState(ps, OP_CHAR, (uint8_t)c, NIL);
+    }
+
+    ps->err = true;
+    return NO_FRAG;
+}
+
+static frag_t parseRepeat(parser_t *ps)
+{
+    frag_t f = parseAtom(ps);
+    frag_t s;
+    char q;
+
+    /* Nothing more of the pattern is read once it failed to parse */
+    if (ps->err) return f;
+    q = *ps->p;
+    if (q != '*' && q != '+' && q != '?')
+        return f;
+    ps->p++;
+    /* A lazy quantifier matches the same channels */
+    if (*ps->p == '?')
+        ps->p++;
+    if (*ps->p == '*' || *ps->p == '+' || *ps->p == '?' || *ps->p == '{') {
+        ps->err = true;
+        return f;
+    }
+
+    s = newState(ps, OP_SPLIT, 0, f.start);
+    if (ps->err) return s;
+    switch (q) {
+        case '*':
+            patch(ps->re, f.out, s.start);
+            return s;
+        case '+':
+            patch(ps->re, f.out, s.start);
+            s.start = f.start;
+            return s;
+        default:
+            s.out = append(ps->re, f.out, s.out);
+            return s;
+    }
+}
+
+static frag_t parseConcat(parser_t *ps)
+{
+    frag_t f, g;
+    bool empty = true;
+
+    while (!ps->err && *ps->p != '\0' && *ps->p != '|' && *ps->p != ')') {
+        g = parseRepeat(ps);
+        if (ps->err) return g;
+        if (empty) {
+            f = g;
+            empty = false;
+        } else {
+            patch(ps->re, f.out, g.start);
+            f.out = g.out;
+        }
+    }
+    if (empty)
+        return newState(ps, OP_EMPTY, 0, NIL);
+    return f;
+}
+
+static frag_t parseAlt(parser_t *ps)
+{
+    frag_t f = parseConcat(ps);
+    frag_t g, s;
+
+    while (!ps->err && *ps->p == '|') {
+        ps->p++;
+        g = parseConcat(ps);
+        s = newState(ps, OP_SPLIT, 0, f.start);
+        if (ps->err) return s;
+        ps->re->states[s.start].out1 = g.start;
+        s.out = append(ps->re, f.out, g.out);
+        f = s;
+    }
+    return f;
+}
+
+bool zcm_regex_compile(zcm_regex_t *re, const char *pattern)
+{
+    parser_t ps;
+    frag_t f, m;
+
+    re->nstates = 0;
+    re->nclasses = 0;
+    ps.re = re;
+    ps.p = pattern;
+    ps.depth = 0;
+    ps.err = false;
+
+    f = parseAlt(&ps);
+    if (ps.err || *ps.p != '\0') return false;
+    m = newState(&ps, OP_MATCH, 0, NIL);
+    if (ps.err) return false;
+    patch(re, f.out, m.start);
+    re->start = f.start;
+    return true;
+}
+
+/* Adds 's' to 'list' along with every state it leads to without consuming anything,
+   skipping those already added for this position */
+static void addState(const zcm_regex_t *re, uint16_t s, size_t pos, size_t len,
+                     uint16_t *list, size_t *n, size_t *marks, size_t gen, uint16_t *stack)
+{
+    size_t sp = 0;
+    const zcm_regex_state_t *st;
+
+    marks[s] = gen;
+    stack[sp++] = s;
+    while (sp > 0) {
+        st = &re->states[stack[--sp]];
+        switch (st->op) {
+            case OP_SPLIT:
+                if (marks[st->out1] != gen) {
+                    marks[st->out1] = gen;
+                    stack[sp++] = st->out1;
+                }
+                /* fall through */
+            case OP_EMPTY:
+            case OP_BOL:
+            case OP_EOL:
+                if ((st->op == OP_BOL && pos != 0) || (st->op == OP_EOL && pos != len))
+                    break;
+                if (marks[st->out] != gen) {
+                    marks[st->out] = gen;
+                    stack[sp++] = st->out;
+                }
+                break;
+            default:
+                list[(*n)++] = (uint16_t)(st - re->states);
+                break;
+        }
+    }
+}
+
+bool zcm_regex_match(const zcm_regex_t *re, const char *str, size_t len)
+{
+    uint16_t lists[2][ZCM_REGEX_MAX_STATES];
+    uint16_t stack[ZCM_REGEX_MAX_STATES];
+    size_t marks[ZCM_REGEX_MAX_STATES];
+    size_t n[2];
+    size_t cur = 0;
+    size_t gen = 1;
+    size_t i, j;
+    unsigned c;
+    const zcm_regex_state_t *st;
+    bool step;
+
+    memset(marks, 0, sizeof(marks));
+    n[0] = 0;
+    addState(re, re->start, 0, len, lists[0], &n[0], marks, gen, stack);
+
+    for (i = 0; i < len && n[cur] > 0; ++i) {
+        c = (unsigned char)str[i];
+        ++gen;
+        n[!cur] = 0;
+        for (j = 0; j < n[cur]; ++j) {
+            st = &re->states[lists[cur][j]];
+            switch (st->op) {
+                case OP_CHAR:  step = c == st->arg; break;
+                case OP_ANY:   step = c != '\n' && c != '\r'; break;
+                case OP_CLASS: step = (re->classes[st->arg][c >> 3] >> (c & 7)) & 1; break;
+                default:       step = false; break;
+            }
+            if (step && marks[st->out] != gen)
+                addState(re, st->out, i + 1, len, lists[!cur], &n[!cur], marks, gen, stack);
+        }
+        cur = !cur;
+    }
+
+    for (j = 0; j < n[cur]; ++j)
+        if (re->states[lists[cur][j]].op == OP_MATCH)
+            return true;
+    return false;
+}
@@ -0,0 +1,58 @@
+#ifndef _ZCM_CHANNEL_REGEX_H
+#define _ZCM_CHANNEL_REGEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A regex for matching channel names that needs no heap, for the nonblocking core.
+   Compiled into a Thompson NFA, which is simulated without backtracking, so matching
+   takes time linear in the length of the channel.
+
+   Patterns must match the whole channel, as in the blocking core. The syntax is the
+   subset of ECMAScript regexes that is useful for channel names: literals, '.', '*',
+   '+', '?', '|', groups, bracket expressions with ranges and negation, the \d \w \s
+   escapes and their negations, and '^' and '$'. Counted repetition, backreferences
+   and lookarounds aren't supported and fail to compile. */
+
+/* The most NFA states and bracket expressions a pattern may compile to */
+#ifndef ZCM_REGEX_MAX_STATES
+#define ZCM_REGEX_MAX_STATES 64
+#endif
+
+#ifndef ZCM_REGEX_MAX_CLASSES
+#define ZCM_REGEX_MAX_CLASSES 4
+#endif
+
+typedef struct
+{
+    uint8_t op;
+    uint8_t arg;   /* the character, or the index of the class */
+    uint16_t out;
+    uint16_t out1; /* only used by splits */
+} zcm_regex_state_t;
+
+typedef struct
+{
+    uint16_t nstates;
+    uint16_t start;
+    zcm_regex_state_t states[ZCM_REGEX_MAX_STATES];
+    uint8_t classes[ZCM_REGEX_MAX_CLASSES][32]; /* one bit per character */
+    uint8_t nclasses;
+} zcm_regex_t;
+
+/* Returns true if 'pattern' compiled into 're' */
+bool zcm_regex_compile(zcm_regex_t *re, const char *pattern);
+
+/* Returns true if the first 'len' characters of 'str' match 're' as a whole */
+bool zcm_regex_match(const zcm_regex_t *re, const char *str, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ZCM_CHANNEL_REGEX_H */
@@ -1,11 +1,67 @@
 #include "zcm/zcm_private.h"
 #include "zcm/transport.h"
 #include "zcm/nonblocking.h"
+#include "zcm/channel_regex.h"
 
 #include <string.h>
 
-/* TODO remove malloc for preallocated mem and linked-lists */
+/* How many subscriptions a zcm_nonblocking can hold, all of them preallocated */
+#ifndef ZCM_NONBLOCK_SUBS_MAX
 #define ZCM_NONBLOCK_SUBS_MAX 16
+#endif
+
+/* Slots of the hash table of exact channel subscriptions. Must be a power of two
+   larger than ZCM_NONBLOCK_SUBS_MAX, the default leaves half of them empty */
+#ifndef ZCM_NONBLOCK_SUBS_SLOTS
+#  if ZCM_NONBLOCK_SUBS_MAX <= 8
+#    define ZCM_NONBLOCK_SUBS_SLOTS 16
+#  elif ZCM_NONBLOCK_SUBS_MAX <= 16
+#    define ZCM_NONBLOCK_SUBS_SLOTS 32
+#  elif ZCM_NONBLOCK_SUBS_MAX <= 32
+#    define ZCM_NONBLOCK_SUBS_SLOTS 64
+#  elif ZCM_NONBLOCK_SUBS_MAX <= 64
+#    define ZCM_NONBLOCK_SUBS_SLOTS 128
+#  elif ZCM_NONBLOCK_SUBS_MAX <= 128
+#    define ZCM_NONBLOCK_SUBS_SLOTS 256
+#  elif ZCM_NONBLOCK_SUBS_MAX <= 256
+#    define ZCM_NONBLOCK_SUBS_SLOTS 512
+#  else
+#    error "ZCM_NONBLOCK_SUBS_SLOTS must be set along with such a large ZCM_NONBLOCK_SUBS_MAX"
+#  endif
+#endif
+
+#if (ZCM_NONBLOCK_SUBS_SLOTS & (ZCM_NONBLOCK_SUBS_SLOTS - 1)) != 0 || \
+    ZCM_NONBLOCK_SUBS_SLOTS <= ZCM_NONBLOCK_SUBS_MAX || ZCM_NONBLOCK_SUBS_MAX >= 0xffff
+#error "ZCM_NONBLOCK_SUBS_SLOTS must be a power of two larger than ZCM_NONBLOCK_SUBS_MAX"
+#endif
+
+/* Set to 0 to leave out support for regex subscriptions and their index */
+#ifndef ZCM_NONBLOCK_REGEX_SUBS
+#define ZCM_NONBLOCK_REGEX_SUBS 1
+#endif
+
+/* How many regex subscriptions may be compiled at once, each into a zcm_regex_t.
+   Those of the form "LITERAL.*" only compare their prefix and don't count */
+#ifndef ZCM_NONBLOCK_COMPILED_SUBS_MAX
+#define ZCM_NONBLOCK_COMPILED_SUBS_MAX 4
+#endif
+
+/* How many messages to ask for when the transport implements recvmsg_batch() */
+#ifndef ZCM_NONBLOCK_RECV_BATCH
+#define ZCM_NONBLOCK_RECV_BATCH 8
+#endif
+
+/* A subscription along with what dispatching needs to know of its channel */
+typedef struct
+{
+    zcm_sub_t sub; /* first, so that the zcm_sub_t handed out leads back here */
+    uint32_t hash; /* of the channel, unused for a regex */
+    uint16_t len;  /* of the channel, or of the prefix before ".*" */
+    bool used;
+} nb_sub_t;
+
+/* A subscription's index in 'subs' plus one, 0 for an empty slot */
+typedef uint16_t nb_ref_t;
 
 struct zcm_nonblocking
 {
@@ -14,11 +70,81 @@ struct zcm_nonblocking
 
     bool allChannelsEnabled;
 
-    /* TODO speed this up */
     size_t nsubs;
-    zcm_sub_t subs[ZCM_NONBLOCK_SUBS_MAX];
+    nb_sub_t subs[ZCM_NONBLOCK_SUBS_MAX];
+
+    /* Open addressing with linear probing. Removing a subscription shifts the
+       rest of its cluster back instead of leaving a tombstone, so subscriptions
+       to one channel always follow each other in the order they were made */
+    nb_ref_t slots[ZCM_NONBLOCK_SUBS_SLOTS];
+
+#if ZCM_NONBLOCK_REGEX_SUBS
+    /* The regex subscriptions in the order they were made, which are only
+       matched against messages when there are any */
+    size_t nregex;
+    nb_ref_t regex[ZCM_NONBLOCK_SUBS_MAX];
+#if ZCM_NONBLOCK_COMPILED_SUBS_MAX > 0
+    /* What the 'regexobj' of regex subscriptions other than "LITERAL.*" points at */
+    zcm_regex_t compiled[ZCM_NONBLOCK_COMPILED_SUBS_MAX];
+    bool compiledUsed[ZCM_NONBLOCK_COMPILED_SUBS_MAX];
+#endif
+#endif
 };
 
+#define SLOT_MASK (ZCM_NONBLOCK_SUBS_SLOTS - 1)
+
+/* FNV-1a of a channel, measuring its length along the way */
+static uint32_t hashChannel(const char *c, size_t *clen)
+{
+    uint32_t h = 2166136261u;
+    size_t i;
+    for (i = 0; c[i] != '\0'; ++i) {
+        h ^= (uint8_t)c[i];
+        h *= 16777619u;
+    }
+    *clen = i;
+    return h;
+}
+
+static nb_sub_t *subOf(zcm_nonblocking_t *zcm, nb_ref_t ref)
+{
+    return &zcm->subs[ref - 1];
+}
+
+static bool isChannel(const nb_sub_t *sub, const char *channel, uint32_t hash, size_t clen)
+{
+    return sub->hash == hash && sub->len == clen &&
+           memcmp(sub->sub.channel, channel, clen) == 0;
+}
+
+static void insertSlot(zcm_nonblocking_t *zcm, nb_ref_t ref)
+{
+    size_t s = subOf(zcm, ref)->hash & SLOT_MASK;
+    while (zcm->slots[s] != 0)
+        s = (s + 1) & SLOT_MASK;
+    zcm->slots[s] = ref;
+}
+
+static void removeSlot(zcm_nonblocking_t *zcm, size_t hole)
+{
+    size_t s = hole;
+    size_t home;
+
+    zcm->slots[hole] = 0;
+    while (true) {
+        s = (s + 1) & SLOT_MASK;
+        if (zcm->slots[s] == 0)
+            return;
+        /* Move it back into the hole unless that would put it before its home slot */
+        home = subOf(zcm, zcm->slots[s])->hash & SLOT_MASK;
+        if (((s - home) & SLOT_MASK) >= ((s - hole) & SLOT_MASK)) {
+            zcm->slots[hole] = zcm->slots[s];
+            zcm->slots[s] = 0;
+            hole = s;
+        }
+    }
+}
+
 static bool isRegexChannel(const char* c, size_t clen)
 {
     /* These chars are considered regex */
@@ -30,36 +156,68 @@ static bool isRegexChannel(const char* c, size_t clen)
     return false;
 }
 
-static bool isSupportedRegex(const char* c, size_t clen)
+/* Returns true if 'c' is some literal characters followed by ".*", which
+   is matched by comparing the prefix instead of running a regex */
+static bool isLiteralPrefix(const char* c, size_t clen)
 {
-    /* Currently only support strings formed as such: */
-    /* "[any non-regex character any number of times].*" */
-    if (!isRegexChannel(c, clen)) return true;
+    size_t i;
 
     if (clen < 2) return false;
     if (c[clen - 1] != '*') return false;
     if (c[clen - 2] != '.') return false;
 
-    size_t i;
     for (i = 0; i < clen - 2; ++i)
-        if (!((c[i] >= 'a' && c[i] <= 'z') ||
-              (c[i] >= 'A' && c[i] <= 'Z') ||
-              (c[i] >= '0' && c[i] <= '9') ||
-              (c[i] == '_'))) return false;
+        if (strchr("\\^$.*+?()[]{}|", c[i])) return false;
 
     return true;
 }
 
-zcm_nonblocking_t *zcm_nonblocking_create(zcm_t *z, zcm_trans_t *zt)
+#if ZCM_NONBLOCK_REGEX_SUBS && ZCM_NONBLOCK_COMPILED_SUBS_MAX > 0
+/* Returns the free zcm_regex_t that 'pattern' compiled into, or NULL */
+static zcm_regex_t *compileRegex(zcm_nonblocking_t *zcm, const char *pattern)
 {
-    zcm_nonblocking_t *zcm;
+    size_t i;
+    for (i = 0; i < ZCM_NONBLOCK_COMPILED_SUBS_MAX; ++i) {
+        if (zcm->compiledUsed[i]) continue;
+        return zcm_regex_compile(&zcm->compiled[i], pattern) ? &zcm->compiled[i] : NULL;
+    }
+    return NULL;
+}
+#endif
+
+#ifdef ZCM_STATIC_INSTANCES
+static zcm_nonblocking_t pool[ZCM_STATIC_INSTANCES] ZCM_STATIC_POOL_ATTR;
+static bool poolUsed[ZCM_STATIC_INSTANCES];
+#endif
 
+zcm_nonblocking_t *zcm_nonblocking_create(zcm_t *z, zcm_trans_t *zt)
+{
+    zcm_nonblocking_t *zcm = NULL;
+#ifdef ZCM_STATIC_INSTANCES
+    size_t i;
+    for (i = 0; i < ZCM_STATIC_INSTANCES; ++i) {
+        if (!poolUsed[i]) {
+            poolUsed[i] = true;
+            zcm = &pool[i];
+            break;
+        }
+    }
+#else
     zcm = malloc(sizeof(zcm_nonblocking_t));
+#endif
     if (!zcm) return NULL;
     zcm->z = z;
     zcm->zt = zt;
     zcm->allChannelsEnabled = false;
     zcm->nsubs = 0;
+    memset(zcm->subs, 0, sizeof(zcm->subs));
+    memset(zcm->slots, 0, sizeof(zcm->slots));
+#if ZCM_NONBLOCK_REGEX_SUBS
+    zcm->nregex = 0;
+#if ZCM_NONBLOCK_COMPILED_SUBS_MAX > 0
+    memset(zcm->compiledUsed, 0, sizeof(zcm->compiledUsed));
+#endif
+#endif
     return zcm;
 }
 
@@ -67,7 +225,11 @@ void zcm_nonblocking_destroy(zcm_nonblocking_t *zcm)
 {
     if (zcm) {
         if (zcm->zt) zcm_trans_destroy(zcm->zt);
+#ifdef ZCM_STATIC_INSTANCES
+        poolUsed[zcm - pool] = false;
+#else
         free(zcm);
+#endif
         zcm = NULL;
     }
 }
@@ -88,11 +250,26 @@ zcm_sub_t *zcm_nonblocking_subscribe(zcm_nonblocking_t *zcm, const char *channel
 {
     int rc;
     size_t i;
-
-    size_t clen = strlen(channel);
+    size_t clen;
+    uint32_t hash = hashChannel(channel, &clen);
     bool regex = isRegexChannel(channel, clen);
+    bool prefix = regex && isLiteralPrefix(channel, clen);
+    zcm_regex_t *compiled = NULL;
+    nb_sub_t *sub;
+
+    if (clen > ZCM_CHANNEL_MAXLEN || zcm->nsubs >= ZCM_NONBLOCK_SUBS_MAX) {
+        return NULL;
+    }
+#if ZCM_NONBLOCK_REGEX_SUBS && ZCM_NONBLOCK_COMPILED_SUBS_MAX > 0
+    if (regex && !prefix) {
+        compiled = compileRegex(zcm, channel);
+        if (!compiled) return NULL;
+    }
+#else
+    if (regex && !(ZCM_NONBLOCK_REGEX_SUBS && prefix)) return NULL;
+#endif
+
     if (regex) {
-        if (!isSupportedRegex(channel, clen)) return NULL;
         if (!zcm->allChannelsEnabled) {
             rc = zcm_trans_recvmsg_enable(zcm->zt, NULL, true);
             zcm->allChannelsEnabled = true;
@@ -107,116 +284,183 @@ zcm_sub_t *zcm_nonblocking_subscribe(zcm_nonblocking_t *zcm, const char *channel
         return NULL;
     }
 
-    i = zcm->nsubs;
-    if (i >= ZCM_NONBLOCK_SUBS_MAX) {
-        return NULL;
-    }
-    strncpy(zcm->subs[i].channel, channel,
-            sizeof(zcm->subs[i].channel)/sizeof(zcm->subs[i].channel[0]));
-    zcm->subs[i].callback = cb;
-    zcm->subs[i].usr = usr;
+    for (i = 0; zcm->subs[i].used; ++i);
+    sub = &zcm->subs[i];
+    memcpy(sub->sub.channel, channel, clen + 1);
+    sub->sub.regex = regex;
+    sub->sub.regexobj = compiled;
+    sub->sub.callback = cb;
+    sub->sub.usr = usr;
+    sub->hash = hash;
+    sub->len = prefix ? clen - 2 : clen;
+    sub->used = true;
     zcm->nsubs++;
 
-    return &zcm->subs[i];
+#if ZCM_NONBLOCK_REGEX_SUBS
+    if (regex) {
+#if ZCM_NONBLOCK_COMPILED_SUBS_MAX > 0
+        if (compiled)
+            zcm->compiledUsed[compiled - zcm->compiled] = true;
+#endif
+        zcm->regex[zcm->nregex++] = i + 1;
+        return &sub->sub;
+    }
+#endif
+    insertSlot(zcm, i + 1);
+    return &sub->sub;
 }
 
-int zcm_nonblocking_unsubscribe(zcm_nonblocking_t *zcm, zcm_sub_t *sub)
+int zcm_nonblocking_unsubscribe(zcm_nonblocking_t *zcm, zcm_sub_t *zsub)
 {
+    nb_sub_t *sub = (nb_sub_t*)zsub;
+    nb_ref_t ref;
     size_t i;
-    size_t match_idx = zcm->nsubs;
+    size_t match_idx = 0;
     size_t num_chan_matches = 0;
     int rc = ZCM_EOK;
-    for (i = 0; i < zcm->nsubs; i++) {
-        /* Note: it would be nice if we didn't have to do a string comp to unsubscribe, but
-                 we need to count the number of channel matches so we know when we can disable
-                 the transport's recvvmsg_enable */
-        if (strncmp(sub->channel, zcm->subs[i].channel,
-                    sizeof(zcm->subs[i].channel)/sizeof(zcm->subs[i].channel[0])) == 0) {
-            ++num_chan_matches;
-            if (sub == &zcm->subs[i]) {
+
+    if (sub < zcm->subs || sub >= zcm->subs + ZCM_NONBLOCK_SUBS_MAX || !sub->used) {
+        return ZCM_EINVALID;
+    }
+    ref = (nb_ref_t)(sub - zcm->subs) + 1;
+
+    /* Note: we count the subscriptions to the same channel so we know when
+             we can disable the transport's recvmsg_enable */
+#if ZCM_NONBLOCK_REGEX_SUBS
+    if (sub->sub.regex) {
+        for (i = 0; i < zcm->nregex; ++i) {
+            if (strcmp(subOf(zcm, zcm->regex[i])->sub.channel, sub->sub.channel) == 0)
+                ++num_chan_matches;
+            if (zcm->regex[i] == ref)
                 match_idx = i;
-            }
         }
-    }
-
-    if (match_idx != zcm->nsubs) {
-        if (num_chan_matches <= 1) {
-            rc = zcm_trans_recvmsg_enable(zcm->zt, sub->channel, false);
+        --zcm->nregex;
+        for (i = match_idx; i < zcm->nregex; ++i)
+            zcm->regex[i] = zcm->regex[i + 1];
+#if ZCM_NONBLOCK_COMPILED_SUBS_MAX > 0
+        if (sub->sub.regexobj)
+            zcm->compiledUsed[(zcm_regex_t*)sub->sub.regexobj - zcm->compiled] = false;
+#endif
+    } else
+#endif
+    {
+        for (i = sub->hash & SLOT_MASK; zcm->slots[i] != 0; i = (i + 1) & SLOT_MASK) {
+            if (isChannel(subOf(zcm, zcm->slots[i]), sub->sub.channel, sub->hash, sub->len))
+                ++num_chan_matches;
+            if (zcm->slots[i] == ref)
+                match_idx = i;
         }
+        removeSlot(zcm, match_idx);
+    }
 
-        --zcm->nsubs;
-        if (match_idx < zcm->nsubs) {
-            strncpy(zcm->subs[match_idx].channel, zcm->subs[zcm->nsubs].channel,
-                    sizeof(zcm->subs[i].channel)/sizeof(zcm->subs[i].channel[0]));
-            zcm->subs[match_idx].callback = zcm->subs[zcm->nsubs].callback;
-            zcm->subs[match_idx].usr = zcm->subs[zcm->nsubs].usr;
-        }
-    } else {
-        rc = ZCM_EINVALID;
+    if (num_chan_matches <= 1) {
+        rc = zcm_trans_recvmsg_enable(zcm->zt, sub->sub.channel, false);
     }
 
+    sub->used = false;
+    --zcm->nsubs;
+
     return rc;
 }
 
+/* Calls the subscriptions to the exact channel first, then the regex ones.
+   Like in the blocking core, a regex has to match the whole channel */
 static void dispatch_message(zcm_nonblocking_t *zcm, zcm_msg_t *msg)
 {
     zcm_recv_buf_t rbuf;
-    zcm_sub_t *sub;
-
+    nb_sub_t *sub;
+    size_t clen;
+    uint32_t hash = hashChannel(msg->channel, &clen);
     size_t i;
-    for (i = 0; i < zcm->nsubs; i++) {
-        size_t subsChanLen = strlen(zcm->subs[i].channel);
-        if (isRegexChannel(zcm->subs[i].channel, subsChanLen)) {
-            size_t msgLen = strlen(msg->channel);
-            /* This only works because isSupportedRegex() is called on subscribe */
-            if (msgLen > 2 &&
-                strncmp(zcm->subs[i].channel, msg->channel, subsChanLen - 2) == 0) {
-
-                rbuf.zcm = zcm->z;
-                rbuf.data = (char*)msg->buf;
-                rbuf.data_size = msg->len;
-                rbuf.recv_utime = msg->utime;
-
-                sub = &zcm->subs[i];
-                sub->callback(&rbuf, msg->channel, sub->usr);
-            }
-        } else {
-            if (strcmp(zcm->subs[i].channel, msg->channel) == 0) {
-                rbuf.zcm = zcm->z;
-                rbuf.data = (char*)msg->buf;
-                rbuf.data_size = msg->len;
-                rbuf.recv_utime = msg->utime;
-
-                sub = &zcm->subs[i];
-                sub->callback(&rbuf, msg->channel, sub->usr);
-            }
+
+    rbuf.zcm = zcm->z;
+    rbuf.data = (char*)msg->buf;
+    rbuf.data_size = msg->len;
+    rbuf.recv_utime = msg->utime;
+
+    for (i = hash & SLOT_MASK; zcm->slots[i] != 0; i = (i + 1) & SLOT_MASK) {
+        sub = subOf(zcm, zcm->slots[i]);
+        if (isChannel(sub, msg->channel, hash, clen))
+            sub->sub.callback(&rbuf, msg->channel, sub->sub.usr);
+    }
+
+#if ZCM_NONBLOCK_REGEX_SUBS
+    for (i = 0; i < zcm->nregex; ++i) {
+        sub = subOf(zcm, zcm->regex[i]);
+        if (sub->sub.regexobj ? zcm_regex_match(sub->sub.regexobj, msg->channel, clen)
+                              : clen >= sub->len &&
+                                memcmp(sub->sub.channel, msg->channel, sub->len) == 0) {
+            sub->sub.callback(&rbuf, msg->channel, sub->sub.usr);
         }
     }
+#endif
 }
 
-int zcm_nonblocking_handle_nonblock(zcm_nonblocking_t *zcm)
+/* Receive up to 'max' of the messages the transport has ready, in one batch if it
+   supports it, and dispatch them. 'ndispatched' is set to how many there were */
+static int recv_and_dispatch(zcm_nonblocking_t *zcm, size_t max, size_t *ndispatched)
 {
     int ret;
-    zcm_msg_t msg;
+    zcm_msg_t msgs[ZCM_NONBLOCK_RECV_BATCH];
+    size_t nmsgs = 1;
+    size_t i;
+
+    *ndispatched = 0;
+    if (zcm_trans_can_recv_batch(zcm->zt)) {
+        nmsgs = max < ZCM_NONBLOCK_RECV_BATCH ? max : ZCM_NONBLOCK_RECV_BATCH;
+        ret = zcm_trans_recvmsg_batch(zcm->zt, msgs, &nmsgs, 0);
+    } else {
+        ret = zcm_trans_recvmsg(zcm->zt, &msgs[0], 0);
+    }
+    if (ret != ZCM_EOK)
+        return ret;
+
+    for (i = 0; i < nmsgs; i++)
+        dispatch_message(zcm, &msgs[i]);
+    *ndispatched = nmsgs;
+
+    return ZCM_EOK;
+}
+
+int zcm_nonblocking_handle_nonblock(zcm_nonblocking_t *zcm)
+{
+    size_t n;
 
     /* Perform any required traansport-level updates */
     zcm_trans_update(zcm->zt);
 
     /* Try to receive a messages from the transport and dispatch them */
-    if ((ret = zcm_trans_recvmsg(zcm->zt, &msg, 0)) != ZCM_EOK)
-        return ret;
-    dispatch_message(zcm, &msg);
+    return recv_and_dispatch(zcm, ZCM_NONBLOCK_RECV_BATCH, &n);
+}
 
-    return ZCM_EOK;
+int zcm_nonblocking_handle_nonblock_budget(zcm_nonblocking_t *zcm, uint32_t max_msgs,
+                                           uint64_t max_us,
+                                           uint64_t (*timestamp_now)(void *usr), void *usr)
+{
+    uint32_t total = 0;
+    uint64_t start = timestamp_now ? timestamp_now(usr) : 0;
+    size_t n;
+
+    while (max_msgs == 0 || total < max_msgs) {
+        zcm_trans_update(zcm->zt);
+        if (recv_and_dispatch(zcm, max_msgs == 0 ? ZCM_NONBLOCK_RECV_BATCH : max_msgs - total,
+                              &n) != ZCM_EOK)
+            break;
+        total += n;
+        if (timestamp_now && timestamp_now(usr) - start >= max_us)
+            break;
+    }
+
+    return total;
 }
 
 void zcm_nonblocking_flush(zcm_nonblocking_t* zcm)
 {
+    size_t n;
+
     /* Call twice because we need to make sure publish and subscribe are both handled */
     zcm_trans_update(zcm->zt);
     zcm_trans_update(zcm->zt);
 
-    zcm_msg_t msg;
-    while (zcm_trans_recvmsg(zcm->zt, &msg, 0) == ZCM_EOK)
-        dispatch_message(zcm, &msg);
+    while (recv_and_dispatch(zcm, ZCM_NONBLOCK_RECV_BATCH, &n) == ZCM_EOK);
 }
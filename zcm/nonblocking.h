@@ -21,6 +21,11 @@ int        zcm_nonblocking_unsubscribe(zcm_nonblocking_t *zcm, zcm_sub_t *sub);
 /* Returns 1 if a message was dispatched, and 0 otherwise */
 int zcm_nonblocking_handle_nonblock(zcm_nonblocking_t *zcm);
 
+/* Returns the number of messages dispatched */
+int zcm_nonblocking_handle_nonblock_budget(zcm_nonblocking_t *zcm, uint32_t max_msgs,
+                                           uint64_t max_us,
+                                           uint64_t (*timestamp_now)(void *usr), void *usr);
+
 void zcm_nonblocking_flush(zcm_nonblocking_t *zcm);
 
 #ifdef __cplusplus
@@ -106,6 +106,56 @@
  *      --------------------------------------------------------------------
  *         Close the transport and cleanup any resources used.
  *
+ *      int recvmsg_lend(zcm_trans_t *zt, zcm_msg_t *msg, int timeout)
+ *      --------------------------------------------------------------------
+ *         OPTIONAL: An implementation is allowed to set this field to NULL.
+ *         Identical to recvmsg() except for the lifetime of the returned
+ *         'channel' and 'buf'. Instead of being reused on the next call, they
+ *         are lent to the caller and stay valid until the message is handed
+ *         back with recvmsg_release(). This allows the caller to hold onto a
+ *         received message without copying it. Any number of messages may be
+ *         on loan at once. If this method is set, recvmsg_release() must also
+ *         be set.
+ *
+ *      void recvmsg_release(zcm_trans_t *zt, zcm_msg_t *msg)
+ *      --------------------------------------------------------------------
+ *         OPTIONAL: An implementation is allowed to set this field to NULL.
+ *         Returns a message obtained from recvmsg_lend() to the transport. The
+ *         'msg' must be exactly as it was filled in by recvmsg_lend(). After
+ *         this call the caller may no longer access the message data.
+ *         NOTE: This method should work concurrently and correctly with
+ *         recvmsg() and recvmsg_lend(), as it is typically called from the
+ *         thread that dispatched the message.
+ *
+ *      int recvmsg_batch(zcm_trans_t *zt, zcm_msg_t *msgs, size_t *nmsgs, int timeout)
+ *      --------------------------------------------------------------------
+ *         OPTIONAL: An implementation is allowed to set this field to NULL.
+ *         Receives up to '*nmsgs' messages at once into 'msgs'. Blocks like
+ *         recvmsg() until at least one message is available, then fills in as
+ *         many of the messages that are already waiting as fit, sets '*nmsgs' to
+ *         how many it filled in and returns ZCM_EOK. On timeout it returns
+ *         ZCM_EAGAIN. The messages are lent exactly as by recvmsg_lend() if the
+ *         transport implements it, otherwise they stay valid until the next
+ *         receive call, as with recvmsg().
+ *
+ *      int sendmsg_batch(zcm_trans_t *zt, zcm_msg_t *msgs, size_t *nmsgs)
+ *      --------------------------------------------------------------------
+ *         OPTIONAL: An implementation is allowed to set this field to NULL.
+ *         Sends the '*nmsgs' messages in 'msgs', in order, as if sendmsg() was
+ *         called on each of them, but gives the transport the chance to combine
+ *         them into fewer system calls. Should return ZCM_EOK once all of them
+ *         have been sent. Otherwise it should set '*nmsgs' to how many were sent
+ *         before the first failure and return that failure's error code.
+ *
+ *      void get_stats(zcm_trans_t *zt, zcm_trans_stats_t *stats)
+ *      --------------------------------------------------------------------
+ *         OPTIONAL: An implementation is allowed to set this field to NULL.
+ *         Fills in the transport's own counters, 'stats' is zeroed beforehand
+ *         so counters the transport doesn't keep may be left alone. May be
+ *         called from any thread, concurrently with every other method.
+ *         'senders' has to be allocated with malloc(), zcm_free_stats()
+ *         frees it.
+ *
  *******************************************************************************
  * Non-Blocking Transport API:
  *
@@ -176,6 +226,20 @@
  *      --------------------------------------------------------------------
  *         Close the transport and cleanup any resources used.
  *
+ *      recvmsg_lend() and recvmsg_release() are unused (in this mode) and
+ *      should be set to NULL.
+ *
+ *      int recvmsg_batch(zcm_trans_t *zt, zcm_msg_t *msgs, size_t *nmsgs, int timeout)
+ *      --------------------------------------------------------------------
+ *         OPTIONAL: An implementation is allowed to set this field to NULL.
+ *         Like recvmsg() but fills in up to '*nmsgs' messages and sets '*nmsgs'
+ *         to how many it filled in. This method should *never block*. All of
+ *         the messages stay valid until the next call to recvmsg() or
+ *         recvmsg_batch(), update() must not invalidate them.
+ *
+ *      sendmsg_batch() and get_stats() are unused (in this mode) and should be
+ *      set to NULL.
+ *
  ******************************************************************************/
 
 #ifdef __cplusplus
@@ -184,6 +248,7 @@ extern "C" {
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "zcm/zcm.h"
@@ -223,6 +288,13 @@ struct zcm_trans_methods_t
     int     (*recvmsg)(zcm_trans_t *zt, zcm_msg_t *msg, int timeout);
     int     (*update)(zcm_trans_t *zt);
     void    (*destroy)(zcm_trans_t *zt);
+
+    /* Optional methods: may be left NULL (trailing so existing tables remain valid) */
+    int     (*recvmsg_lend)(zcm_trans_t *zt, zcm_msg_t *msg, int timeout);
+    void    (*recvmsg_release)(zcm_trans_t *zt, zcm_msg_t *msg);
+    int     (*recvmsg_batch)(zcm_trans_t *zt, zcm_msg_t *msgs, size_t *nmsgs, int timeout);
+    int     (*sendmsg_batch)(zcm_trans_t *zt, zcm_msg_t *msgs, size_t *nmsgs);
+    void    (*get_stats)(zcm_trans_t *zt, zcm_trans_stats_t *stats);
 };
 
 /* Helper functions to make the VTbl dispatch cleaner */
@@ -244,6 +316,35 @@ static INLINE int zcm_trans_update(zcm_trans_t *zt)
 static INLINE void zcm_trans_destroy(zcm_trans_t *zt)
 { return zt->vtbl->destroy(zt); }
 
+static INLINE bool zcm_trans_can_lend(zcm_trans_t *zt)
+{ return zt->vtbl->recvmsg_lend != NULL && zt->vtbl->recvmsg_release != NULL; }
+
+static INLINE int zcm_trans_recvmsg_lend(zcm_trans_t *zt, zcm_msg_t *msg, int timeout)
+{ return zt->vtbl->recvmsg_lend(zt, msg, timeout); }
+
+static INLINE void zcm_trans_recvmsg_release(zcm_trans_t *zt, zcm_msg_t *msg)
+{ return zt->vtbl->recvmsg_release(zt, msg); }
+
+static INLINE bool zcm_trans_can_recv_batch(zcm_trans_t *zt)
+{ return zt->vtbl->recvmsg_batch != NULL; }
+
+static INLINE int zcm_trans_recvmsg_batch(zcm_trans_t *zt, zcm_msg_t *msgs, size_t *nmsgs,
+                                          int timeout)
+{ return zt->vtbl->recvmsg_batch(zt, msgs, nmsgs, timeout); }
+
+static INLINE bool zcm_trans_can_send_batch(zcm_trans_t *zt)
+{ return zt->vtbl->sendmsg_batch != NULL; }
+
+static INLINE int zcm_trans_sendmsg_batch(zcm_trans_t *zt, zcm_msg_t *msgs, size_t *nmsgs)
+{ return zt->vtbl->sendmsg_batch(zt, msgs, nmsgs); }
+
+static INLINE void zcm_trans_get_stats(zcm_trans_t *zt, zcm_trans_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (zt->vtbl->get_stats)
+        zt->vtbl->get_stats(zt, stats);
+}
+
 #ifdef __cplusplus
 }
 #endif
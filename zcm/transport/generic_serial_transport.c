@@ -349,8 +349,19 @@ static int _serial_recvmsg(zcm_trans_t *zt, zcm_msg_t *msg, int timeout)
 static int _serial_update(zcm_trans_t *zt)
 { return serial_update(cast(zt)); }
 
+#ifdef ZCM_STATIC_INSTANCES
+static zcm_trans_generic_serial_t pool[ZCM_STATIC_INSTANCES] ZCM_STATIC_POOL_ATTR;
+static bool poolUsed[ZCM_STATIC_INSTANCES];
+#endif
+
 static void _serial_destroy(zcm_trans_t *zt)
-{ free(cast(zt)); }
+{
+#ifdef ZCM_STATIC_INSTANCES
+    poolUsed[cast(zt) - pool] = false;
+#else
+    free(cast(zt));
+#endif
+}
 
 static zcm_trans_methods_t methods = {
     &_serial_get_mtu,
@@ -374,7 +385,19 @@ zcm_trans_t *zcm_trans_generic_serial_create(
         uint64_t (*timestamp_now)(void* usr),
         void* time_usr)
 {
-    zcm_trans_generic_serial_t *zt = malloc(sizeof(zcm_trans_generic_serial_t));
+    zcm_trans_generic_serial_t *zt = NULL;
+#ifdef ZCM_STATIC_INSTANCES
+    size_t i;
+    for (i = 0; i < ZCM_STATIC_INSTANCES; ++i) {
+        if (!poolUsed[i]) {
+            poolUsed[i] = true;
+            zt = &pool[i];
+            break;
+        }
+    }
+#else
+    zt = malloc(sizeof(zcm_trans_generic_serial_t));
+#endif
     if (zt == NULL) return NULL;
 
     zt->trans.trans_type = ZCM_NONBLOCKING;
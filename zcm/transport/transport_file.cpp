@@ -28,6 +28,7 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
 
     string mode = "r";
     double speed = 1.0;
+    bool virtualTime = false; // hand out events as fast as they are asked for
 
     u64 lastMsgUtime = 0;
     u64 lastDispatchUtime = 0;
@@ -58,6 +59,10 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
             }
         }
 
+        string* virtualTimeStr = findOption("virtual_time");
+        if (virtualTimeStr)
+            virtualTime = *virtualTimeStr == "1";
+
         string* modeStr = findOption("mode");
         if (modeStr) {
             mode = string(*modeStr);
@@ -141,6 +146,9 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         msg->len = le->datalen;
         msg->buf = le->data;
 
+        if (virtualTime)
+            return ZCM_EOK;
+
         u64 now = TimeUtil::utime();
 
         if (lastMsgUtime == 0)
@@ -209,4 +217,5 @@ static zcm_trans_t *create(zcm_url_t *url)
 }
 
 const TransportRegister ZCM_TRANS_CLASSNAME::reg(
-    "file", "Interact with zcm log file (e.g. 'file://vehicle.log?speed=2.0)", create);
+    "file", "Interact with zcm log file (e.g. 'file://vehicle.log?speed=2.0' or "
+    "'file://vehicle.log?virtual_time=1' to replay without pacing)", create);
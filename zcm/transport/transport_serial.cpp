@@ -17,6 +17,7 @@
 #include <cstring>
 
 #include <string>
+#include <vector>
 #include <unordered_map>
 #include <mutex>
 using namespace std;
@@ -241,6 +242,9 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     u8 recvChannelMem[33];
     u8 recvDataMem[MTU];
 
+    // Encoded frames waiting to be written, only used by the send thread
+    vector<u8> sendBuf;
+
     string *findOption(const string& s)
     {
         auto it = options.find(s);
@@ -299,71 +303,88 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         return MTU;
     }
 
-    int sendmsg(zcm_msg_t msg)
+    // Append the frame of 'msg' to 'out'
+    int encode(zcm_msg_t msg, vector<u8>& out)
     {
-        string channel = msg.channel;
-        if (channel.size() > ZCM_CHANNEL_MAXLEN)
+        size_t channelLen = strlen(msg.channel);
+        if (channelLen > ZCM_CHANNEL_MAXLEN)
             return ZCM_EINVALID;
         if (msg.len > MTU)
             return ZCM_EINVALID;
 
-        u8 buffer[1024];
-        size_t index = 0;
         u8 sum = 0;  // TODO introduce better checksum
 
         auto writeBytes = [&](const u8 *data, size_t len) {
             for (size_t i = 0; i < len; i++) {
-                // Less than 2 bytes of buffer left? Flush it.
-                if (index >= sizeof(buffer)-1) {
-                    int ret = ser.write(buffer, index);
-                    if (ret == -1) assert(false && "Serial port has been unplugged");
-                    index = 0;
-                }
                 u8 c = data[i];
                 sum += c;
                 // Escape byte?
-                if (c == ESCAPE_CHAR) {
-                    buffer[index++] = ESCAPE_CHAR;
-                    buffer[index++] = c;
-                } else {
-                    buffer[index++] = c;
-                }
-            }
-        };
-
-        auto finish = [&]() {
-            if (index != 0) {
-                int ret = ser.write(buffer, index);
-                if (ret == -1) assert(false && "Serial port has been unplugged");
-                index = 0;
+                if (c == ESCAPE_CHAR)
+                    out.push_back(ESCAPE_CHAR);
+                out.push_back(c);
             }
-            int ret = ser.write(&sum, 1);
-            if (ret == -1) assert(false && "Serial port has been unplugged");
         };
 
         // Sync bytes are Escape and 1 zero
-        buffer[index++] = ESCAPE_CHAR;
-        buffer[index++] = 0;
+        out.push_back(ESCAPE_CHAR);
+        out.push_back(0);
 
         // Length of the channel (1 byte) due to ZCM_CHANNEL_MAXLEN
         // being less than 256
         static_assert(ZCM_CHANNEL_MAXLEN < (1<<8),
                       "Expected channel length to fit in one byte");
-        buffer[index++] = (uint8_t)channel.size();
+        out.push_back((u8)channelLen);
 
         // Length of the data (32-bits): Big Endian
         static_assert(MTU < (1ULL<<32),
                       "Expected data length to fit in 32-bits");
         u32 len = (u32)msg.len;
-        buffer[index++] = (len>>24)&0xff;
-        buffer[index++] = (len>>16)&0xff;
-        buffer[index++] = (len>>8)&0xff;
-        buffer[index++] = (len>>0)&0xff;
+        out.push_back((len>>24)&0xff);
+        out.push_back((len>>16)&0xff);
+        out.push_back((len>>8)&0xff);
+        out.push_back((len>>0)&0xff);
+
+        writeBytes((const u8*)msg.channel, channelLen);
+        writeBytes((const u8*)msg.buf, msg.len);
+        out.push_back(sum);
+
+        return ZCM_EOK;
+    }
+
+    void writeAll(const vector<u8>& buf)
+    {
+        size_t index = 0;
+        while (index < buf.size()) {
+            int ret = ser.write(&buf[index], buf.size() - index);
+            if (ret == -1) assert(false && "Serial port has been unplugged");
+            if (ret <= 0) break;
+            index += ret;
+        }
+    }
 
-        writeBytes((u8*)channel.c_str(), channel.size());
-        writeBytes((u8*)msg.buf, msg.len);
-        finish();
+    int sendmsg(zcm_msg_t msg)
+    {
+        sendBuf.clear();
+        int ret = encode(msg, sendBuf);
+        if (ret != ZCM_EOK)
+            return ret;
+        writeAll(sendBuf);
+        return ZCM_EOK;
+    }
 
+    // Encodes every message and writes them out together
+    int sendmsgBatch(zcm_msg_t *msgs, size_t *nmsgs)
+    {
+        sendBuf.clear();
+        for (size_t i = 0; i < *nmsgs; i++) {
+            int ret = encode(msgs[i], sendBuf);
+            if (ret != ZCM_EOK) {
+                writeAll(sendBuf);
+                *nmsgs = i;
+                return ret;
+            }
+        }
+        writeAll(sendBuf);
         return ZCM_EOK;
     }
 
@@ -546,6 +567,9 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     static int _sendmsg(zcm_trans_t *zt, zcm_msg_t msg)
     { return cast(zt)->sendmsg(msg); }
 
+    static int _sendmsgBatch(zcm_trans_t *zt, zcm_msg_t *msgs, size_t *nmsgs)
+    { return cast(zt)->sendmsgBatch(msgs, nmsgs); }
+
     static int _recvmsgEnable(zcm_trans_t *zt, const char *channel, bool enable)
     { return cast(zt)->recvmsgEnable(channel, enable); }
 
@@ -565,6 +589,10 @@ zcm_trans_methods_t ZCM_TRANS_CLASSNAME::methods = {
     &ZCM_TRANS_CLASSNAME::_recvmsg,
     NULL, // update
     &ZCM_TRANS_CLASSNAME::_destroy,
+    NULL, // recvmsg_lend
+    NULL, // recvmsg_release
+    NULL, // recvmsg_batch
+    &ZCM_TRANS_CLASSNAME::_sendmsgBatch,
 };
 
 static zcm_trans_t *create(zcm_url_t *url)
@@ -51,6 +51,11 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     size_t recvmsgBufferSize = START_BUF_SIZE; // Start at 1MB but allow it to grow to MTU
     char* recvmsgBuffer;
 
+    // The messages returned by the last recvmsgBatch(), valid until the next call
+    vector<zmq_msg_t> batchMsgs;
+    vector<string> batchChannels;
+    size_t batchUsed = 0;
+
     // Mutex used to protect 'subsocks' while allowing
     // recvmsgEnable() and recvmsg() to be called
     // concurrently
@@ -116,6 +121,7 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         }
 
         delete[] recvmsgBuffer;
+        releaseBatch();
     }
 
     string getAddress(const string& channel)
@@ -331,38 +337,41 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         }
     }
 
-    int recvmsg(zcm_msg_t *msg, int timeout)
+    // Build up a list of poll items, one per subscribed socket
+    void buildPollItems(vector<zmq_pollitem_t>& pitems, vector<string>& pchannels)
     {
-        // Build up a list of poll items
-        vector<zmq_pollitem_t> pitems;
-        vector<string> pchannels;
-        {
-            // Mutex used to protect 'subsocks' while allowing
-            // recvmsgEnable() and recvmsg() to be called
-            // concurrently
-            unique_lock<mutex> lk(mut);
-
-            if (recvAllChannels) {
-                switch (type) {
-                    case IPC: ipcScanForNewChannels();
-                    case INPROC: inprocScanForNewChannels();
-                }
-            }
+        // Mutex used to protect 'subsocks' while allowing
+        // recvmsgEnable() and recvmsg() to be called
+        // concurrently
+        unique_lock<mutex> lk(mut);
 
-            pitems.resize(subsocks.size());
-            int i = 0;
-            for (auto& elt : subsocks) {
-                auto& channel = elt.first;
-                auto& sock = elt.second.first;
-                auto *p = &pitems[i];
-                memset(p, 0, sizeof(*p));
-                p->socket = sock;
-                p->events = ZMQ_POLLIN;
-                pchannels.emplace_back(channel);
-                i++;
+        if (recvAllChannels) {
+            switch (type) {
+                case IPC: ipcScanForNewChannels();
+                case INPROC: inprocScanForNewChannels();
             }
         }
 
+        pitems.resize(subsocks.size());
+        int i = 0;
+        for (auto& elt : subsocks) {
+            auto& channel = elt.first;
+            auto& sock = elt.second.first;
+            auto *p = &pitems[i];
+            memset(p, 0, sizeof(*p));
+            p->socket = sock;
+            p->events = ZMQ_POLLIN;
+            pchannels.emplace_back(channel);
+            i++;
+        }
+    }
+
+    int recvmsg(zcm_msg_t *msg, int timeout)
+    {
+        vector<zmq_pollitem_t> pitems;
+        vector<string> pchannels;
+        buildPollItems(pitems, pchannels);
+
         timeout = (timeout >= 0) ? timeout : -1;
         int rc = zmq_poll(pitems.data(), pitems.size(), timeout);
         // TODO: implement better error handling, but can't assert because this triggers during
@@ -411,6 +420,7 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
                     //       and getting interpreted first could shadow a low freq message
                     //       on a resource constrained system, though perhaps that's just
                     //       and indicator that you need to optimize your code or do less.
+                    //       recvmsgBatch() doesn't have this problem.
 
                     return ZCM_EOK;
                 }
@@ -420,6 +430,75 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         return ZCM_EAGAIN;
     }
 
+    void releaseBatch()
+    {
+        for (size_t i = 0; i < batchUsed; i++)
+            zmq_msg_close(&batchMsgs[i]);
+        batchUsed = 0;
+    }
+
+    // Polls once and then reads from every ready socket in turn, one message
+    // per socket per round, until the batch is full or they are all drained.
+    // The messages are received straight into zmq's own buffers.
+    int recvmsgBatch(zcm_msg_t *msgs, size_t *nmsgs, int timeout)
+    {
+        size_t max = *nmsgs;
+        *nmsgs = 0;
+
+        // The previous batch is only valid until now
+        releaseBatch();
+        if (batchMsgs.size() < max) {
+            batchMsgs.resize(max);
+            batchChannels.resize(max);
+        }
+
+        vector<zmq_pollitem_t> pitems;
+        vector<string> pchannels;
+        buildPollItems(pitems, pchannels);
+
+        timeout = (timeout >= 0) ? timeout : -1;
+        int rc = zmq_poll(pitems.data(), pitems.size(), timeout);
+        if (rc == -1) {
+            ZCM_DEBUG("zmq_poll failed with: %s", zmq_strerror(errno));
+            return ZCM_EAGAIN;
+        }
+
+        bool progress = true;
+        while (progress && batchUsed < max) {
+            progress = false;
+            for (size_t i = 0; i < pitems.size() && batchUsed < max; i++) {
+                auto& p = pitems[i];
+                if (p.revents == 0) continue;
+
+                zmq_msg_t *zmsg = &batchMsgs[batchUsed];
+                zmq_msg_init(zmsg);
+                int rc = zmq_msg_recv(zmsg, p.socket, ZMQ_DONTWAIT);
+                if (rc == -1) {
+                    zmq_msg_close(zmsg);
+                    if (errno != EAGAIN)
+                        ZCM_DEBUG("zmq_msg_recv failed with: %s", zmq_strerror(errno));
+                    // Nothing left on this socket for this batch
+                    p.revents = 0;
+                    continue;
+                }
+                assert(rc < MTU && "Received message that is bigger than a legally-published message could be");
+
+                batchChannels[batchUsed] = pchannels[i];
+                zcm_msg_t *msg = &msgs[batchUsed];
+                msg->utime = TimeUtil::utime();
+                msg->channel = batchChannels[batchUsed].c_str();
+                msg->len = zmq_msg_size(zmsg);
+                msg->buf = (char*)zmq_msg_data(zmsg);
+
+                batchUsed++;
+                progress = true;
+            }
+        }
+
+        *nmsgs = batchUsed;
+        return batchUsed > 0 ? ZCM_EOK : ZCM_EAGAIN;
+    }
+
     /********************** STATICS **********************/
     static zcm_trans_methods_t methods;
     static ZCM_TRANS_CLASSNAME *cast(zcm_trans_t *zt)
@@ -440,6 +519,9 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     static int _recvmsg(zcm_trans_t *zt, zcm_msg_t *msg, int timeout)
     { return cast(zt)->recvmsg(msg, timeout); }
 
+    static int _recvmsgBatch(zcm_trans_t *zt, zcm_msg_t *msgs, size_t *nmsgs, int timeout)
+    { return cast(zt)->recvmsgBatch(msgs, nmsgs, timeout); }
+
     static void _destroy(zcm_trans_t *zt)
     { delete cast(zt); }
 
@@ -454,6 +536,9 @@ zcm_trans_methods_t ZCM_TRANS_CLASSNAME::methods = {
     &ZCM_TRANS_CLASSNAME::_recvmsg,
     NULL, // update
     &ZCM_TRANS_CLASSNAME::_destroy,
+    NULL, // recvmsg_lend
+    NULL, // recvmsg_release
+    &ZCM_TRANS_CLASSNAME::_recvmsgBatch,
 };
 
 static zcm_trans_t *createIpc(zcm_url_t *url)
@@ -1,24 +1,15 @@
 #include "buffers.hpp"
 
-static bool sockaddrEqual(struct sockaddr_in *a, struct sockaddr_in *b)
-{
-    return a->sin_addr.s_addr == b->sin_addr.s_addr &&
-           a->sin_port        == b->sin_port &&
-           a->sin_family      == b->sin_family;
-}
-
-bool FragBuf::matchesSockaddr(struct sockaddr_in *addr)
-{
-    return sockaddrEqual(&from, addr);
-}
-
 MessagePool::MessagePool(size_t maxSize, size_t maxBuffers)
     : maxSize(maxSize), maxBuffers(maxBuffers)
 {
+    fragbufs.reserve(maxBuffers + 1);
 }
 
 MessagePool::~MessagePool()
 {
+    while (lruHead)
+        removeFragBuf(lruHead);
 }
 
 Buffer MessagePool::allocBuffer(size_t sz)
@@ -82,69 +73,80 @@ void MessagePool::freeMessage(Message *b)
 }
 
 
-FragBuf *MessagePool::addFragBuf(u32 data_size)
+FragBuf *MessagePool::addFragBuf(const struct sockaddr_in *from, u32 seqno,
+                                 u32 msg_size, u16 fragments_in_msg)
 {
-    FragBuf *fbuf = new (mempool.alloc<FragBuf>()) FragBuf{};
-    fbuf->buf = this->allocBuffer(data_size);
-
-    while (totalSize > maxSize || fragbufs.size() > maxBuffers) {
-        // find and remove the least recently updated fragment buffer
-        int idx = -1;
-        FragBuf *eldest = nullptr;
-        for (size_t i = 0; i < fragbufs.size(); i++) {
-            FragBuf *f = fragbufs[i];
-            if (idx == -1 || f->last_packet_utime < eldest->last_packet_utime) {
-                idx = (int)i;
-                eldest = f;
-            }
-        }
-        if (eldest) {
-            _removeFragBuf((size_t)idx);
-            // XXX Need to free the removed FragBuf*
-        }
-    }
+    FragKey key {senderKey(from), seqno};
+    assert(fragbufs.find(key) == fragbufs.end() && "fragment buffer already exists");
 
-    fragbufs.push_back(fbuf);
-    totalSize += data_size;
+    size_t size = FragBuf::bufferSize(msg_size, fragments_in_msg);
+    FragBuf *fbuf = new (mempool.alloc<FragBuf>()) FragBuf{};
+    fbuf->buf = this->allocBuffer(size);
+    memset(fbuf->buf.data, 0, FragBuf::bitmapSize(fragments_in_msg));
+    fbuf->msg_seqno = seqno;
+    fbuf->msg_size = msg_size;
+    fbuf->fragments_in_msg = fragments_in_msg;
+    fbuf->fragments_remaining = fragments_in_msg;
+    fbuf->from = *from;
+
+    fragbufs.emplace(key, fbuf);
+    _lruPushFront(fbuf);
+    totalSize += size;
 
     return fbuf;
 }
 
-FragBuf *MessagePool::lookupFragBuf(struct sockaddr_in *key)
+FragBuf *MessagePool::overBudgetFragBuf()
 {
-    for (auto& elt : fragbufs)
-        if (elt->matchesSockaddr(key))
-            return elt;
+    if (totalSize > maxSize || fragbufs.size() > maxBuffers)
+        return lruTail;
     return nullptr;
 }
 
-void MessagePool::_removeFragBuf(size_t index)
+FragBuf *MessagePool::lookupFragBuf(const struct sockaddr_in *from, u32 seqno)
 {
-    assert(index < fragbufs.size());
+    auto it = fragbufs.find(FragKey {senderKey(from), seqno});
+    if (it == fragbufs.end())
+        return nullptr;
 
-    // Update the total_size of the fragment buffers
-    FragBuf *fbuf = fragbufs[index];
-    totalSize -= fbuf->buf.size;
+    FragBuf *fbuf = it->second;
+    if (fbuf != lruHead) {
+        _lruUnlink(fbuf);
+        _lruPushFront(fbuf);
+    }
+    return fbuf;
+}
+
+void MessagePool::removeFragBuf(FragBuf *fbuf)
+{
+    size_t erased = fragbufs.erase(FragKey {senderKey(&fbuf->from), fbuf->msg_seqno});
+    assert(erased == 1 && "Tried to remove invalid fragbuf");
+    (void)erased;
 
-    // delete old element, move last element to this slot, and shrink by 1
-    size_t lastIdx = fragbufs.size()-1;
-    fragbufs[index] = fragbufs[lastIdx];
-    fragbufs.pop_back();
+    _lruUnlink(fbuf);
 
+    // Note: a buffer moved into a Message keeps its size, so it is still accounted for
+    totalSize -= fbuf->buf.size;
     this->freeBuffer(fbuf->buf);
     mempool.free(fbuf);
 }
 
-void MessagePool::removeFragBuf(FragBuf *fbuf)
+void MessagePool::_lruUnlink(FragBuf *fbuf)
 {
-    // NOTE: this is kinda slow...
-    // Search for the fragbuf index
-    for (size_t idx = 0; idx < fragbufs.size(); idx++)
-        if (fragbufs[idx] == fbuf)
-            return this->_removeFragBuf(idx);
+    if (fbuf->lruPrev) fbuf->lruPrev->lruNext = fbuf->lruNext;
+    else               lruHead = fbuf->lruNext;
+    if (fbuf->lruNext) fbuf->lruNext->lruPrev = fbuf->lruPrev;
+    else               lruTail = fbuf->lruPrev;
+    fbuf->lruPrev = fbuf->lruNext = nullptr;
+}
 
-    // Did not find
-    assert(0 && "Tried to remove invalid fragbuf");
+void MessagePool::_lruPushFront(FragBuf *fbuf)
+{
+    fbuf->lruPrev = nullptr;
+    fbuf->lruNext = lruHead;
+    if (lruHead) lruHead->lruPrev = fbuf;
+    else         lruTail = fbuf;
+    lruHead = fbuf;
 }
 
 void MessagePool::transferBufffer(Message *to, FragBuf *from)
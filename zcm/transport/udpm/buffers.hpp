@@ -108,6 +108,8 @@ struct Message
     Message() { memset(this, 0, sizeof(*this)); }
 };
 
+struct FragBuf;
+
 struct Packet
 {
     i64             utime;      // timestamp of first datagram receipt
@@ -119,27 +121,100 @@ struct Packet
     // Backing store buffer that contains the actual data
     Buffer          buf;
 
+    // When set, what follows a MsgHeaderLong is received into 'placed' instead
+    // of 'buf', for the packet expected to be fragment 'placedFragNo' of 'placedIn'.
+    // Whatever doesn't fit still goes where it would have in 'buf'
+    char           *placed;
+    size_t          placedLen;
+    FragBuf        *placedIn;
+    u16             placedFragNo;
+
     Packet() { memset(this, 0, sizeof(*this)); }
     MsgHeaderShort *asHeaderShort() { return (MsgHeaderShort*)buf.data; }
     MsgHeaderLong  *asHeaderLong()  { return (MsgHeaderLong* )buf.data; }
 };
 
 /******************** fragment buffer **********************/
+// Identifies a sender by its address and port
+static inline u64 senderKey(const struct sockaddr_in *addr)
+{
+    return ((u64)addr->sin_addr.s_addr << 16) | addr->sin_port;
+}
+
+// Names the sender of 'key' as "ip:port"
+static inline void senderAddress(u64 key, char *buf, size_t len)
+{
+    struct in_addr addr;
+    addr.s_addr = (u32)(key >> 16);
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+    snprintf(buf, len, "%s:%d", ip, ntohs((u16)key));
+}
+
 struct FragBuf
 {
     i64     last_packet_utime;
-    u32     msg_seqno;
-    u16     fragments_remaining;
+    u16     max_fragment_no; // the highest numbered fragment received so far
 
-    // The channel starts at the beginning of the buffer. The data
-    // follows immediately after the channel and its NULL
+    // Only known once fragment 0 arrives. The channel and its NULL end
+    // right where the data starts
     size_t  channellen;
-    struct sockaddr_in from;
+
+    // How the sender cuts its messages, learned from its fragments: the
+    // payload of every fragment but the last, and where fragment 1 starts
+    u32     frag_payload;
+    u32     frag1_offset;
+    bool    frag_layout_bad;
 
     // Fields set by the allocator object
+    u32     msg_seqno;
+    u32     msg_size;
+    u16     fragments_in_msg;
+    u16     fragments_remaining;
+    struct sockaddr_in from;
+
+    // Holds a bit for every fragment received, room for the longest channel, and
+    // then the data, so fragments can be put in place in whatever order they arrive
     Buffer buf;
 
-    bool matchesSockaddr(struct sockaddr_in *addr);
+    // Neighbours in the pool's LRU list, the most recently used first
+    FragBuf *lruPrev;
+    FragBuf *lruNext;
+
+    static size_t bitmapSize(u16 nfrags) { return (nfrags + 7) / 8; }
+    static size_t bufferSize(u32 msg_size, u16 nfrags)
+    { return bitmapSize(nfrags) + ZCM_CHANNEL_MAXLEN + 1 + msg_size; }
+
+    char *getDataPtr() { return buf.data + bitmapSize(fragments_in_msg) + ZCM_CHANNEL_MAXLEN + 1; }
+    char *getChannelPtr() { return getDataPtr() - (channellen + 1); }
+
+    bool isReceived(u16 no) { return ((u8*)buf.data)[no / 8] & (1 << (no % 8)); }
+
+    // Returns false if fragment 'no' was already received
+    bool markReceived(u16 no)
+    {
+        u8 *bits = (u8*)buf.data;
+        u8 mask = 1 << (no % 8);
+        if (bits[no / 8] & mask)
+            return false;
+        bits[no / 8] |= mask;
+        return true;
+    }
+};
+
+// Fragment buffers are keyed by the sender and sequence number of their message
+struct FragKey
+{
+    u64 sender;
+    u32 seqno;
+
+    bool operator==(const FragKey& o) const { return sender == o.sender && seqno == o.seqno; }
+};
+
+struct FragKeyHash
+{
+    size_t operator()(const FragKey& k) const
+    { return std::hash<u64>()(k.sender ^ ((u64)k.seqno << 48) ^ ((u64)k.seqno >> 16)); }
 };
 
 /************** A pool to handle every alloc/dealloc operation on Message objects ******/
@@ -162,20 +237,29 @@ struct MessagePool
     void freeMessage(Message *b);
 
     // FragBuf
-    FragBuf *addFragBuf(u32 data_size);
-    FragBuf *lookupFragBuf(struct sockaddr_in *key);
+    FragBuf *addFragBuf(const struct sockaddr_in *from, u32 seqno,
+                        u32 msg_size, u16 fragments_in_msg);
+    // Finding a buffer marks it as the most recently used
+    FragBuf *lookupFragBuf(const struct sockaddr_in *from, u32 seqno);
     void removeFragBuf(FragBuf *fbuf);
+    // Returns the least recently used buffer while over budget, for the caller
+    // to remove before adding another one
+    FragBuf *overBudgetFragBuf();
+    FragBuf *mostRecentFragBuf() { return lruHead; }
 
     void transferBufffer(Message *to, FragBuf *from);
     void moveBuffer(Buffer& to, Buffer& from);
 
   private:
     void _freeMessageBuffer(Message *b);
-    void _removeFragBuf(size_t index);
+    void _lruUnlink(FragBuf *fbuf);
+    void _lruPushFront(FragBuf *fbuf);
 
   private:
     MemPool mempool;
-    vector<FragBuf*> fragbufs;
+    unordered_map<FragKey, FragBuf*, FragKeyHash> fragbufs;
+    FragBuf *lruHead = nullptr;
+    FragBuf *lruTail = nullptr;
     size_t maxSize;
     size_t maxBuffers;
     size_t totalSize = 0;
@@ -9,12 +9,11 @@
 
 #define MTU (1<<28)
 
-static i32 utimeInSeconds()
-{
-    struct timeval tv;
-    gettimeofday (&tv, NULL);
-    return (i32)tv.tv_sec;
-}
+// How far back a sender's sequence numbers may jump before we assume it restarted
+#define SEQNO_RESTART_GAP 1024
+
+// How many of a sender's latest messages may be reassembled at once, up to 64
+#define REASSEMBLY_WINDOW 8
 
 /**
  * udpm_params_t:
@@ -62,12 +61,37 @@ struct UDPM
 
     MessagePool pool {MAX_FRAG_BUF_TOTAL_SIZE, MAX_NUM_FRAG_BUFS};
 
-    /* other variables */
-    u32          udp_rx = 0;            // packets received and processed
-    u32          udp_discarded_bad = 0; // packets discarded because they were bad
-                                    // somehow
-    double       udp_low_watermark = 1.0; // least buffer available
-    i32          udp_last_report_secs = 0;
+    /* statistics, only written by the recv thread but read by getStats() */
+    atomic<u64>  udp_rx {0};            // packets received
+    atomic<u64>  udp_discarded_bad {0}; // packets discarded because they were bad
+                                        // somehow
+    atomic<u64>  msgs_lost {0};         // messages of other senders we never got whole
+    atomic<u64>  frags_placed {0};      // fragments received right into their place
+    atomic<u64>  frags_misplaced {0};   // fragments placed where they didn't belong
+
+    // What we know of each sender, keyed by address and port
+    struct Sender
+    {
+        u32 lastSeqno;  // the newest message seen
+        // Bit i is for message 'lastSeqno - i', set in 'seen' once any of its
+        // packets arrived and in 'inFlight' while its fragments are reassembled
+        u64 seen;
+        u64 inFlight;
+
+        // Only written by the recv thread but read by getStats()
+        atomic<u64> msgsLost {0};        // skipped or never completed
+        atomic<u64> fragsReordered {0};  // fragments that came after a higher numbered one
+        atomic<u64> fragsDuplicated {0}; // fragments received again
+
+        // The bit of 'seqno' in the masks, 0 once it is too old to be tracked
+        u64 bit(u32 seqno) const
+        {
+            u32 age = lastSeqno - seqno;
+            return age < 64 ? (u64)1 << age : 0;
+        }
+    };
+    unordered_map<u64, Sender> senders;
+    mutex sendersLock; // Held to add senders, and by getStats() to go through them
 
     u32          msg_seqno = 0; // rolling counter of how many messages transmitted
 
@@ -79,18 +103,59 @@ struct UDPM
     int handle();
 
     int sendmsg(zcm_msg_t msg);
+    int sendmsgBatch(zcm_msg_t *msgs, size_t *nmsgs);
     int recvmsg(zcm_msg_t *msg, int timeout);
+    int recvmsgLend(zcm_msg_t *msg, int timeout);
+    void recvmsgRelease(zcm_msg_t *msg);
+
+    void getStats(zcm_trans_stats_t *stats);
 
   private:
+    // Scratch space of sendmsgBatch() and sendFragments(), only touched by the send thread
+    vector<MsgHeaderShort> batchHdrs;
+    vector<MsgHeaderLong> fragHdrs;
+    vector<struct iovec> batchIovs;
+    size_t sendShortBatch(zcm_msg_t *msgs, size_t n);
+    size_t sendFragments(const zcm_msg_t& msg, int channel_size, int nfragments);
+
     // These returns non-null when a full message has been received
     Message *recvShort(Packet *pkt, u32 sz);
     Message *recvFragment(Packet *pkt, u32 sz);
+    Message *handlePacket(Packet *pkt);
     Message *readMessage(int timeout);
 
     Message *m = nullptr;
 
+    // Packets are received in batches into this ring, and handled one at a time
+    // from 'rxNext' until 'rxCount'. Only touched by the recv thread
+    Packet *rxPkts[ZCM_RECV_BATCH_SIZE] = {};
+    size_t rxNext = 0;
+    size_t rxCount = 0;
+
+    // Set when most fragments placed in the last batch were not the expected ones,
+    // so the next batch is received without placing any
+    bool placementMissed = false;
+    // Set once a fragment is handled, and cleared when the next batch is received.
+    // Only then is the next packet peeked at to see if it starts a message
+    bool fragmentsSeen = false;
+    void placeFragments();
+    bool checkPlacement(size_t npkts);
+    bool nextStartsFragments();
+
+    // Messages on loan to the zcm core, keyed by their data pointer.
+    // Released messages are parked in 'returned' until the recv thread
+    // gives them back to the pool, as the pool is not thread-safe.
+    mutex lentLock;
+    unordered_map<const char*, Message*> lentMessages;
+    vector<Message*> returned;
+    void reclaimReturned();
+
     bool selftest();
-    void checkForMessageLoss();
+    Sender& noteSeqno(const struct sockaddr *from, u32 seqno, bool *firstSeen);
+    void dropFragBuf(FragBuf *fbuf, Sender& sender);
+    void learnFragmentLayout(FragBuf *fbuf, u16 fragment_no, u32 fragment_offset,
+                             u32 frag_size, u32 payload);
+    void dropInFlight(const struct sockaddr_in *from, Sender& sender, u64 bits);
 };
 
 Message *UDPM::recvShort(Packet *pkt, u32 sz)
@@ -104,7 +169,8 @@ Message *UDPM::recvShort(Packet *pkt, u32 sz)
         return NULL;
     }
 
-    udp_rx++;
+    bool firstSeen;
+    noteSeqno(&pkt->from, hdr->getMsgSeqno(), &firstSeen);
 
     Message *msg = pool.allocMessageEmpty();
     msg->utime = pkt->utime;
@@ -121,64 +187,100 @@ Message *UDPM::recvFragment(Packet *pkt, u32 sz)
 {
     MsgHeaderLong *hdr = pkt->asHeaderLong();
 
-    // any existing fragment buffer for this message source?
-    FragBuf *fbuf = pool.lookupFragBuf((struct sockaddr_in*)&pkt->from);
-
     u32 msg_seqno = hdr->getMsgSeqno();
     u32 data_size = hdr->getMsgSize();
     u32 fragment_offset = hdr->getFragmentOffset();
     u16 fragment_no = hdr->getFragmentNo();
     u16 fragments_in_msg = hdr->getFragmentsInMsg();
     u32 frag_size = hdr->getFragmentSize(sz);
-    char *data_start = hdr->getDataPtr();
+    char *data_start = pkt->placed ? pkt->placed : hdr->getDataPtr();
+    const struct sockaddr_in *from = (const struct sockaddr_in*)&pkt->from;
+
+    bool firstSeen;
+    Sender& sender = noteSeqno(&pkt->from, msg_seqno, &firstSeen);
+
+    FragBuf *fbuf = NULL;
+    if (firstSeen) {
+        if (sender.lastSeqno - msg_seqno >= REASSEMBLY_WINDOW) {
+            ZCM_DEBUG("Dropping message (too far behind to reassemble)");
+            sender.msgsLost++;
+            msgs_lost++;
+            return NULL;
+        }
+        // Any fragment can start the message, they all know its size
+        if (data_size > MTU || fragments_in_msg == 0) {
+            ZCM_DEBUG("rejecting message (%u bytes in %u fragments)", data_size, fragments_in_msg);
+            udp_discarded_bad++;
+            sender.msgsLost++;
+            msgs_lost++;
+            return NULL;
+        }
+        while (FragBuf *old = pool.overBudgetFragBuf()) {
+            ZCM_DEBUG("Dropping message (out of room, missing %d fragments)",
+                      old->fragments_remaining);
+            dropFragBuf(old, senders.at(senderKey(&old->from)));
+        }
+        fbuf = pool.addFragBuf(from, msg_seqno, data_size, fragments_in_msg);
+        fbuf->max_fragment_no = fragment_no;
+        sender.inFlight |= sender.bit(msg_seqno);
+    } else {
+        // Otherwise the message is either in flight, or done with
+        fbuf = pool.lookupFragBuf(from, msg_seqno);
+        if (!fbuf)
+            return NULL;
+    }
+    recvfd.checkAndWarnAboutSmallBuffer(data_size, kernel_rbuf_sz);
 
-    // discard any stale fragments from previous messages
-    if (fbuf && ((fbuf->msg_seqno != msg_seqno) ||
-                 (fbuf->buf.size != data_size + fbuf->channellen+1))) {
-        pool.removeFragBuf(fbuf);
-        ZCM_DEBUG("Dropping message (missing %d fragments)", fbuf->fragments_remaining);
-        fbuf = NULL;
+    if (fbuf->msg_size != data_size || fbuf->fragments_in_msg != fragments_in_msg ||
+        fragment_no >= fragments_in_msg) {
+        ZCM_DEBUG("Dropping message (fragments disagree on its size)");
+        udp_discarded_bad++;
+        dropFragBuf(fbuf, sender);
+        return NULL;
     }
 
-    if (data_size > MTU) {
-        ZCM_DEBUG("rejecting huge message (%d bytes)", data_size);
+    // Note: only possible if the buffer it was placed in went away and came back
+    if (pkt->placed && pkt->placedIn != fbuf)
+        return NULL;
+
+    if (!fbuf->markReceived(fragment_no)) {
+        sender.fragsDuplicated++;
         return NULL;
     }
 
-    // create a new fragment buffer if necessary
-    if (!fbuf && fragment_no == 0) {
-        char *channel = (char*) (hdr + 1);
-        int channel_sz = strlen(channel);
-        if (channel_sz > ZCM_CHANNEL_MAXLEN) {
+    if (fragment_no < fbuf->max_fragment_no)
+        sender.fragsReordered++;
+    else
+        fbuf->max_fragment_no = fragment_no;
+
+    // first fragment is special.  the channel comes before its data
+    if (fragment_no == 0) {
+        size_t clen = strnlen(data_start, std::min((size_t)frag_size, (size_t)ZCM_CHANNEL_MAXLEN + 1));
+        if (clen > ZCM_CHANNEL_MAXLEN || clen == frag_size) {
             ZCM_DEBUG("bad channel name length");
             udp_discarded_bad++;
+            dropFragBuf(fbuf, sender);
             return NULL;
         }
-
-        fbuf = pool.addFragBuf(channel_sz + 1 + data_size);
-        fbuf->last_packet_utime = pkt->utime;
-        fbuf->msg_seqno = msg_seqno;
-        fbuf->fragments_remaining = fragments_in_msg;
-        fbuf->channellen = channel_sz;
-        fbuf->from = *(struct sockaddr_in*)&pkt->from;
-        memcpy(fbuf->buf.data, data_start, frag_size);
-
-        --fbuf->fragments_remaining;
-        return NULL;
+        fbuf->channellen = clen;
+        memcpy(fbuf->getChannelPtr(), data_start, clen + 1);
+        data_start += clen + 1;
+        frag_size -= clen + 1;
     }
+    learnFragmentLayout(fbuf, fragment_no, fragment_offset, frag_size, hdr->getFragmentSize(sz));
 
-    if (!fbuf) return NULL;
-    recvfd.checkAndWarnAboutSmallBuffer(data_size, kernel_rbuf_sz);
-
-    if (fbuf->channellen+1 + fragment_offset + frag_size > fbuf->buf.size) {
-        ZCM_DEBUG("dropping invalid fragment (off: %d, %d / %zu)",
-                fragment_offset, frag_size, fbuf->buf.size);
-        pool.removeFragBuf(fbuf);
+    if ((u64)fragment_offset + frag_size > fbuf->msg_size) {
+        ZCM_DEBUG("dropping invalid fragment (off: %u, %u / %u)",
+                  fragment_offset, frag_size, fbuf->msg_size);
+        udp_discarded_bad++;
+        dropFragBuf(fbuf, sender);
         return NULL;
     }
 
-    // copy data
-    memcpy(fbuf->buf.data + fbuf->channellen+1 + fragment_offset, data_start, frag_size);
+    // copy data, unless it was received in place
+    char *dest = fbuf->getDataPtr() + fragment_offset;
+    if (dest != data_start)
+        memcpy(dest, data_start, frag_size);
 
     fbuf->last_packet_utime = pkt->utime;
     if (--fbuf->fragments_remaining > 0)
@@ -187,89 +289,271 @@ Message *UDPM::recvFragment(Packet *pkt, u32 sz)
     // we've received all the fragments, return a new Message
     Message *msg = pool.allocMessageEmpty();
     msg->utime = fbuf->last_packet_utime;
-    msg->channel = fbuf->buf.data;
+    msg->channel = fbuf->getChannelPtr();
     msg->channellen = fbuf->channellen;
-    msg->data = fbuf->buf.data + fbuf->channellen + 1;
-    msg->datalen = fbuf->buf.size - (fbuf->channellen + 1);
+    msg->data = fbuf->getDataPtr();
+    msg->datalen = fbuf->msg_size;
     pool.moveBuffer(msg->buf, fbuf->buf);
 
     // don't need the fragment buffer anymore
+    sender.inFlight &= ~sender.bit(msg_seqno);
     pool.removeFragBuf(fbuf);
 
     return msg;
 }
 
-void UDPM::checkForMessageLoss()
+// Learns where the sender puts fragment 1 and how much every fragment but the
+// last carries, so later fragments can be received in place
+void UDPM::learnFragmentLayout(FragBuf *fbuf, u16 fragment_no, u32 fragment_offset,
+                               u32 frag_size, u32 payload)
 {
-    // ISSUE-101 TODO: add this back
-    // TODO warn about message loss somewhere else.
-    // u32 ring_capacity = ringbuf->get_capacity();
-    // u32 ring_used = ringbuf->get_used();
-
-    // double buf_avail = ((double)(ring_capacity - ring_used)) / ring_capacity;
-    // if (buf_avail < udp_low_watermark)
-    //     udp_low_watermark = buf_avail;
-
-    // i32 tm = utimeInSeconds();
-    // int elapsedsecs = tm - udp_last_report_secs;
-    // if (elapsedsecs > 2) {
-    //    if (udp_discarded_bad > 0 || udp_low_watermark < 0.5) {
-    //        fprintf(stderr,
-    //                "%d ZCM loss %4.1f%% : %5d err, "
-    //                "buf avail %4.1f%%\n",
-    //                (int) tm,
-    //                udp_discarded_bad * 100.0 / (udp_rx + udp_discarded_bad),
-    //                udp_discarded_bad,
-    //                100.0 * udp_low_watermark);
-
-    //        udp_rx = 0;
-    //        udp_discarded_bad = 0;
-    //        udp_last_report_secs = tm;
-    //        udp_low_watermark = HUGE;
-    //    }
-    // }
+    bool last = fragment_no == fbuf->fragments_in_msg - 1;
+    if (fbuf->frag_payload == 0) {
+        if (fbuf->frag_layout_bad || last)
+            return;
+        fbuf->frag_payload = payload;
+        fbuf->frag1_offset = fragment_no == 0 ? frag_size
+                                              : fragment_offset - (fragment_no - 1) * payload;
+        return;
+    }
+
+    // Senders that don't cut their messages evenly don't get fragments placed
+    bool even = fragment_no == 0 ? frag_size == fbuf->frag1_offset :
+                fragment_offset == fbuf->frag1_offset + (fragment_no - 1) * fbuf->frag_payload &&
+                (last || payload == fbuf->frag_payload);
+    if (!even) {
+        fbuf->frag_payload = 0;
+        fbuf->frag_layout_bad = true;
+    }
 }
 
-// read continuously until a complete message arrives
-Message *UDPM::readMessage(int timeout)
+// Gives up on reassembling the message of 'fbuf'
+void UDPM::dropFragBuf(FragBuf *fbuf, Sender& sender)
+{
+    sender.inFlight &= ~sender.bit(fbuf->msg_seqno);
+    sender.msgsLost++;
+    msgs_lost++;
+    pool.removeFragBuf(fbuf);
+}
+
+// Drops the messages of 'sender' still in flight among 'bits'
+void UDPM::dropInFlight(const struct sockaddr_in *from, Sender& sender, u64 bits)
 {
-    Packet *pkt = pool.allocPacket(ZCM_MAX_UNFRAGMENTED_PACKET_SIZE);
-    UDPM::checkForMessageLoss();
+    bits &= sender.inFlight;
+    while (bits) {
+        int age = __builtin_ctzll(bits);
+        bits &= bits - 1;
+        FragBuf *fbuf = pool.lookupFragBuf(from, sender.lastSeqno - age);
+        assert(fbuf);
+        if (!fbuf) continue;
+        ZCM_DEBUG("Dropping message (missing %d fragments)", fbuf->fragments_remaining);
+        dropFragBuf(fbuf, sender);
+    }
+}
 
-    Message *msg = NULL;
-    while (!msg) {
-        // // wait for either incoming UDP data, or for an abort message
-        if (!recvfd.waitUntilData(timeout))
-            break;
+// Account for a packet of message 'seqno' from 'from'. Messages skipped since the
+// last one from that sender count as lost, unless they turn up within the next 64.
+// Messages still in flight once REASSEMBLY_WINDOW newer ones have started are
+// given up on.
+// Sets 'firstSeen' if this is the first packet seen of that message.
+UDPM::Sender& UDPM::noteSeqno(const struct sockaddr *from, u32 seqno, bool *firstSeen)
+{
+    const struct sockaddr_in *in = (const struct sockaddr_in*)from;
+    u64 key = senderKey(in);
+
+    auto it = senders.find(key);
+    if (it == senders.end()) {
+        // Note: anything older it sent before we joined is not lost to us
+        unique_lock<mutex> lk(sendersLock);
+        Sender& s = senders[key];
+        lk.unlock();
+        s.lastSeqno = seqno;
+        s.seen = ~(u64)0;
+        s.inFlight = 0;
+        *firstSeen = true;
+        return s;
+    }
+    Sender& s = it->second;
+
+    // Note: a sender that jumps far back has most likely restarted
+    i32 diff = (i32)(seqno - s.lastSeqno);
+    if (diff < -SEQNO_RESTART_GAP) {
+        dropInFlight(in, s, ~(u64)0);
+        s.lastSeqno = seqno;
+        s.seen = ~(u64)0;
+        s.inFlight = 0;
+        *firstSeen = true;
+        return s;
+    }
 
-        int sz = recvfd.recvPacket(pkt);
-        if (sz < 0) {
-            ZCM_DEBUG("udp_read_packet -- recvmsg");
-            udp_discarded_bad++;
-            continue;
+    if (diff <= 0) {
+        // Reordered behind a newer message
+        u64 bit = s.bit(seqno);
+        *firstSeen = bit && !(s.seen & bit);
+        if (*firstSeen) {
+            // It was counted as lost when skipped
+            s.seen |= bit;
+            s.msgsLost--;
+            msgs_lost--;
         }
+        return s;
+    }
 
-        ZCM_DEBUG("Got packet of size %d", sz);
+    // Whatever leaves the window is never completing
+    dropInFlight(in, s, diff >= REASSEMBLY_WINDOW ? ~(u64)0 :
+                                                  ~(u64)0 << (REASSEMBLY_WINDOW - diff));
+
+    s.msgsLost += diff - 1;
+    msgs_lost += diff - 1;
+    s.lastSeqno = seqno;
+    s.seen = diff >= 64 ? 1 : (s.seen << diff) | 1;
+    s.inFlight = diff >= 64 ? 0 : s.inFlight << diff;
+    *firstSeen = true;
+    return s;
+}
 
-        if (sz < (int)sizeof(MsgHeaderShort)) {
-            // packet too short to be ZCM
-            udp_discarded_bad++;
+Message *UDPM::handlePacket(Packet *pkt)
+{
+    int sz = pkt->sz;
+    ZCM_DEBUG("Got packet of size %d", sz);
+
+    if (sz < (int)sizeof(MsgHeaderShort)) {
+        // packet too short to be ZCM
+        udp_discarded_bad++;
+        return NULL;
+    }
+
+    u32 magic = pkt->asHeaderShort()->getMagic();
+    if (magic == ZCM_MAGIC_SHORT)
+        return recvShort(pkt, sz);
+    if (magic == ZCM_MAGIC_LONG) {
+        fragmentsSeen = true;
+        return recvFragment(pkt, sz);
+    }
+
+    ZCM_DEBUG("ZCM: bad magic");
+    udp_discarded_bad++;
+    return NULL;
+}
+
+// Sets the ring up to receive the next fragments of the message that was
+// updated last right into their place in its buffer
+void UDPM::placeFragments()
+{
+    for (Packet *pkt : rxPkts)
+        pkt->placed = NULL;
+
+    FragBuf *fbuf = pool.mostRecentFragBuf();
+    if (placementMissed || !fbuf || !fbuf->frag_payload)
+        return;
+
+    size_t i = 0;
+    for (u32 no = fbuf->max_fragment_no + 1;
+         no < fbuf->fragments_in_msg && i < ZCM_RECV_BATCH_SIZE; no++) {
+        if (fbuf->isReceived(no))
+            continue;
+        u64 offset = fbuf->frag1_offset + (u64)(no - 1) * fbuf->frag_payload;
+        if (offset >= fbuf->msg_size)
+            break;
+
+        Packet *pkt = rxPkts[i++];
+        pkt->placed = fbuf->getDataPtr() + offset;
+        pkt->placedLen = std::min((u64)fbuf->frag_payload, fbuf->msg_size - offset);
+        pkt->placedIn = fbuf;
+        pkt->placedFragNo = no;
+    }
+}
+
+// Keeps the placed packets that turned out to be the fragments expected, and
+// puts the others back together in their own buffer, before any is handled.
+// Returns true if most of them were not the ones expected
+bool UDPM::checkPlacement(size_t npkts)
+{
+    size_t hits = 0, misses = 0;
+    for (size_t i = 0; i < npkts; i++) {
+        Packet *pkt = rxPkts[i];
+        if (!pkt->placed)
+            continue;
+
+        FragBuf *fbuf = pkt->placedIn;
+        MsgHeaderLong *hdr = pkt->asHeaderLong();
+        size_t hdrlen = sizeof(MsgHeaderLong);
+        bool hit = pkt->sz == hdrlen + pkt->placedLen &&
+                   hdr->getMagic() == ZCM_MAGIC_LONG &&
+                   senderKey((struct sockaddr_in*)&pkt->from) == senderKey(&fbuf->from) &&
+                   hdr->getMsgSeqno() == fbuf->msg_seqno &&
+                   hdr->getMsgSize() == fbuf->msg_size &&
+                   hdr->getFragmentsInMsg() == fbuf->fragments_in_msg &&
+                   hdr->getFragmentNo() == pkt->placedFragNo &&
+                   fbuf->getDataPtr() + hdr->getFragmentOffset() == pkt->placed;
+        if (hit) {
+            hits++;
             continue;
         }
 
-        u32 magic = pkt->asHeaderShort()->getMagic();
-        if (magic == ZCM_MAGIC_SHORT)
-            msg = recvShort(pkt, sz);
-        else if (magic == ZCM_MAGIC_LONG)
-            msg = recvFragment(pkt, sz);
-        else {
-            ZCM_DEBUG("ZCM: bad magic");
-            udp_discarded_bad++;
+        misses++;
+        size_t len = pkt->sz > hdrlen ? std::min(pkt->sz - hdrlen, pkt->placedLen) : 0;
+        memcpy(pkt->buf.data + hdrlen, pkt->placed, len);
+        pkt->placed = NULL;
+    }
+    for (size_t i = npkts; i < ZCM_RECV_BATCH_SIZE; i++)
+        rxPkts[i]->placed = NULL;
+
+    frags_placed += hits;
+    frags_misplaced += misses;
+    return misses > hits;
+}
+
+// Returns true if the next packet is the first fragment of a message
+bool UDPM::nextStartsFragments()
+{
+    MsgHeaderLong hdr;
+    if (recvfd.peekPacket((char*)&hdr, sizeof(hdr)) != (int)sizeof(hdr))
+        return false;
+    return hdr.getMagic() == ZCM_MAGIC_LONG && hdr.getFragmentNo() == 0 &&
+           hdr.getFragmentsInMsg() > 1;
+}
+
+// read continuously until a complete message arrives
+Message *UDPM::readMessage(int timeout)
+{
+    Message *msg = NULL;
+    while (!msg) {
+        if (rxNext == rxCount) {
+            // // wait for either incoming UDP data, or for an abort message
+            if (!recvfd.waitUntilData(timeout))
+                break;
+
+            // A message starting gets its first fragment alone, so the rest
+            // of it can be placed. Without fragments coming in lately, it is
+            // not worth a syscall per batch to look for one
+            placeFragments();
+            size_t batch = ZCM_RECV_BATCH_SIZE;
+            if (fragmentsSeen && !rxPkts[0]->placed && nextStartsFragments())
+                batch = 1;
+            fragmentsSeen = false;
+
+            int n = recvfd.recvPackets(rxPkts, batch);
+            if (n < 0) {
+                ZCM_DEBUG("udp_read_packet -- recvmmsg");
+                udp_discarded_bad++;
+                continue;
+            }
+            placementMissed = checkPlacement(n);
+            rxNext = 0;
+            rxCount = n;
+            udp_rx += n;
             continue;
         }
+
+        Packet *pkt = rxPkts[rxNext++];
+        msg = handlePacket(pkt);
+
+        // Short messages take the packet's buffer with them
+        if (!pkt->buf.data)
+            pkt->buf = pool.allocBuffer(ZCM_MAX_UNFRAGMENTED_PACKET_SIZE);
     }
 
-    pool.freePacket(pkt);
     return msg;
 }
 
@@ -321,51 +605,112 @@ int UDPM::sendmsg(zcm_msg_t msg)
         ZCM_DEBUG("transmitting %d byte [%s] payload in %d fragments",
                   payload_size, msg.channel, nfragments);
 
-        u32 fragment_offset = 0;
+        size_t sent = sendFragments(msg, channel_size, nfragments);
+        if (sent < (size_t)nfragments)
+            ZCM_DEBUG("only sent %zu of %d fragments", sent, nfragments);
+
+        msg_seqno++;
+    }
+
+    return 0;
+}
 
-        MsgHeaderLong hdr;
+// Sends all 'nfragments' fragments of 'msg' together, returns how many were sent
+size_t UDPM::sendFragments(const zcm_msg_t& msg, int channel_size, int nfragments)
+{
+    fragHdrs.resize(nfragments);
+    batchIovs.resize(nfragments * 3);
+
+    u32 fragment_offset = 0;
+    for (int frag_no = 0; frag_no < nfragments; frag_no++) {
+        MsgHeaderLong& hdr = fragHdrs[frag_no];
         hdr.magic = htonl(ZCM_MAGIC_LONG);
         hdr.msg_seqno = htonl(msg_seqno);
         hdr.msg_size = htonl(msg.len);
-        hdr.fragment_offset = 0;
-        hdr.fragment_no = 0;
+        hdr.fragment_offset = htonl(fragment_offset);
+        hdr.fragment_no = htons(frag_no);
         hdr.fragments_in_msg = htons(nfragments);
 
         // first fragment is special.  insert channel before data
-        size_t firstfrag_datasize = fragment_size - (channel_size + 1);
-        assert(firstfrag_datasize <= msg.len);
+        size_t chanlen = frag_no == 0 ? channel_size + 1 : 0;
+        size_t fraglen = std::min((size_t)ZCM_FRAGMENT_MAX_PAYLOAD - chanlen,
+                                  msg.len - fragment_offset);
+
+        struct iovec *iv = &batchIovs[frag_no * 3];
+        iv[0].iov_base = (char*)&hdr;
+        iv[0].iov_len = sizeof(hdr);
+        iv[1].iov_base = (char*)msg.channel;
+        iv[1].iov_len = chanlen;
+        iv[2].iov_base = msg.buf + fragment_offset;
+        iv[2].iov_len = fraglen;
+
+        fragment_offset += fraglen;
+    }
+    assert(fragment_offset == msg.len);
 
-        int packet_size = sizeof(hdr) + (channel_size + 1) + firstfrag_datasize;
-        fragment_offset += firstfrag_datasize;
+    return sendfd.sendPackets(destAddr, batchIovs.data(), 3, nfragments);
+}
 
-        ssize_t status = sendfd.sendBuffers(destAddr,
-                                            (char*)&hdr, sizeof(hdr),
-                                            (char*)msg.channel, channel_size+1,
-                                            msg.buf, firstfrag_datasize);
-
-        // transmit the rest of the fragments
-        for (u16 frag_no = 1; packet_size == status && frag_no < nfragments; frag_no++) {
-            hdr.fragment_offset = htonl(fragment_offset);
-            hdr.fragment_no = htons(frag_no);
-
-            int fraglen = std::min(fragment_size, (int)msg.len - (int)fragment_offset);
-            status = sendfd.sendBuffers(destAddr,
-                                        (char*)&hdr, sizeof(hdr),
-                                        (char*)(msg.buf + fragment_offset), fraglen);
-
-            fragment_offset += fraglen;
-            packet_size = sizeof(hdr) + fraglen;
-        }
+static bool isShortMessage(const zcm_msg_t& msg)
+{
+    size_t channel_size = strlen(msg.channel);
+    return channel_size <= ZCM_CHANNEL_MAXLEN &&
+           channel_size + 1 + msg.len <= ZCM_SHORT_MESSAGE_MAX_SIZE;
+}
 
-        // sanity check
-        if (0 == status) {
-            assert(fragment_offset == msg.len);
+// Sends 'n' short messages, returns how many were sent
+size_t UDPM::sendShortBatch(zcm_msg_t *msgs, size_t n)
+{
+    batchHdrs.resize(n);
+    batchIovs.resize(n * 3);
+    for (size_t i = 0; i < n; i++) {
+        batchHdrs[i].setMagic(ZCM_MAGIC_SHORT);
+        batchHdrs[i].setMsgSeqno(msg_seqno + i);
+
+        struct iovec *iv = &batchIovs[i * 3];
+        iv[0].iov_base = (char*)&batchHdrs[i];
+        iv[0].iov_len = sizeof(MsgHeaderShort);
+        iv[1].iov_base = (char*)msgs[i].channel;
+        iv[1].iov_len = strlen(msgs[i].channel) + 1;
+        iv[2].iov_base = msgs[i].buf;
+        iv[2].iov_len = msgs[i].len;
+
+        ZCM_DEBUG("transmitting %zu byte [%s] payload (batched)", msgs[i].len, msgs[i].channel);
+    }
+
+    size_t sent = sendfd.sendPackets(destAddr, batchIovs.data(), 3, n);
+    msg_seqno += sent;
+    return sent;
+}
+
+int UDPM::sendmsgBatch(zcm_msg_t *msgs, size_t *nmsgs)
+{
+    size_t n = *nmsgs;
+    size_t sent = 0;
+    while (sent < n) {
+        // Runs of short messages go out together, anything else through sendmsg()
+        size_t nshort = 0;
+        while (sent + nshort < n && isShortMessage(msgs[sent + nshort]))
+            nshort++;
+
+        if (nshort == 0) {
+            int ret = sendmsg(msgs[sent]);
+            if (ret != ZCM_EOK) {
+                *nmsgs = sent;
+                return ret == ZCM_EINVALID ? ZCM_EINVALID : ZCM_EUNKNOWN;
+            }
+            sent++;
+            continue;
         }
 
-        msg_seqno++;
+        size_t ret = sendShortBatch(&msgs[sent], nshort);
+        sent += ret;
+        if (ret < nshort) {
+            *nmsgs = sent;
+            return ZCM_EUNKNOWN;
+        }
     }
-
-    return 0;
+    return ZCM_EOK;
 }
 
 int UDPM::recvmsg(zcm_msg_t *msg, int timeout)
@@ -385,9 +730,94 @@ int UDPM::recvmsg(zcm_msg_t *msg, int timeout)
     return ZCM_EOK;
 }
 
+void UDPM::reclaimReturned()
+{
+    unique_lock<mutex> lk(lentLock);
+    for (Message *r : returned)
+        pool.freeMessage(r);
+    returned.clear();
+}
+
+int UDPM::recvmsgLend(zcm_msg_t *msg, int timeout)
+{
+    reclaimReturned();
+
+    Message *lent = readMessage(timeout);
+    if (lent == nullptr)
+        return ZCM_EAGAIN;
+
+    {
+        unique_lock<mutex> lk(lentLock);
+        lentMessages[lent->data] = lent;
+    }
+
+    msg->utime = lent->utime;
+    msg->channel = lent->channel;
+    msg->len = lent->datalen;
+    msg->buf = lent->data;
+
+    return ZCM_EOK;
+}
+
+void UDPM::recvmsgRelease(zcm_msg_t *msg)
+{
+    unique_lock<mutex> lk(lentLock);
+    auto it = lentMessages.find(msg->buf);
+    assert(it != lentMessages.end() && "releasing a message that was never lent");
+    if (it == lentMessages.end())
+        return;
+    returned.push_back(it->second);
+    lentMessages.erase(it);
+}
+
+void UDPM::getStats(zcm_trans_stats_t *stats)
+{
+    stats->packets_received = udp_rx;
+    stats->packets_discarded = udp_discarded_bad;
+    stats->messages_lost = msgs_lost;
+    stats->fragments_placed = frags_placed;
+    stats->fragments_misplaced = frags_misplaced;
+
+    unique_lock<mutex> lk(sendersLock);
+    if (senders.empty())
+        return;
+    stats->senders = (zcm_sender_stats_t*)malloc(senders.size() * sizeof(zcm_sender_stats_t));
+    if (!stats->senders)
+        return;
+    for (auto& it : senders) {
+        const Sender& s = it.second;
+        zcm_sender_stats_t *out = &stats->senders[stats->nsenders++];
+        senderAddress(it.first, out->address, sizeof(out->address));
+        out->messages_lost = s.msgsLost;
+        out->fragments_reordered = s.fragsReordered;
+        out->fragments_duplicated = s.fragsDuplicated;
+    }
+}
+
 UDPM::~UDPM()
 {
     ZCM_DEBUG("closing zcm context");
+
+    if (!lentMessages.empty())
+        ZCM_DEBUG("%zu messages still on loan at shutdown", lentMessages.size());
+    for (auto& it : lentMessages)
+        pool.freeMessage(it.second);
+    reclaimReturned();
+
+    for (auto& it : senders) {
+        const Sender& s = it.second;
+        if (!s.msgsLost && !s.fragsReordered && !s.fragsDuplicated)
+            continue;
+        char address[ZCM_ADDRESS_MAXLEN+1];
+        senderAddress(it.first, address, sizeof(address));
+        ZCM_DEBUG("sender %s lost %llu messages, reordered %llu and duplicated %llu fragments",
+                  address, (unsigned long long)s.msgsLost,
+                  (unsigned long long)s.fragsReordered, (unsigned long long)s.fragsDuplicated);
+    }
+
+    for (Packet *pkt : rxPkts)
+        if (pkt)
+            pool.freePacket(pkt);
 }
 
 UDPM::UDPM(const string& ip, u16 port, size_t recv_buf_size, u8 ttl)
@@ -410,6 +840,9 @@ bool UDPM::init()
     if (!recvfd.isOpen()) return false;
     kernel_rbuf_sz = recvfd.getRecvBufSize();
 
+    for (Packet*& pkt : rxPkts)
+        pkt = pool.allocPacket(ZCM_MAX_UNFRAGMENTED_PACKET_SIZE);
+
     if (!this->selftest()) {
         // self test failed.  destroy the read thread
         fprintf(stderr, "ZCM self test failed!!\n"
@@ -459,6 +892,9 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     static int _sendmsg(zcm_trans_t *zt, zcm_msg_t msg)
     { return cast(zt)->udpm.sendmsg(msg); }
 
+    static int _sendmsgBatch(zcm_trans_t *zt, zcm_msg_t *msgs, size_t *nmsgs)
+    { return cast(zt)->udpm.sendmsgBatch(msgs, nmsgs); }
+
     static int _recvmsgEnable(zcm_trans_t *zt, const char *channel, bool enable)
     { return ZCM_EOK; }
 
@@ -468,6 +904,15 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     static void _destroy(zcm_trans_t *zt)
     { delete cast(zt); }
 
+    static int _recvmsgLend(zcm_trans_t *zt, zcm_msg_t *msg, int timeout)
+    { return cast(zt)->udpm.recvmsgLend(msg, timeout); }
+
+    static void _recvmsgRelease(zcm_trans_t *zt, zcm_msg_t *msg)
+    { cast(zt)->udpm.recvmsgRelease(msg); }
+
+    static void _getStats(zcm_trans_t *zt, zcm_trans_stats_t *stats)
+    { cast(zt)->udpm.getStats(stats); }
+
     static const TransportRegister regUdpm;
 };
 
@@ -478,6 +923,11 @@ zcm_trans_methods_t ZCM_TRANS_CLASSNAME::methods = {
     &ZCM_TRANS_CLASSNAME::_recvmsg,
     NULL, // update
     &ZCM_TRANS_CLASSNAME::_destroy,
+    &ZCM_TRANS_CLASSNAME::_recvmsgLend,
+    &ZCM_TRANS_CLASSNAME::_recvmsgRelease,
+    NULL, // recvmsg_batch
+    &ZCM_TRANS_CLASSNAME::_sendmsgBatch,
+    &ZCM_TRANS_CLASSNAME::_getStats,
 };
 
 static const char *optFind(zcm_url_opts_t *opts, const string& key)
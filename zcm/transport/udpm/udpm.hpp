@@ -17,6 +17,7 @@
 #include <condition_variable>
 
 // Headers for C++ library
+#include <atomic>
 #include <algorithm>
 #include <vector>
 #include <stack>
@@ -99,6 +100,7 @@ typedef int64_t  i64;
 #define ZCM_RINGBUF_SIZE (200*1024)
 #define ZCM_DEFAULT_RECV_BUFS 2000
 #define ZCM_MAX_UNFRAGMENTED_PACKET_SIZE 65536
+#define ZCM_RECV_BATCH_SIZE 32 // packets taken off the socket per syscall
 
 #define MAX_FRAG_BUF_TOTAL_SIZE (1 << 24)// 16 megabytes
 #define MAX_NUM_FRAG_BUFS 1000
@@ -231,37 +231,55 @@ bool UDPMSocket::waitUntilData(int timeout)
     }
 }
 
-int UDPMSocket::recvPacket(Packet *pkt)
-{
-    struct iovec vec;
-    vec.iov_base = pkt->buf.data;
-    vec.iov_len = pkt->buf.size;
+// Room for the SO_TIMESTAMP control message of one packet
+#define PACKET_CONTROL_SIZE 64
 
-    struct msghdr msg;
-    memset(&msg, 0, sizeof(struct msghdr));
-    msg.msg_name = &pkt->from;
-    msg.msg_namelen = sizeof(struct sockaddr);
-    msg.msg_iov = &vec;
-    msg.msg_iovlen = 1;
+// Prepares 'msg' to receive into 'pkt', with up to 3 'vecs' for its data
+// and 'controlbuf' for its timestamp
+static void preparePacketHeader(struct msghdr *msg, struct iovec *vecs,
+                                Packet *pkt, char *controlbuf)
+{
+    memset(msg, 0, sizeof(struct msghdr));
+    msg->msg_name = &pkt->from;
+    msg->msg_namelen = sizeof(struct sockaddr);
+    msg->msg_iov = vecs;
+
+    if (pkt->placed) {
+        size_t hdrlen = sizeof(MsgHeaderLong);
+        assert(hdrlen + pkt->placedLen <= pkt->buf.size);
+        vecs[0].iov_base = pkt->buf.data;
+        vecs[0].iov_len = hdrlen;
+        vecs[1].iov_base = pkt->placed;
+        vecs[1].iov_len = pkt->placedLen;
+        vecs[2].iov_base = pkt->buf.data + hdrlen + pkt->placedLen;
+        vecs[2].iov_len = pkt->buf.size - hdrlen - pkt->placedLen;
+        msg->msg_iovlen = 3;
+    } else {
+        vecs[0].iov_base = pkt->buf.data;
+        vecs[0].iov_len = pkt->buf.size;
+        msg->msg_iovlen = 1;
+    }
 
 #ifdef MSG_EXT_HDR
     // operating systems that provide SO_TIMESTAMP allow us to obtain more
     // accurate timestamps by having the kernel produce timestamps as soon
     // as packets are received.
-    char controlbuf[64];
-    msg.msg_control = controlbuf;
-    msg.msg_controllen = sizeof(controlbuf);
-    msg.msg_flags = 0;
+    msg->msg_control = controlbuf;
+    msg->msg_controllen = PACKET_CONTROL_SIZE;
+    msg->msg_flags = 0;
 #endif
+}
 
-    int ret = ::recvmsg(fd, &msg, 0);
-    pkt->fromlen = msg.msg_namelen;
+// Fills in who sent 'pkt' and when, once 'msg' has been received into it
+static void finishPacket(struct msghdr *msg, Packet *pkt)
+{
+    pkt->fromlen = msg->msg_namelen;
 
     bool got_utime = false;
 #ifdef SO_TIMESTAMP
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
     /* Get the receive timestamp out of the packet headers if possible */
-    while (!pkt->utime && cmsg) {
+    while (cmsg) {
         if (cmsg->cmsg_level == SOL_SOCKET &&
             cmsg->cmsg_type == SCM_TIMESTAMP) {
             struct timeval *t = (struct timeval*) CMSG_DATA (cmsg);
@@ -269,7 +287,7 @@ int UDPMSocket::recvPacket(Packet *pkt)
             got_utime = true;
             break;
         }
-        cmsg = CMSG_NXTHDR(&msg, cmsg);
+        cmsg = CMSG_NXTHDR(msg, cmsg);
     }
 #endif
 
@@ -278,8 +296,59 @@ int UDPMSocket::recvPacket(Packet *pkt)
         gettimeofday(&tv, NULL);
         pkt->utime = (i64)tv.tv_sec * 1000000 + tv.tv_usec;
     }
+}
+
+int UDPMSocket::recvPacket(Packet *pkt)
+{
+    struct iovec vecs[3];
+    struct msghdr msg;
+    char controlbuf[PACKET_CONTROL_SIZE];
+    preparePacketHeader(&msg, vecs, pkt, controlbuf);
+
+    int ret = ::recvmsg(fd, &msg, 0);
+    finishPacket(&msg, pkt);
+    pkt->sz = ret < 0 ? 0 : ret;
+
+    return ret;
+}
+
+int UDPMSocket::recvPackets(Packet **pkts, size_t npkts)
+{
+#ifdef __linux__
+    static const size_t CHUNK = 64;
+    struct mmsghdr mhdrs[CHUNK];
+    struct iovec vecs[CHUNK][3];
+    char controlbufs[CHUNK][PACKET_CONTROL_SIZE];
+
+    size_t n = std::min(npkts, CHUNK);
+    for (size_t i = 0; i < n; i++) {
+        preparePacketHeader(&mhdrs[i].msg_hdr, vecs[i], pkts[i], controlbufs[i]);
+        mhdrs[i].msg_len = 0;
+    }
 
+    // Note: Only takes what is already queued, waitUntilData() does the waiting
+    int ret;
+    do {
+        ret = ::recvmmsg(fd, mhdrs, n, MSG_DONTWAIT, NULL);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+    for (int i = 0; i < ret; i++) {
+        finishPacket(&mhdrs[i].msg_hdr, pkts[i]);
+        pkts[i]->sz = mhdrs[i].msg_len;
+    }
     return ret;
+#else
+    if (npkts == 0)
+        return 0;
+    return recvPacket(pkts[0]) < 0 ? -1 : 1;
+#endif
+}
+
+int UDPMSocket::peekPacket(char *buf, size_t len)
+{
+    return ::recv(fd, buf, len, MSG_PEEK);
 }
 
 ssize_t UDPMSocket::sendBuffers(const UDPMAddress& dest, const char *a, size_t alen)
@@ -344,6 +413,54 @@ ssize_t UDPMSocket::sendBuffers(const UDPMAddress& dest, const char *a, size_t a
     return::sendmsg(fd, &mhdr, 0);
 }
 
+size_t UDPMSocket::sendPackets(const UDPMAddress& dest, struct iovec *iovs,
+                               size_t niov, size_t npkts)
+{
+    static const size_t CHUNK = 64;
+    size_t sent = 0;
+    while (sent < npkts) {
+#ifdef __linux__
+        if (haveSendmmsg) {
+            struct mmsghdr mhdrs[CHUNK];
+            size_t n = std::min(npkts - sent, CHUNK);
+            for (size_t i = 0; i < n; i++) {
+                struct msghdr& mhdr = mhdrs[i].msg_hdr;
+                mhdr.msg_name = dest.getAddrPtr();
+                mhdr.msg_namelen = dest.getAddrSize();
+                mhdr.msg_iov = &iovs[(sent + i) * niov];
+                mhdr.msg_iovlen = niov;
+                mhdr.msg_control = NULL;
+                mhdr.msg_controllen = 0;
+                mhdr.msg_flags = 0;
+                mhdrs[i].msg_len = 0;
+            }
+            int ret = ::sendmmsg(fd, mhdrs, n, 0);
+            if (ret < 0 && errno == EINTR) continue;
+            if (ret < 0 && errno == ENOSYS) {
+                // Kernels older than 3.0 only have sendmsg()
+                ZCM_DEBUG("sendmmsg() is not supported, falling back to sendmsg()");
+                haveSendmmsg = false;
+                continue;
+            }
+            if (ret <= 0) break;
+            sent += ret;
+            continue;
+        }
+#endif
+        struct msghdr mhdr;
+        mhdr.msg_name = dest.getAddrPtr();
+        mhdr.msg_namelen = dest.getAddrSize();
+        mhdr.msg_iov = &iovs[sent * niov];
+        mhdr.msg_iovlen = niov;
+        mhdr.msg_control = NULL;
+        mhdr.msg_controllen = 0;
+        mhdr.msg_flags = 0;
+        if (::sendmsg(fd, &mhdr, 0) < 0) break;
+        sent++;
+    }
+    return sent;
+}
+
 bool UDPMSocket::checkConnection(const string& ip, u16 port)
 {
     UDPMAddress addr{ip, port};
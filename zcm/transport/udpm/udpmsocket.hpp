@@ -52,12 +52,26 @@ class UDPMSocket
     bool waitUntilData(int timeout);
     int recvPacket(Packet *pkt);
 
+    // Receives up to 'npkts' of the packets already queued on the socket into
+    // 'pkts', with as few syscalls as the platform allows, setting their 'sz'.
+    // Returns how many were received, or -1 on error
+    int recvPackets(Packet **pkts, size_t npkts);
+
+    // Copies the start of the next packet into 'buf' without receiving it.
+    // Returns how much was copied, or -1 on error
+    int peekPacket(char *buf, size_t len);
+
     ssize_t sendBuffers(const UDPMAddress& dest, const char *a, size_t alen);
     ssize_t sendBuffers(const UDPMAddress& dest, const char *a, size_t alen,
                             const char *b, size_t blen);
     ssize_t sendBuffers(const UDPMAddress& dest, const char *a, size_t alen,
                         const char *b, size_t blen, const char *c, size_t clen);
 
+    // Sends 'npkts' datagrams, the i-th one made of the 'niov' buffers starting at
+    // iovs[i*niov], with as few syscalls as the platform allows.
+    // Returns how many were sent, which is less than 'npkts' only on error
+    size_t sendPackets(const UDPMAddress& dest, struct iovec *iovs, size_t niov, size_t npkts);
+
     static bool checkConnection(const string& ip, u16 port);
     void checkAndWarnAboutSmallBuffer(size_t datalen, size_t kbufsize);
 
@@ -67,6 +81,7 @@ class UDPMSocket
   private:
     SOCKET fd = -1;
     bool warnedAboutSmallBuffer = false;
+    bool haveSendmmsg = true;
 
   private:
     // Disallow copies
@@ -75,6 +90,15 @@ class UDPMSocket
 
   public:
     // Allow moves
-    UDPMSocket(UDPMSocket&& other) { std::swap(this->fd, other.fd); }
-    UDPMSocket& operator=(UDPMSocket&& other) { std::swap(this->fd, other.fd); return *this; }
+    UDPMSocket(UDPMSocket&& other)
+    {
+        std::swap(this->fd, other.fd);
+        std::swap(this->haveSendmmsg, other.haveSendmmsg);
+    }
+    UDPMSocket& operator=(UDPMSocket&& other)
+    {
+        std::swap(this->fd, other.fd);
+        std::swap(this->haveSendmmsg, other.haveSendmmsg);
+        return *this;
+    }
 };
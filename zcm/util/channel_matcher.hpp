@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <regex>
+#include <algorithm>
+#include <utility>
+
+// Finds the wildcard subscriptions that a channel name matches.
+//
+// Patterns of the form "LITERAL.*" (including a bare ".*") are the common case
+// and are stored in a trie keyed by their literal prefix, so looking up a channel
+// only walks as many nodes as the channel has characters. Every other pattern is
+// compiled into a std::regex and tried one after the other.
+//
+// Matching is still meant to be done once per distinct channel name: callers
+// are expected to cache the result of match() until they add or remove a pattern.
+//
+// Copying a matcher is the way to modify a snapshot that other threads are still
+// reading. Not thread safe otherwise, callers must serialize all calls.
+template<class Sub>
+class ChannelMatcher
+{
+    struct Entry
+    {
+        Sub sub;
+        uint64_t order; // subscription order, match() reports in this order
+        std::string pattern;
+        std::string prefix;
+        std::unique_ptr<std::regex> re; // nullptr when in the trie
+    };
+
+    struct Node
+    {
+        std::vector<std::pair<char, std::unique_ptr<Node>>> children;
+        std::vector<Entry*> entries; // patterns whose literal prefix ends here
+
+        Node *child(char c) const
+        {
+            for (auto& ch : children)
+                if (ch.first == c) return ch.second.get();
+            return nullptr;
+        }
+
+        bool empty() const { return children.empty() && entries.empty(); }
+    };
+
+    std::vector<std::unique_ptr<Entry>> entries;
+    std::vector<Entry*> general;
+    Node root;
+    uint64_t nextOrder = 0;
+
+    // Returns true if 'pattern' is some literal characters followed by ".*"
+    static bool literalPrefix(const std::string& pattern, std::string& prefix)
+    {
+        size_t len = pattern.size();
+        if (len < 2 || pattern[len - 2] != '.' || pattern[len - 1] != '*')
+            return false;
+        static const char *special = "\\^$.*+?()[]{}|";
+        for (size_t i = 0; i < len - 2; i++)
+            if (strchr(special, pattern[i])) return false;
+        prefix = pattern.substr(0, len - 2);
+        return true;
+    }
+
+    // Remove 'e' from the node of 'prefix' and prune the nodes left empty
+    static bool trieRemove(Node& n, const std::string& prefix, size_t depth, Entry *e)
+    {
+        if (depth == prefix.size()) {
+            auto it = std::find(n.entries.begin(), n.entries.end(), e);
+            if (it == n.entries.end()) return false;
+            n.entries.erase(it);
+            return true;
+        }
+        for (size_t i = 0; i < n.children.size(); i++) {
+            if (n.children[i].first != prefix[depth]) continue;
+            Node *c = n.children[i].second.get();
+            if (!trieRemove(*c, prefix, depth + 1, e)) return false;
+            if (c->empty()) n.children.erase(n.children.begin() + i);
+            return true;
+        }
+        return false;
+    }
+
+    // Compiles 'pattern' unless it is already compiled in 're'
+    void insert(Sub sub, const std::string& pattern, uint64_t order, const std::regex *re)
+    {
+        std::unique_ptr<Entry> e {new Entry()};
+        e->sub = sub;
+        e->order = order;
+        e->pattern = pattern;
+
+        if (literalPrefix(pattern, e->prefix)) {
+            Node *n = &root;
+            for (char c : e->prefix) {
+                Node *next = n->child(c);
+                if (!next) {
+                    next = new Node();
+                    n->children.emplace_back(c, std::unique_ptr<Node>(next));
+                }
+                n = next;
+            }
+            n->entries.push_back(e.get());
+        } else {
+            e->re.reset(re ? new std::regex(*re) : new std::regex(pattern));
+            general.push_back(e.get());
+        }
+
+        entries.push_back(std::move(e));
+    }
+
+  public:
+    ChannelMatcher() {}
+
+    ChannelMatcher(const ChannelMatcher& other) : nextOrder(other.nextOrder)
+    {
+        for (auto& e : other.entries)
+            insert(e->sub, e->pattern, e->order, e->re.get());
+    }
+
+    ChannelMatcher& operator=(const ChannelMatcher& other) = delete;
+
+    // Add a subscription for 'pattern'
+    // Throws std::regex_error if 'pattern' is not a valid regex
+    void add(Sub sub, const std::string& pattern)
+    {
+        insert(sub, pattern, nextOrder, nullptr);
+        nextOrder++;
+    }
+
+    // Remove a subscription previously added with add()
+    // Returns true if it was found
+    bool remove(Sub sub)
+    {
+        for (size_t i = 0; i < entries.size(); i++) {
+            Entry *e = entries[i].get();
+            if (e->sub != sub) continue;
+
+            if (e->re)
+                general.erase(std::find(general.begin(), general.end(), e));
+            else
+                trieRemove(root, e->prefix, 0, e);
+
+            entries.erase(entries.begin() + i);
+            return true;
+        }
+        return false;
+    }
+
+    // Append the subscriptions matching 'channel' to 'out', in the order they were added
+    void match(const std::string& channel, std::vector<Sub>& out) const
+    {
+        std::vector<const Entry*> found;
+
+        const Node *n = &root;
+        for (size_t i = 0; n; i++) {
+            found.insert(found.end(), n->entries.begin(), n->entries.end());
+            if (i == channel.size()) break;
+            n = n->child(channel[i]);
+        }
+
+        for (const Entry *e : general)
+            if (std::regex_match(channel, *e->re))
+                found.push_back(e);
+
+        std::sort(found.begin(), found.end(),
+                  [](const Entry *a, const Entry *b) { return a->order < b->order; });
+        for (const Entry *e : found)
+            out.push_back(e->sub);
+    }
+
+    // Returns every subscription, in the order they were added
+    std::vector<Sub> getAll() const
+    {
+        std::vector<Sub> ret;
+        for (auto& e : entries)
+            ret.push_back(e->sub);
+        return ret;
+    }
+
+    size_t size() const
+    {
+        return entries.size();
+    }
+};
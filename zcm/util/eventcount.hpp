@@ -0,0 +1,77 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+// A simple eventcount: lets lock-free data structures put threads to sleep
+// without making the other side pay for a lock or a syscall on every operation.
+// notify() is a fence and a load unless somebody is actually waiting.
+//
+// Waiters must follow this pattern to avoid lost wakeups:
+//
+//     while (!ready()) {
+//         uint32_t key = ec.prepareWait();
+//         if (ready()) { ec.cancelWait(); break; }
+//         ec.wait(key);
+//     }
+//
+// Notifiers must publish whatever makes ready() true *before* calling notify()
+class EventCount
+{
+    // Low 32 bits count the registered waiters, high 32 bits are the epoch
+    std::atomic<uint64_t> state {0};
+
+    std::mutex mut;
+    std::condition_variable cond;
+
+    static constexpr uint64_t WAITER_MASK = 0xffffffff;
+    static constexpr uint64_t EPOCH_INC = (uint64_t)1 << 32;
+
+  public:
+    EventCount() {}
+    ~EventCount() {}
+
+    // Register as a waiter and return the current epoch
+    uint32_t prepareWait()
+    {
+        uint64_t prev = state.fetch_add(1, std::memory_order_seq_cst);
+        return (uint32_t)(prev >> 32);
+    }
+
+    // Abandon a prepareWait() because the condition became true
+    void cancelWait()
+    {
+        state.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    // Sleep until the epoch moves past the one returned by prepareWait()
+    void wait(uint32_t key)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        cond.wait(lk, [&](){
+            return (uint32_t)(state.load(std::memory_order_relaxed) >> 32) != key;
+        });
+        state.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Wake up every thread currently blocked in wait()
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if ((state.load(std::memory_order_relaxed) & WAITER_MASK) == 0)
+            return;
+        {
+            std::unique_lock<std::mutex> lk(mut);
+            state.fetch_add(EPOCH_INC, std::memory_order_relaxed);
+        }
+        cond.notify_all();
+    }
+
+  private:
+    EventCount(const EventCount& other) = delete;
+    EventCount(EventCount&& other) = delete;
+    EventCount& operator=(const EventCount& other) = delete;
+    EventCount& operator=(EventCount&& other) = delete;
+};
@@ -0,0 +1,271 @@
+#pragma once
+
+#include "zcm/util/eventcount.hpp"
+
+#include <utility>
+#include <cstring>
+#include <cassert>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <type_traits>
+
+// A lock-free bounded C++ queue designed for efficiency.
+// No unneeded copies or initializations. push() must only ever be called from
+// one thread at a time. Elements are moved out by pop(), which is safe to call
+// concurrently, so the producer may also pop to evict the oldest element of a
+// full queue while the regular consumer keeps draining it.
+//
+// Every slot carries a sequence number telling whether it is ready to be written
+// or to be read at a given position, so producer and consumer never touch the
+// same cache line unless the queue is nearly full or nearly empty.
+//
+// Blocked threads first spin, then yield, then park on an EventCount. The
+// spin budget adapts: it grows while spinning pays off and shrinks when a
+// thread ends up parking anyway, so an idle queue quickly stops burning cpu.
+template<class Element>
+class SpscQueue
+{
+    static constexpr size_t CACHELINE = 64;
+
+    static constexpr unsigned SPIN_MIN = 16;
+    static constexpr unsigned SPIN_MAX = 4096;
+    static constexpr unsigned YIELD_NUM = 8;
+
+    // Spinning can't help when the other side has no cpu to run on
+    const unsigned spinMin = std::thread::hardware_concurrency() > 1 ? SPIN_MIN : 0;
+    const unsigned spinMax = std::thread::hardware_concurrency() > 1 ? SPIN_MAX : 0;
+
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        typename std::aligned_storage<sizeof(Element), alignof(Element)>::type storage;
+
+        Element *get() { return reinterpret_cast<Element*>(&storage); }
+    };
+
+    Cell   *cells;
+    size_t  capacity;
+    size_t  mask;
+
+    // Owned by the consumers
+    std::atomic<size_t> front {0};
+    unsigned consumerSpin = spinMin;
+    char pad0[CACHELINE];
+
+    // Owned by the producer
+    std::atomic<size_t> back {0};
+    unsigned producerSpin = spinMin;
+    char pad1[CACHELINE];
+
+    std::atomic<int> wakeupNum {0};
+    EventCount ec;
+
+    static void cpuRelax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    // Wait for ready() or a forceWakeups() after 'localWakeupNum' was sampled
+    // Returns true if ready() was satisfied
+    template<class Pred>
+    bool waitFor(Pred ready, int localWakeupNum, unsigned& spin)
+    {
+        auto done = [&](){
+            return ready() || localWakeupNum != wakeupNum.load(std::memory_order_acquire);
+        };
+
+        for (unsigned i = 0; i < spin; i++) {
+            if (done()) {
+                if (spin < spinMax) spin *= 2;
+                return ready();
+            }
+            cpuRelax();
+        }
+        for (unsigned i = 0; i < YIELD_NUM; i++) {
+            if (done()) return ready();
+            std::this_thread::yield();
+        }
+        if (spin > spinMin) spin /= 2;
+
+        while (!done()) {
+            uint32_t key = ec.prepareWait();
+            if (done()) {
+                ec.cancelWait();
+                break;
+            }
+            ec.wait(key);
+        }
+        return ready();
+    }
+
+    // Producer only: true if the slot at 'back' may be written
+    bool writable()
+    {
+        size_t pos = back.load(std::memory_order_relaxed);
+        if (pos - front.load(std::memory_order_acquire) >= capacity)
+            return false;
+        return cells[pos & mask].seq.load(std::memory_order_acquire) == pos;
+    }
+
+    template<class... Args>
+    void emplace(Args&&... args)
+    {
+        size_t pos = back.load(std::memory_order_relaxed);
+        Cell& c = cells[pos & mask];
+
+        // Initialize the Element by forwarding the parameter pack
+        // directly to the constructor called via Placement New
+        new (c.get()) Element(std::forward<Args>(args)...);
+        c.seq.store(pos + 1, std::memory_order_release);
+        back.store(pos + 1, std::memory_order_release);
+
+        ec.notify();
+    }
+
+  public:
+    SpscQueue(size_t size) : capacity(size)
+    {
+        ZCM_ASSERT(size > 0);
+
+        // Round the number of cells up to a power of two so that indexing is a mask.
+        // The queue still never holds more than 'size' elements.
+        size_t ncells = 1;
+        while (ncells < size) ncells <<= 1;
+        mask = ncells - 1;
+
+        // Note: the element storage is intentionally left uninitialized
+        cells = new Cell[ncells];
+        for (size_t i = 0; i < ncells; i++)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    ~SpscQueue()
+    {
+        clear();
+        delete[] cells;
+    }
+
+    size_t getCapacity() const
+    {
+        return capacity;
+    }
+
+    bool hasFreeSpace()
+    {
+        return back.load(std::memory_order_acquire) -
+               front.load(std::memory_order_acquire) < capacity;
+    }
+
+    // Number of queued elements, may be stale by the time it returns
+    size_t size()
+    {
+        size_t f = front.load(std::memory_order_acquire);
+        size_t b = back.load(std::memory_order_acquire);
+        return b > f ? b - f : 0;
+    }
+
+    bool hasMessage()
+    {
+        return front.load(std::memory_order_acquire) !=
+               back.load(std::memory_order_acquire);
+    }
+
+    // Push the new element if there is room for it
+    // Returns true if the value was pushed, otherwise the args are untouched
+    template<class... Args>
+    bool tryPush(Args&&... args)
+    {
+        if (!writable())
+            return false;
+        emplace(std::forward<Args>(args)...);
+        return true;
+    }
+
+    // Wait for hasFreeSpace() and then push the new element
+    // Returns true if the value was pushed, otherwise it
+    // was forcibly awoken by forceWakeups()
+    template<class... Args>
+    bool push(Args&&... args)
+    {
+        int localWakeupNum = wakeupNum.load(std::memory_order_acquire);
+        if (!writable() &&
+            !waitFor([&](){ return writable(); }, localWakeupNum, producerSpin))
+            return false;
+        emplace(std::forward<Args>(args)...);
+        return true;
+    }
+
+    // Move the oldest element into 'out' if there is one
+    // Returns true if an element was popped
+    bool tryPop(Element& out)
+    {
+        size_t pos = front.load(std::memory_order_relaxed);
+        Cell *c;
+        while (true) {
+            c = &cells[pos & mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (front.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = front.load(std::memory_order_relaxed);
+            }
+        }
+
+        Element *elt = c->get();
+        out = std::move(*elt);
+        // Manually call the destructor
+        elt->~Element();
+        c->seq.store(pos + mask + 1, std::memory_order_release);
+
+        ec.notify();
+        return true;
+    }
+
+    // Wait for hasMessage() and then move the oldest element into 'out'
+    // Returns true if an element was popped, otherwise it
+    // was forcibly awoken by forceWakeups()
+    bool pop(Element& out)
+    {
+        int localWakeupNum = wakeupNum.load(std::memory_order_acquire);
+        while (!tryPop(out)) {
+            if (!waitFor([&](){ return hasMessage(); }, localWakeupNum, consumerSpin))
+                return false;
+        }
+        return true;
+    }
+
+    // Destroy every element in the queue
+    // Requires that no other thread is using the queue
+    void clear()
+    {
+        size_t pos = front.load(std::memory_order_relaxed);
+        size_t end = back.load(std::memory_order_relaxed);
+        for (; pos != end; pos++) {
+            Cell& c = cells[pos & mask];
+            c.get()->~Element();
+            c.seq.store(pos + mask + 1, std::memory_order_relaxed);
+        }
+        front.store(end, std::memory_order_relaxed);
+    }
+
+    // Force all blocked threads to wakeup and return from
+    // whichever methods are blocking them
+    void forceWakeups()
+    {
+        wakeupNum.fetch_add(1, std::memory_order_acq_rel);
+        ec.notify();
+    }
+
+  private:
+    SpscQueue(const SpscQueue& other) = delete;
+    SpscQueue(SpscQueue&& other) = delete;
+    SpscQueue& operator=(const SpscQueue& other) = delete;
+    SpscQueue& operator=(SpscQueue&& other) = delete;
+};
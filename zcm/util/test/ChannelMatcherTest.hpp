@@ -0,0 +1,88 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "cxxtest/TestSuite.h"
+
+#include "channel_matcher.hpp"
+
+class ChannelMatcherTest : public CxxTest::TestSuite
+{
+    static std::vector<int> matches(const ChannelMatcher<int>& m, const std::string& channel)
+    {
+        std::vector<int> ret;
+        m.match(channel, ret);
+        return ret;
+    }
+
+  public:
+    void setUp() override {}
+    void tearDown() override {}
+
+    void testPrefixes()
+    {
+        ChannelMatcher<int> m;
+        m.add(0, ".*");
+        m.add(1, "FOO.*");
+        m.add(2, "FOOBAR.*");
+        m.add(3, "BAR.*");
+
+        TS_ASSERT_EQUALS(matches(m, "FOOBAR"), std::vector<int>({0, 1, 2}));
+        TS_ASSERT_EQUALS(matches(m, "FOOBA"),  std::vector<int>({0, 1}));
+        TS_ASSERT_EQUALS(matches(m, "FOO"),    std::vector<int>({0, 1}));
+        TS_ASSERT_EQUALS(matches(m, "FO"),     std::vector<int>({0}));
+        TS_ASSERT_EQUALS(matches(m, "BARFOO"), std::vector<int>({0, 3}));
+        TS_ASSERT_EQUALS(matches(m, ""),       std::vector<int>({0}));
+    }
+
+    void testGeneralPatterns()
+    {
+        ChannelMatcher<int> m;
+        m.add(0, "(FOO|BAR)_[0-9]+");
+        m.add(1, "FOO.*");
+        m.add(2, ".*_STATUS");
+        m.add(3, "A.B.*"); // '.' in the prefix is not literal
+
+        TS_ASSERT_EQUALS(matches(m, "FOO_12"),     std::vector<int>({0, 1}));
+        TS_ASSERT_EQUALS(matches(m, "BAR_1"),      std::vector<int>({0}));
+        TS_ASSERT_EQUALS(matches(m, "BAR_X"),      std::vector<int>());
+        TS_ASSERT_EQUALS(matches(m, "FOO_STATUS"), std::vector<int>({1, 2}));
+        TS_ASSERT_EQUALS(matches(m, "AXBY"),       std::vector<int>({3}));
+    }
+
+    void testRemove()
+    {
+        ChannelMatcher<int> m;
+        m.add(0, "FOO.*");
+        m.add(1, "FOOBAR.*");
+        m.add(2, "F[O]+.*");
+        TS_ASSERT_EQUALS(m.size(), 3);
+
+        TS_ASSERT(m.remove(1));
+        TS_ASSERT(!m.remove(1));
+        TS_ASSERT_EQUALS(matches(m, "FOOBAR"), std::vector<int>({0, 2}));
+
+        TS_ASSERT(m.remove(0));
+        TS_ASSERT(m.remove(2));
+        TS_ASSERT_EQUALS(matches(m, "FOOBAR"), std::vector<int>());
+        TS_ASSERT_EQUALS(m.size(), 0);
+
+        m.add(3, "FOOBAR.*");
+        TS_ASSERT_EQUALS(matches(m, "FOOBAR"), std::vector<int>({3}));
+        TS_ASSERT_EQUALS(m.getAll(), std::vector<int>({3}));
+    }
+
+    void testCopy()
+    {
+        ChannelMatcher<int> m;
+        m.add(0, "FOO.*");
+        m.add(1, "FO+");
+
+        ChannelMatcher<int> c {m};
+        c.add(2, ".*");
+        TS_ASSERT(c.remove(0));
+        TS_ASSERT_EQUALS(matches(c, "FOO"), std::vector<int>({1, 2}));
+        TS_ASSERT_EQUALS(matches(m, "FOO"), std::vector<int>({0, 1}));
+    }
+};
@@ -15,17 +15,17 @@
 // Note: To prevent compiler "redefinition" issues, all functions in this file must be declared
 //       as `inline`
 
-inline ZCM::ZCM()
+inline ZCM::ZCM() : subscriptions(nullptr)
 {
     zcm = zcm_create(nullptr);
 }
 
-inline ZCM::ZCM(const std::string& transport)
+inline ZCM::ZCM(const std::string& transport) : subscriptions(nullptr)
 {
     zcm = zcm_create(transport.c_str());
 }
 
-inline ZCM::ZCM(zcm_trans_t *zt)
+inline ZCM::ZCM(zcm_trans_t *zt) : subscriptions(nullptr)
 {
     zcm = (zcm_t*) malloc(sizeof(zcm_t));
     zcm_init_trans(zcm, zt);
@@ -36,9 +36,13 @@ inline ZCM::~ZCM()
     if (zcm != nullptr)
         zcm_destroy(zcm);
 
-    std::vector<Subscription*>::iterator end = subscriptions.end(),
-                                          it = subscriptions.begin();
-    for (;it != end; ++it) delete *it;
+    while (subscriptions) {
+        Subscription *next = subscriptions->next;
+        delete subscriptions;
+        subscriptions = next;
+    }
+    for (DecodeGroups::iterator it = groups.begin(); it != groups.end(); ++it)
+        delete it->second;
 
     zcm = nullptr;
 }
@@ -83,20 +87,106 @@ inline int ZCM::handleNonblock()
     return zcm_handle_nonblock(zcm);
 }
 
+inline int ZCM::handleNonblock(uint32_t maxMsgs, uint64_t maxUs,
+                               uint64_t (*timestampNow)(void *usr), void *usr)
+{
+    return zcm_handle_nonblock_budget(zcm, maxMsgs, maxUs, timestampNow, usr);
+}
+
+inline int ZCM::getFileno()
+{
+    return zcm_get_fileno(zcm);
+}
+
+inline int ZCM::handleReady(uint32_t maxMsgs)
+{
+    return zcm_handle_ready(zcm, maxMsgs);
+}
+
 inline void ZCM::flush()
 {
     zcm_flush(zcm);
 }
 
+inline int ZCM::setQueueSize(zcm_queue queue, uint32_t size)
+{
+    return zcm_set_queue_size(zcm, queue, size);
+}
+
+inline int ZCM::setQueuePolicy(zcm_queue queue, zcm_queue_policy policy)
+{
+    return zcm_set_queue_policy(zcm, queue, policy);
+}
+
+inline int ZCM::setChannelQueueSize(zcm_queue queue, const std::string& channel, uint32_t size)
+{
+    return zcm_set_channel_queue_size(zcm, queue, channel.c_str(), size);
+}
+
+inline int ZCM::setChannelPriority(const std::string& channel, zcm_priority priority)
+{
+    return zcm_set_channel_priority(zcm, channel.c_str(), priority);
+}
+
+inline int ZCM::setChannelConflate(const std::string& channel, bool conflate)
+{
+    return zcm_set_channel_conflate(zcm, channel.c_str(), conflate);
+}
+
+inline int ZCM::setDispatchThreads(uint32_t n)
+{
+    return zcm_set_dispatch_threads(zcm, n);
+}
+
+inline int ZCM::setVirtualTime(bool enable)
+{
+    return zcm_set_virtual_time(zcm, enable ? 1 : 0);
+}
+
+inline uint64_t ZCM::getUtime()
+{
+    return zcm_get_utime(zcm);
+}
+
+inline int ZCM::getStats(zcm_stats_t *stats)
+{
+    return zcm_get_stats(zcm, stats);
+}
+
 inline int ZCM::publish(const std::string& channel, const char *data, uint32_t len)
 {
     return zcm_publish(zcm, channel.c_str(), (char*)data, len);
 }
 
+inline void *ZCM::publishLoan(uint32_t len)
+{
+    return zcm_publish_loan(zcm, len);
+}
+
+inline int ZCM::publishCommit(const std::string& channel, void *buf, uint32_t len)
+{
+    return zcm_publish_commit(zcm, channel.c_str(), buf, len);
+}
+
+inline void ZCM::publishCancel(void *buf)
+{
+    zcm_publish_cancel(zcm, buf);
+}
+
 template <class Msg>
 inline int ZCM::publish(const std::string& channel, const Msg *msg)
 {
     uint32_t len = msg->getEncodedSize();
+
+    // Encode straight into the send queue's buffer when zcm can lend us one
+    if (zcm->type == ZCM_BLOCKING) {
+        uint8_t *loan = (uint8_t*)publishLoan(len);
+        if (loan) {
+            msg->encode(loan, 0, len);
+            return publishCommit(channel, loan, len);
+        }
+    }
+
     uint8_t *buf = new uint8_t[len];
     ZCM_ASSERT(buf);
     msg->encode(buf, 0, len);
@@ -106,80 +196,257 @@ inline int ZCM::publish(const std::string& channel, const Msg *msg)
 }
 
 // Virtual inheritance to avoid ambiguous base class problem http://stackoverflow.com/a/139329
-template<class Msg>
-class TypedSubscription : public virtual Subscription
+// A subscription that is handed messages already decoded by its DecodeGroup
+template <class Msg>
+class DecodedSubscription : public virtual Subscription
 {
     friend class ZCM;
+    friend class TypedDecodeGroup<Msg>;
 
   protected:
-    void (*typedCallback)(const ReceiveBuffer* rbuf, const std::string& channel, const Msg* msg,
-                          void *usr);
-    Msg msgMem; // Memory to decode this message into
+    // Set by every subscription type to dispatchAs<itself>, so that the group reaches the
+    // callback through this one call, with the type's typedDispatch() inlined into it
+    void (*invoke)(DecodedSubscription<Msg> *sub, const ReceiveBuffer *rbuf,
+                   const char *channel, const Msg *msg);
+
+    // Set once it left its group, for the messages already being dispatched to skip it
+    #ifndef ZCM_EMBEDDED
+    std::atomic<bool> removed;
+    #else
+    bool removed;
+    #endif
+
+    DecodedSubscription() : removed(false) {}
+
+    template <class Sub>
+    static inline void dispatchAs(DecodedSubscription<Msg> *sub, const ReceiveBuffer *rbuf,
+                                  const char *channel, const Msg *msg)
+    {
+        static_cast<Sub*>(sub)->typedDispatch(rbuf, channel, msg);
+    }
 
   public:
-    virtual ~TypedSubscription() {}
+    virtual ~DecodedSubscription() {}
+};
+
+template <class Msg>
+class TypedDecodeGroup : public DecodeGroup
+{
+    friend class ZCM;
+
+  protected:
+    // Memory to decode messages into. Messages dispatched while it is taken, on other
+    // channels of a pattern or from a callback, are decoded into their own
+    Msg msgMem;
+    bool msgMemTaken;
+    // In the order they subscribed, with NULL left behind by those that unsubscribed
+    // until there are more of those than subscriptions
+    std::vector<DecodedSubscription<Msg>*> members;
+    size_t numMembers;
+    // Messages are dispatched to the members they saw when they started, without the
+    // lock. Meanwhile 'members' is only appended to, the arrays it outgrows are kept
+    // in 'retiredArrays', those that leave are only marked as removed and kept in
+    // 'retired', and the group itself is only marked as released
+    size_t dispatching;
+    std::vector<std::vector<DecodedSubscription<Msg>*> > retiredArrays;
+    std::vector<DecodedSubscription<Msg>*> retired;
+    bool released;
+    #ifndef ZCM_EMBEDDED
+    std::mutex mut; // Guards all of the above but 'msgMem', callbacks may subscribe
+    #endif
+
+    inline void lock()
+    {
+        #ifndef ZCM_EMBEDDED
+        mut.lock();
+        #endif
+    }
+
+    inline void unlock()
+    {
+        #ifndef ZCM_EMBEDDED
+        mut.unlock();
+        #endif
+    }
 
-    inline int readMsg(const ReceiveBuffer *rbuf)
+    // Requires the lock, and that no message is being dispatched
+    inline void compact()
     {
-        int status = msgMem.decode(rbuf->data, 0, rbuf->data_size);
+        if (members.size() <= 2 * numMembers)
+            return;
+        size_t n = 0;
+        for (size_t i = 0; i < members.size(); i++) {
+            if (members[i]) {
+                members[i]->member = n;
+                members[n++] = members[i];
+            }
+        }
+        members.resize(n);
+    }
+
+    // Frees what was left behind once the last message being dispatched is done
+    inline void doneDispatching(Msg *mem)
+    {
+        std::vector<DecodedSubscription<Msg>*> done;
+        lock();
+        if (mem == &msgMem)
+            msgMemTaken = false;
+        bool last = --dispatching == 0;
+        bool freeGroup = last && released;
+        if (last) {
+            done.swap(retired);
+            for (size_t i = 0; i < done.size(); i++)
+                members[done[i]->member] = NULL;
+            compact();
+            retiredArrays.clear();
+        }
+        unlock();
+
+        if (mem != &msgMem)
+            delete mem;
+        for (size_t i = 0; i < done.size(); i++)
+            delete done[i];
+        if (freeGroup)
+            delete this;
+    }
+
+  public:
+    TypedDecodeGroup() : msgMemTaken(false), numMembers(0), dispatching(0), released(false) {}
+    virtual ~TypedDecodeGroup() {}
+
+    // One per message type, only used to tell the types apart
+    static inline const void *key()
+    {
+        static const char k = 0;
+        return &k;
+    }
+
+    inline void add(DecodedSubscription<Msg> *sub)
+    {
+        lock();
+        if (dispatching > 0 && members.size() == members.capacity()) {
+            std::vector<DecodedSubscription<Msg>*> grown;
+            grown.reserve(2 * members.size());
+            grown.assign(members.begin(), members.end());
+            retiredArrays.push_back(std::vector<DecodedSubscription<Msg>*>());
+            retiredArrays.back().swap(members);
+            members.swap(grown);
+        }
+        sub->member = members.size();
+        members.push_back(sub);
+        numMembers++;
+        unlock();
+    }
+
+    inline size_t remove(Subscription *sub)
+    {
+        lock();
+        DecodedSubscription<Msg> *member = members[sub->member];
+        size_t left = --numMembers;
+        bool freeNow = dispatching == 0;
+        if (freeNow) {
+            members[sub->member] = NULL;
+            compact();
+        } else {
+            member->removed = true;
+            retired.push_back(member);
+        }
+        unlock();
+
+        if (freeNow)
+            delete sub;
+        return left;
+    }
+
+    inline void release()
+    {
+        lock();
+        bool freeNow = dispatching == 0;
+        released = true;
+        unlock();
+
+        if (freeNow)
+            delete this;
+    }
+
+    inline void groupDispatch(const ReceiveBuffer *rbuf, const char *channel)
+    {
+        // Only those that subscribed before the message are handed it
+        lock();
+        dispatching++;
+        DecodedSubscription<Msg> *const *subs = members.empty() ? NULL : &members[0];
+        size_t n = members.size();
+        bool ownMem = !msgMemTaken;
+        msgMemTaken = true;
+        unlock();
+
+        Msg *mem = ownMem ? &msgMem : new Msg();
+        int status = mem->decode(rbuf->data, 0, rbuf->data_size);
         if (status < 0) {
             #ifndef ZCM_EMBEDDED
             fprintf (stderr, "error %d decoding %s!!!\n", status, Msg::getTypeName());
             #endif
-            return -1;
+        } else {
+            for (size_t i = 0; i < n; i++) {
+                // Checked every time, as a callback may unsubscribe the others
+                DecodedSubscription<Msg> *sub = subs[i];
+                if (sub && !sub->removed)
+                    sub->invoke(sub, rbuf, channel, mem);
+            }
         }
-        return 0;
-    }
 
-    inline void typedDispatch(const ReceiveBuffer *rbuf, const char *channel)
-    {
-        if (readMsg(rbuf) != 0) return;
-        (*typedCallback)(rbuf, channel, &msgMem, usr);
+        doneDispatching(mem);
     }
 
     static inline void dispatch(const ReceiveBuffer *rbuf, const char *channel, void *usr)
     {
-        ((TypedSubscription<Msg>*)usr)->typedDispatch(rbuf, channel);
+        ((TypedDecodeGroup<Msg>*)usr)->groupDispatch(rbuf, channel);
     }
 };
 
-#if __cplusplus > 199711L
-// Virtual inheritance to avoid ambiguous base class problem http://stackoverflow.com/a/139329
 template<class Msg>
-class TypedFunctionalSubscription : public virtual Subscription
+class TypedSubscription : public DecodedSubscription<Msg>
 {
     friend class ZCM;
 
   protected:
-    std::function<void (const ReceiveBuffer *rbuf,
-                        const std::string& channel,
-                        const Msg *msg)> cb;
-    Msg msgMem; // Memory to decode this message into
+    void (*typedCallback)(const ReceiveBuffer* rbuf, const std::string& channel, const Msg* msg,
+                          void *usr);
 
   public:
-    virtual ~TypedFunctionalSubscription() {}
+    TypedSubscription()
+    {
+        this->invoke = &DecodedSubscription<Msg>::template dispatchAs<TypedSubscription>;
+    }
+    virtual ~TypedSubscription() {}
 
-    inline int readMsg(const ReceiveBuffer *rbuf)
+    inline void typedDispatch(const ReceiveBuffer *rbuf, const char *channel, const Msg *msg)
     {
-        int status = msgMem.decode(rbuf->data, 0, rbuf->data_size);
-        if (status < 0) {
-            #ifndef ZCM_EMBEDDED
-            fprintf (stderr, "error %d decoding %s!!!\n", status, Msg::getTypeName());
-            #endif
-            return -1;
-        }
-        return 0;
+        (*typedCallback)(rbuf, channel, msg, this->usr);
     }
+};
+
+#if __cplusplus > 199711L
+// Holds a callable of any type, such as a lambda or a std::function
+template<class Msg, class Callable>
+class TypedCallableSubscription : public DecodedSubscription<Msg>
+{
+    friend class ZCM;
 
-    inline void typedDispatch(const ReceiveBuffer *rbuf, const char *channel)
+  protected:
+    Callable cb;
+
+  public:
+    template <class C>
+    TypedCallableSubscription(C&& cb) : cb(std::forward<C>(cb))
     {
-        if (readMsg(rbuf) != 0) return;
-        cb(rbuf, channel, &msgMem);
+        this->invoke = &DecodedSubscription<Msg>::template dispatchAs<TypedCallableSubscription>;
     }
+    virtual ~TypedCallableSubscription() {}
 
-    static inline void dispatch(const ReceiveBuffer *rbuf, const char *channel, void *usr)
+    inline void typedDispatch(const ReceiveBuffer *rbuf, const char *channel, const Msg *msg)
     {
-        ((TypedFunctionalSubscription<Msg>*)usr)->typedDispatch(rbuf, channel);
+        cb(rbuf, channel, msg);
     }
 };
 #endif
@@ -218,22 +485,43 @@ class TypedHandlerSubscription : public TypedSubscription<Msg>, HandlerSubscript
                                           const Msg* msg);
 
   public:
+    TypedHandlerSubscription()
+    {
+        this->invoke = &DecodedSubscription<Msg>::template dispatchAs<TypedHandlerSubscription>;
+    }
     virtual ~TypedHandlerSubscription() {}
 
-    inline void typedHandlerDispatch(const ReceiveBuffer *rbuf, const char *channel)
+    inline void typedDispatch(const ReceiveBuffer *rbuf, const char *channel, const Msg *msg)
     {
         // Unfortunately, we need to add "this" here to handle template inheritance:
         // https://isocpp.org/wiki/faq/templates#nondependent-name-lookup-members
-        if (this->readMsg(rbuf) != 0) return;
-        (this->handler->*typedHandlerCallback)(rbuf, channel, &this->msgMem);
+        (this->handler->*typedHandlerCallback)(rbuf, channel, msg);
     }
+};
 
-    static inline void dispatch(const ReceiveBuffer *rbuf, const char *channel, void *usr)
-    {
-        ((TypedHandlerSubscription<Msg, Handler>*)usr)->typedHandlerDispatch(rbuf, channel);
+template <class Msg>
+inline void ZCM::addToGroup(const std::string& channel, DecodedSubscription<Msg> *sub)
+{
+    typedef TypedDecodeGroup<Msg> GroupType;
+    #ifndef ZCM_EMBEDDED
+    std::unique_lock<std::mutex> lk(subsMut);
+    #endif
+
+    std::pair<std::string, const void*> key(channel, GroupType::key());
+    DecodeGroups::iterator it = groups.find(key);
+    if (it != groups.end()) {
+        ((GroupType*)it->second)->add(sub);
+        sub->group = it->second;
+        return;
     }
 
-};
+    GroupType *group = new GroupType();
+    ZCM_ASSERT(group);
+    group->add(sub);
+    group->c_sub = zcm_subscribe(zcm, channel.c_str(), GroupType::dispatch, group);
+    group->pos = groups.insert(std::make_pair(key, (DecodeGroup*)group)).first;
+    sub->group = group;
+}
 
 // TODO: lots of room to condense the implementations of the various subscribe functions
 template <class Msg, class Handler>
@@ -255,9 +543,9 @@ inline Subscription *ZCM::subscribe(const std::string& channel,
     ZCM_ASSERT(sub);
     sub->handler = handler;
     sub->typedHandlerCallback = cb;
-    sub->c_sub = zcm_subscribe(zcm, channel.c_str(), SubType::dispatch, sub);
+    addToGroup<Msg>(channel, sub);
 
-    subscriptions.push_back(sub);
+    addSubscription(sub);
     return sub;
 }
 
@@ -281,7 +569,7 @@ inline Subscription *ZCM::subscribe(const std::string& channel,
     sub->handlerCallback = cb;
     sub->c_sub = zcm_subscribe(zcm, channel.c_str(), SubType::dispatch, sub);
 
-    subscriptions.push_back(sub);
+    addSubscription(sub);
     return sub;
 }
 
@@ -304,9 +592,9 @@ inline Subscription *ZCM::subscribe(const std::string& channel,
     ZCM_ASSERT(sub);
     sub->usr = usr;
     sub->typedCallback = cb;
-    sub->c_sub = zcm_subscribe(zcm, channel.c_str(), SubType::dispatch, sub);
+    addToGroup<Msg>(channel, sub);
 
-    subscriptions.push_back(sub);
+    addSubscription(sub);
     return sub;
 }
 
@@ -316,6 +604,18 @@ inline Subscription *ZCM::subscribe(const std::string& channel,
                                     std::function<void (const ReceiveBuffer *rbuf,
                                                         const std::string& channel,
                                                         const Msg *msg)> cb)
+{
+    return subscribeCallable<Msg>(channel, std::move(cb));
+}
+
+template <class Msg, class Callable>
+inline Subscription *ZCM::subscribe(const std::string& channel, Callable&& cb)
+{
+    return subscribeCallable<Msg>(channel, std::forward<Callable>(cb));
+}
+
+template <class Msg, class Callable>
+inline Subscription *ZCM::subscribeCallable(const std::string& channel, Callable&& cb)
 {
     if (!zcm) {
         #ifndef ZCM_EMBEDDED
@@ -324,14 +624,13 @@ inline Subscription *ZCM::subscribe(const std::string& channel,
         return nullptr;
     }
 
-    typedef TypedFunctionalSubscription<Msg> SubType;
-    SubType *sub = new SubType();
+    typedef TypedCallableSubscription<Msg, typename std::decay<Callable>::type> SubType;
+    SubType *sub = new SubType(std::forward<Callable>(cb));
     ZCM_ASSERT(sub);
     sub->usr = nullptr;
-    sub->cb = cb;
-    sub->c_sub = zcm_subscribe(zcm, channel.c_str(), SubType::dispatch, sub);
+    addToGroup<Msg>(channel, sub);
 
-    subscriptions.push_back(sub);
+    addSubscription(sub);
     return sub;
 }
 #endif
@@ -355,21 +654,41 @@ inline Subscription *ZCM::subscribe(const std::string& channel,
     sub->callback = cb;
     sub->c_sub = zcm_subscribe(zcm, channel.c_str(), SubType::dispatch, sub);
 
-    subscriptions.push_back(sub);
+    addSubscription(sub);
     return sub;
 }
 
+inline void ZCM::addSubscription(Subscription *sub)
+{
+    #ifndef ZCM_EMBEDDED
+    std::unique_lock<std::mutex> lk(subsMut);
+    #endif
+    sub->next = subscriptions;
+    if (subscriptions) subscriptions->prev = sub;
+    subscriptions = sub;
+}
+
 inline void ZCM::unsubscribe(Subscription *sub)
 {
-    std::vector<Subscription*>::iterator end = subscriptions.end(),
-                                          it = subscriptions.begin();
-    for (; it != end; ++it) {
-        if (*it == sub) {
-            zcm_unsubscribe(zcm, sub->c_sub);
-            subscriptions.erase(it);
-            delete sub;
-            break;
-        }
+    if (!sub) return;
+
+    #ifndef ZCM_EMBEDDED
+    std::unique_lock<std::mutex> lk(subsMut);
+    #endif
+    if (sub->prev) sub->prev->next = sub->next;
+    else           subscriptions = sub->next;
+    if (sub->next) sub->next->prev = sub->prev;
+
+    // Note: a group frees the subscriptions that leave it, and itself once released,
+    //       only after the messages being dispatched to it are done with them
+    DecodeGroup *group = sub->group;
+    if (!group) {
+        zcm_unsubscribe(zcm, sub->c_sub);
+        delete sub;
+    } else if (group->remove(sub) == 0) {
+        zcm_unsubscribe(zcm, group->c_sub);
+        groups.erase(group->pos);
+        group->release();
     }
 }
 
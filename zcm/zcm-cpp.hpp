@@ -3,6 +3,8 @@
 #include <stdint.h>
 #include <string>
 #include <vector>
+#include <map>
+#include <algorithm>
 
 #include "zcm/zcm.h"
 
@@ -12,12 +14,25 @@
 
 #if __cplusplus > 199711L
 #include <functional>
+#include <type_traits>
+#include <utility>
+#endif
+
+#ifndef ZCM_EMBEDDED
+#include <mutex>
+#include <atomic>
 #endif
 
 namespace zcm {
 
 typedef zcm_recv_buf_t ReceiveBuffer;
 class Subscription;
+class DecodeGroup;
+template <class Msg> class DecodedSubscription;
+template <class Msg> class TypedDecodeGroup;
+
+// The decode groups of a ZCM, by channel and message type
+typedef std::map<std::pair<std::string, const void*>, DecodeGroup*> DecodeGroups;
 
 // TODO: unify pointer style pref "Msg* msg" vs "Msg *msg", I'd tend toward the former
 
@@ -39,11 +54,36 @@ class ZCM
     inline void stop();
     inline int handle();
     inline int handleNonblock();
+    // See zcm_handle_nonblock_budget()
+    inline int handleNonblock(uint32_t maxMsgs, uint64_t maxUs = 0,
+                              uint64_t (*timestampNow)(void *usr) = NULL,
+                              void *usr = NULL);
+    // See zcm_get_fileno() and zcm_handle_ready()
+    inline int getFileno();
+    inline int handleReady(uint32_t maxMsgs);
 
     inline void flush();
 
+    inline int setQueueSize(zcm_queue queue, uint32_t size);
+    inline int setQueuePolicy(zcm_queue queue, zcm_queue_policy policy);
+    inline int setChannelQueueSize(zcm_queue queue, const std::string& channel, uint32_t size);
+    inline int setChannelPriority(const std::string& channel, zcm_priority priority);
+    inline int setChannelConflate(const std::string& channel, bool conflate);
+    inline int setDispatchThreads(uint32_t n);
+    // See zcm_set_virtual_time() and zcm_get_utime()
+    inline int setVirtualTime(bool enable);
+    inline uint64_t getUtime();
+
+    // See zcm_get_stats(), the result must be freed with zcm_free_stats()
+    inline int getStats(zcm_stats_t *stats);
+
     inline int publish(const std::string& channel, const char *data, uint32_t len);
 
+    // Zero-copy publishing, see zcm_publish_loan() and friends
+    inline void *publishLoan(uint32_t len);
+    inline int publishCommit(const std::string& channel, void *buf, uint32_t len);
+    inline void publishCancel(void *buf);
+
     // Note: if we make a publish binding that takes a const message reference, the compiler does
     //       not select the right version between the pointer and reference versions, so when the
     //       user intended to call the pointer version, the reference version is called and causes
@@ -78,6 +118,11 @@ class ZCM
                                    std::function<void (const ReceiveBuffer *rbuf,
                                                        const std::string& channel,
                                                        const Msg *msg)> cb);
+
+    // Any callable with the signature above, such as a lambda, including move-only ones.
+    // It is moved into the subscription and called directly, without a std::function
+    template <class Msg, class Callable>
+    inline Subscription *subscribe(const std::string& channel, Callable&& cb);
     #endif
 
     inline Subscription *subscribe(const std::string& channel,
@@ -86,26 +131,49 @@ class ZCM
                                               void *usr),
                                    void *usr);
 
+    // 'sub' must be a subscription of this ZCM that wasn't unsubscribed yet, or nullptr
     inline void unsubscribe(Subscription *sub);
 
     inline zcm_t* getUnderlyingZCM();
 
   private:
+    template <class Msg>
+    inline void addToGroup(const std::string& channel, DecodedSubscription<Msg> *sub);
+
+    #if __cplusplus > 199711L
+    template <class Msg, class Callable>
+    inline Subscription *subscribeCallable(const std::string& channel, Callable&& cb);
+    #endif
+
+    inline void addSubscription(Subscription *sub);
+
     zcm_t *zcm;
-    std::vector<Subscription*> subscriptions;
+    Subscription *subscriptions; // the newest, the rest linked through 'next'
+    DecodeGroups groups;
+    #ifndef ZCM_EMBEDDED
+    std::mutex subsMut; // Guards the two above, callbacks may subscribe and unsubscribe
+    #endif
 };
 
 // New class required to allow the Handler callbacks and std::string channel names
 class Subscription
 {
     friend class ZCM;
+    template <class Msg> friend class TypedDecodeGroup;
     zcm_sub_t *c_sub;
+    DecodeGroup *group; // set instead of 'c_sub' for typed subscriptions
+
+    // Where the subscription is in the ZCM's list and in the members of its group,
+    // so that unsubscribing never has to search for it
+    Subscription *prev, *next;
+    size_t member;
 
   protected:
     void *usr;
     void (*callback)(const ReceiveBuffer* rbuf, const std::string& channel, void *usr);
 
   public:
+    Subscription() : c_sub(NULL), group(NULL), prev(NULL), next(NULL), member(0) {}
     virtual ~Subscription() {}
 
     inline void dispatch(const ReceiveBuffer *rbuf, const char *channel)
@@ -119,6 +187,28 @@ class Subscription
     }
 };
 
+// The typed subscriptions to the same channel (or pattern) and message type share a
+// single zcm subscription, so every message is decoded once for all of them. Raw
+// subscriptions keep their own zcm subscription and never pay for a decode.
+class DecodeGroup
+{
+    friend class ZCM;
+
+  protected:
+    zcm_sub_t *c_sub;
+    DecodeGroups::iterator pos; // where the group is in its ZCM's 'groups'
+
+  public:
+    virtual ~DecodeGroup() {}
+
+    // Takes 'sub' out of the group and frees it, once no message is being dispatched
+    // to the group anymore. Returns how many subscriptions are left in the group
+    virtual size_t remove(Subscription *sub) = 0;
+
+    // Frees the group, once no message is being dispatched to it anymore
+    virtual void release() = 0;
+};
+
 // TODO: why not use or inherit from the existing zcm data structures for the below
 
 #ifndef ZCM_EMBEDDED
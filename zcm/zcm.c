@@ -16,22 +16,56 @@
 
 #ifndef ZCM_EMBEDDED
 #include <stdlib.h>
+#include <string.h>
 
 # include "zcm/blocking.h"
 # include "zcm/transport_registrar.h"
+# include "zcm/url.h"
 # include "zcm/util/debug.h"
 #else
 /** Note: here's to hoping that variadic macros are "portable enough" **/
 # define ZCM_DEBUG(...)
 #endif
 
-zcm_t *zcm_create(const char *url)
+#ifdef ZCM_STATIC_INSTANCES
+static zcm_t zcmPool[ZCM_STATIC_INSTANCES] ZCM_STATIC_POOL_ATTR;
+static char  zcmPoolUsed[ZCM_STATIC_INSTANCES];
+#endif
+
+static zcm_t *zcm_alloc(void)
 {
-#ifndef ZCM_EMBEDDED
+#ifdef ZCM_STATIC_INSTANCES
+    size_t i;
+    for (i = 0; i < ZCM_STATIC_INSTANCES; ++i) {
+        if (!zcmPoolUsed[i]) {
+            zcmPoolUsed[i] = 1;
+            return &zcmPool[i];
+        }
+    }
+    return NULL;
+#else
     zcm_t *z = malloc(sizeof(zcm_t));
     ZCM_ASSERT(z);
+    return z;
+#endif
+}
+
+static void zcm_free(zcm_t *z)
+{
+#ifdef ZCM_STATIC_INSTANCES
+    zcmPoolUsed[z - zcmPool] = 0;
+#else
+    free(z);
+#endif
+}
+
+zcm_t *zcm_create(const char *url)
+{
+#ifndef ZCM_EMBEDDED
+    zcm_t *z = zcm_alloc();
+    if (!z) return NULL;
     if (zcm_init(z, url) == -1) {
-        free(z);
+        zcm_free(z);
         return NULL;
     }
     return z;
@@ -43,10 +77,10 @@ zcm_t *zcm_create(const char *url)
 
 zcm_t *zcm_create_trans(zcm_trans_t *zt)
 {
-    zcm_t *z = malloc(sizeof(zcm_t));
-    ZCM_ASSERT(z);
+    zcm_t *z = zcm_alloc();
+    if (!z) return NULL;
     if (zcm_init_trans(z, zt) == -1) {
-        free(z);
+        zcm_free(z);
         return NULL;
     }
     return z;
@@ -55,9 +89,88 @@ zcm_t *zcm_create_trans(zcm_trans_t *zt)
 void zcm_destroy(zcm_t *zcm)
 {
     zcm_cleanup(zcm);
-    free(zcm);
+    if (zcm) zcm_free(zcm);
+}
+
+#ifndef ZCM_EMBEDDED
+static int parse_queue_policy(const char *str, enum zcm_queue_policy *policy)
+{
+    if      (strcmp(str, "block")       == 0) *policy = ZCM_QUEUE_BLOCK;
+    else if (strcmp(str, "drop_newest") == 0) *policy = ZCM_QUEUE_DROP_NEWEST;
+    else if (strcmp(str, "drop_oldest") == 0) *policy = ZCM_QUEUE_DROP_OLDEST;
+    else if (strcmp(str, "keep_latest") == 0) *policy = ZCM_QUEUE_KEEP_LATEST;
+    else return -1;
+    return 0;
 }
 
+/* Apply the url options understood by the core rather than by the transport
+   Returns 0 on success, and -1 on failure */
+static int zcm_init_url_opts(zcm_t *zcm, zcm_url_opts_t *opts)
+{
+    size_t i;
+    for (i = 0; i < opts->numopts; i++) {
+        const char *name = opts->name[i];
+        const char *value = opts->value[i];
+        enum zcm_queue queue;
+        int isPolicy;
+
+        if (strcmp(name, "dispatch_threads") == 0) {
+            char *end;
+            unsigned long n = strtoul(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || n == 0 || n > UINT32_MAX) {
+                ZCM_DEBUG("expected a positive integer for '%s'", name);
+                zcm->err = ZCM_EINVALID;
+                return -1;
+            }
+            if (zcm_set_dispatch_threads(zcm, (uint32_t)n) != 0)
+                return -1;
+            continue;
+        }
+
+        if (strcmp(name, "virtual_time") == 0) {
+            if (strcmp(value, "0") != 0 && strcmp(value, "1") != 0) {
+                ZCM_DEBUG("expected 0 or 1 for '%s'", name);
+                zcm->err = ZCM_EINVALID;
+                return -1;
+            }
+            if (zcm_set_virtual_time(zcm, value[0] == '1') != 0)
+                return -1;
+            continue;
+        }
+
+        if      (strcmp(name, "queue_size")        == 0) { queue = ZCM_BOTH_QUEUES; isPolicy = 0; }
+        else if (strcmp(name, "send_queue_size")   == 0) { queue = ZCM_SEND_QUEUE;  isPolicy = 0; }
+        else if (strcmp(name, "recv_queue_size")   == 0) { queue = ZCM_RECV_QUEUE;  isPolicy = 0; }
+        else if (strcmp(name, "queue_policy")      == 0) { queue = ZCM_BOTH_QUEUES; isPolicy = 1; }
+        else if (strcmp(name, "send_queue_policy") == 0) { queue = ZCM_SEND_QUEUE;  isPolicy = 1; }
+        else if (strcmp(name, "recv_queue_policy") == 0) { queue = ZCM_RECV_QUEUE;  isPolicy = 1; }
+        else continue;
+
+        if (isPolicy) {
+            enum zcm_queue_policy policy;
+            if (parse_queue_policy(value, &policy) != 0) {
+                ZCM_DEBUG("unknown queue policy '%s' for '%s'", value, name);
+                zcm->err = ZCM_EINVALID;
+                return -1;
+            }
+            if (zcm_set_queue_policy(zcm, queue, policy) != 0)
+                return -1;
+        } else {
+            char *end;
+            unsigned long size = strtoul(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || size == 0 || size > UINT32_MAX) {
+                ZCM_DEBUG("expected a positive integer for '%s'", name);
+                zcm->err = ZCM_EINVALID;
+                return -1;
+            }
+            if (zcm_set_queue_size(zcm, queue, (uint32_t)size) != 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+#endif
+
 int zcm_init(zcm_t *zcm, const char *url)
 {
 #ifndef ZCM_EMBEDDED
@@ -80,6 +193,11 @@ int zcm_init(zcm_t *zcm, const char *url)
         zcm_trans_t *trans = creator(u);
         if (trans) {
             ret = zcm_init_trans(zcm, trans);
+            if (ret == 0 && zcm->type == ZCM_BLOCKING &&
+                zcm_init_url_opts(zcm, zcm_url_opts(u)) != 0) {
+                zcm_cleanup(zcm);
+                ret = -1;
+            }
         } else {
             ZCM_DEBUG("failed to create transport for '%s'", url);
         }
@@ -116,7 +234,8 @@ int zcm_init_trans(zcm_t *zcm, zcm_trans_t *zt)
         case ZCM_NONBLOCKING: {
             zcm->type = ZCM_NONBLOCKING;
             zcm->impl = zcm_nonblocking_create(zcm, zt);
-            ZCM_ASSERT(zcm->impl);
+            if (!zcm->impl)
+                goto fail;
             zcm->err = ZCM_EOK;
             return 0;
         } break;
@@ -185,6 +304,57 @@ int zcm_publish(zcm_t *zcm, const char *channel, const void *data, uint32_t len)
     assert(0 && "unreachable");
 }
 
+void *zcm_publish_loan(zcm_t *zcm, uint32_t len)
+{
+#ifndef ZCM_EMBEDDED
+    switch (zcm->type) {
+        case ZCM_BLOCKING: {
+            char *buf = zcm_blocking_publish_loan(zcm->impl, len);
+            zcm->err = buf ? ZCM_EOK : ZCM_EINVALID;
+            return buf;
+        } break;
+        case ZCM_NONBLOCKING: {
+            ZCM_DEBUG("zcm_publish_loan() is not supported on a nonblocking ZCM interface");
+            zcm->err = ZCM_EINVALID;
+            return NULL;
+        } break;
+    }
+#else
+    zcm->err = ZCM_EINVALID;
+#endif
+    return NULL;
+}
+
+int zcm_publish_commit(zcm_t *zcm, const char *channel, void *buf, uint32_t len)
+{
+#ifndef ZCM_EMBEDDED
+    switch (zcm->type) {
+        case ZCM_BLOCKING: {
+            zcm->err = zcm_blocking_publish_commit(zcm->impl, channel, buf, len);
+            return zcm->err == ZCM_EOK ? 0 : -1;
+        } break;
+        case ZCM_NONBLOCKING: {
+            assert(0 && "Cannot publish_commit() on a nonblocking ZCM interface");
+        } break;
+    }
+#else
+    assert(0 && "the blocking api is not supported");
+#endif
+    return -1;
+}
+
+void zcm_publish_cancel(zcm_t *zcm, void *buf)
+{
+#ifndef ZCM_EMBEDDED
+    switch (zcm->type) {
+        case ZCM_BLOCKING:    zcm_blocking_publish_cancel(zcm->impl, buf); break;
+        case ZCM_NONBLOCKING: assert(0 && "Cannot publish_cancel() on a nonblocking ZCM interface"); break;
+    }
+#else
+    assert(0 && "the blocking api is not supported");
+#endif
+}
+
 void zcm_flush(zcm_t *zcm)
 {
 #ifndef ZCM_EMBEDDED
@@ -271,6 +441,293 @@ int zcm_handle(zcm_t *zcm)
     return -1;
 }
 
+int zcm_get_fileno(zcm_t *zcm)
+{
+#ifndef ZCM_EMBEDDED
+    int fd = -1;
+    switch (zcm->type) {
+        case ZCM_BLOCKING: {
+            zcm->err = zcm_blocking_get_fileno(zcm->impl, &fd);
+            return zcm->err == ZCM_EOK ? fd : -1;
+        } break;
+        case ZCM_NONBLOCKING: {
+            ZCM_DEBUG("zcm_get_fileno() is not supported on a nonblocking ZCM interface");
+            zcm->err = ZCM_EINVALID;
+            return -1;
+        } break;
+    }
+#else
+    assert(0 && "the blocking api is not supported");
+#endif
+    return -1;
+}
+
+int zcm_handle_ready(zcm_t *zcm, uint32_t max_msgs)
+{
+#ifndef ZCM_EMBEDDED
+    uint32_t n = 0;
+    switch (zcm->type) {
+        case ZCM_BLOCKING: {
+            zcm->err = zcm_blocking_handle_ready(zcm->impl, max_msgs, &n);
+            return zcm->err == ZCM_EOK ? (int)n : -1;
+        } break;
+        case ZCM_NONBLOCKING: {
+            ZCM_DEBUG("zcm_handle_ready() is not supported on a nonblocking ZCM interface");
+            zcm->err = ZCM_EINVALID;
+            return -1;
+        } break;
+    }
+#else
+    assert(0 && "the blocking api is not supported");
+#endif
+    return -1;
+}
+
+int zcm_set_queue_size(zcm_t *zcm, enum zcm_queue queue, uint32_t size)
+{
+#ifndef ZCM_EMBEDDED
+    switch (zcm->type) {
+        case ZCM_BLOCKING: {
+            zcm->err = zcm_blocking_set_queue_size(zcm->impl, queue, size);
+            return zcm->err == ZCM_EOK ? 0 : -1;
+        } break;
+        case ZCM_NONBLOCKING: {
+            ZCM_DEBUG("zcm_set_queue_size() is not supported on a nonblocking ZCM interface");
+            zcm->err = ZCM_EINVALID;
+            return -1;
+        } break;
+    }
+#else
+    assert(0 && "the blocking api is not supported");
+#endif
+    return -1;
+}
+
+int zcm_set_queue_policy(zcm_t *zcm, enum zcm_queue queue, enum zcm_queue_policy policy)
+{
+#ifndef ZCM_EMBEDDED
+    switch (zcm->type) {
+        case ZCM_BLOCKING: {
+            zcm->err = zcm_blocking_set_queue_policy(zcm->impl, queue, policy);
+            return zcm->err == ZCM_EOK ? 0 : -1;
+        } break;
+        case ZCM_NONBLOCKING: {
+            ZCM_DEBUG("zcm_set_queue_policy() is not supported on a nonblocking ZCM interface");
+            zcm->err = ZCM_EINVALID;
+            return -1;
+        } break;
+    }
+#else
+    assert(0 && "the blocking api is not supported");
+#endif
+    return -1;
+}
+
+int zcm_set_channel_queue_size(zcm_t *zcm, enum zcm_queue queue,
+                               const char *channel, uint32_t size)
+{
+#ifndef ZCM_EMBEDDED
+    switch (zcm->type) {
+        case ZCM_BLOCKING: {
+            zcm->err = zcm_blocking_set_channel_queue_size(zcm->impl, queue, channel, size);
+            return zcm->err == ZCM_EOK ? 0 : -1;
+        } break;
+        case ZCM_NONBLOCKING: {
+            ZCM_DEBUG("zcm_set_channel_queue_size() is not supported on a nonblocking ZCM interface");
+            zcm->err = ZCM_EINVALID;
+            return -1;
+        } break;
+    }
+#else
+    assert(0 && "the blocking api is not supported");
+#endif
+    return -1;
+}
+
+int zcm_set_channel_priority(zcm_t *zcm, const char *channel, enum zcm_priority priority)
+{
+#ifndef ZCM_EMBEDDED
+    switch (zcm->type) {
+        case ZCM_BLOCKING: {
+            zcm->err = zcm_blocking_set_channel_priority(zcm->impl, channel, priority);
+            return zcm->err == ZCM_EOK ? 0 : -1;
+        } break;
+        case ZCM_NONBLOCKING: {
+            ZCM_DEBUG("zcm_set_channel_priority() is not supported on a nonblocking ZCM interface");
+            zcm->err = ZCM_EINVALID;
+            return -1;
+        } break;
+    }
+#else
+    assert(0 && "the blocking api is not supported");
+#endif
+    return -1;
+}
+
+int zcm_set_channel_conflate(zcm_t *zcm, const char *channel, int conflate)
+{
+#ifndef ZCM_EMBEDDED
+    switch (zcm->type) {
+        case ZCM_BLOCKING: {
+            zcm->err = zcm_blocking_set_channel_conflate(zcm->impl, channel, conflate);
+            return zcm->err == ZCM_EOK ? 0 : -1;
+        } break;
+        case ZCM_NONBLOCKING: {
+            ZCM_DEBUG("zcm_set_channel_conflate() is not supported on a nonblocking ZCM interface");
+            zcm->err = ZCM_EINVALID;
+            return -1;
+        } break;
+    }
+#else
+    assert(0 && "the blocking api is not supported");
+#endif
+    return -1;
+}
+
+int zcm_set_dispatch_threads(zcm_t *zcm, uint32_t n)
+{
+#ifndef ZCM_EMBEDDED
+    switch (zcm->type) {
+        case ZCM_BLOCKING: {
+            zcm->err = zcm_blocking_set_dispatch_threads(zcm->impl, n);
+            return zcm->err == ZCM_EOK ? 0 : -1;
+        } break;
+        case ZCM_NONBLOCKING: {
+            ZCM_DEBUG("zcm_set_dispatch_threads() is not supported on a nonblocking ZCM interface");
+            zcm->err = ZCM_EINVALID;
+            return -1;
+        } break;
+    }
+#else
+    assert(0 && "the blocking api is not supported");
+#endif
+    return -1;
+}
+
+int zcm_set_virtual_time(zcm_t *zcm, int enable)
+{
+#ifndef ZCM_EMBEDDED
+    switch (zcm->type) {
+        case ZCM_BLOCKING: {
+            zcm->err = zcm_blocking_set_virtual_time(zcm->impl, enable);
+            return zcm->err == ZCM_EOK ? 0 : -1;
+        } break;
+        case ZCM_NONBLOCKING: {
+            ZCM_DEBUG("zcm_set_virtual_time() is not supported on a nonblocking ZCM interface");
+            zcm->err = ZCM_EINVALID;
+            return -1;
+        } break;
+    }
+#else
+    assert(0 && "the blocking api is not supported");
+#endif
+    return -1;
+}
+
+uint64_t zcm_get_utime(zcm_t *zcm)
+{
+#ifndef ZCM_EMBEDDED
+    switch (zcm->type) {
+        case ZCM_BLOCKING:    return zcm_blocking_get_utime(zcm->impl); break;
+        case ZCM_NONBLOCKING: return 0; break;
+    }
+#else
+    assert(0 && "the blocking api is not supported");
+#endif
+    return 0;
+}
+
+int zcm_get_stats(zcm_t *zcm, zcm_stats_t *stats)
+{
+#ifndef ZCM_EMBEDDED
+    switch (zcm->type) {
+        case ZCM_BLOCKING: {
+            zcm->err = zcm_blocking_get_stats(zcm->impl, stats);
+            return zcm->err == ZCM_EOK ? 0 : -1;
+        } break;
+        case ZCM_NONBLOCKING: {
+            ZCM_DEBUG("zcm_get_stats() is not supported on a nonblocking ZCM interface");
+            zcm->err = ZCM_EINVALID;
+            return -1;
+        } break;
+    }
+#else
+    assert(0 && "the blocking api is not supported");
+#endif
+    return -1;
+}
+
+void zcm_free_stats(zcm_stats_t *stats)
+{
+#ifndef ZCM_EMBEDDED
+    free(stats->channels);
+    free(stats->transport.senders);
+#endif
+    stats->channels = NULL;
+    stats->nchannels = 0;
+    stats->transport.senders = NULL;
+    stats->transport.nsenders = 0;
+}
+
+/* Values below 16 have a bucket each, then every power of two has 8 buckets */
+#define HIST_LINEAR 16
+#define HIST_SUB_BITS 3
+#define HIST_MAX_EXP 39
+
+uint32_t zcm_histogram_bucket(uint64_t value)
+{
+    uint32_t exp = 0;
+    uint64_t v = value;
+
+    if (value < HIST_LINEAR)
+        return (uint32_t)value;
+    while (v >>= 1) exp++;
+    if (exp > HIST_MAX_EXP)
+        return ZCM_HISTOGRAM_BUCKETS - 1;
+    return HIST_LINEAR + (exp - 4) * (1 << HIST_SUB_BITS) +
+           (uint32_t)((value >> (exp - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+uint64_t zcm_histogram_bucket_max(uint32_t bucket)
+{
+    uint32_t exp, sub;
+
+    if (bucket < HIST_LINEAR)
+        return bucket;
+    if (bucket >= ZCM_HISTOGRAM_BUCKETS - 1)
+        return UINT64_MAX;
+    exp = 4 + (bucket - HIST_LINEAR) / (1 << HIST_SUB_BITS);
+    sub = (bucket - HIST_LINEAR) % (1 << HIST_SUB_BITS);
+    return ((uint64_t)((1 << HIST_SUB_BITS) + sub + 1) << (exp - HIST_SUB_BITS)) - 1;
+}
+
+uint64_t zcm_histogram_percentile(const zcm_histogram_t *h, double percentile)
+{
+    uint64_t total = 0, seen = 0, target;
+    uint32_t i;
+
+    /* Note: the buckets are counted again so that they agree with each other even
+             if 'count' was snapshotted at a slightly different time */
+    for (i = 0; i < ZCM_HISTOGRAM_BUCKETS; i++)
+        total += h->buckets[i];
+    if (total == 0)
+        return 0;
+
+    if (percentile < 0) percentile = 0;
+    if (percentile > 100) percentile = 100;
+    target = (uint64_t)(total * percentile / 100.0 + 0.5);
+    if (target == 0) target = 1;
+
+    for (i = 0; i < ZCM_HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= target) {
+            uint64_t max = zcm_histogram_bucket_max(i);
+            return max < h->max_us ? max : h->max_us;
+        }
+    }
+    return h->max_us;
+}
+
 int zcm_handle_nonblock(zcm_t *zcm)
 {
 #ifndef ZCM_EMBEDDED
@@ -284,3 +741,21 @@ int zcm_handle_nonblock(zcm_t *zcm)
 #endif
     assert(0 && "unreachable");
 }
+
+int zcm_handle_nonblock_budget(zcm_t *zcm, uint32_t max_msgs, uint64_t max_us,
+                               uint64_t (*timestamp_now)(void *usr), void *usr)
+{
+#ifndef ZCM_EMBEDDED
+    switch (zcm->type) {
+        case ZCM_BLOCKING:    assert(0 && "Cannot handle_nonblock() on a blocking ZCM interface"); break;
+        case ZCM_NONBLOCKING: return zcm_nonblocking_handle_nonblock_budget(zcm->impl, max_msgs,
+                                                                            max_us, timestamp_now,
+                                                                            usr); break;
+    }
+#else
+    assert(zcm->type == ZCM_NONBLOCKING);
+    return zcm_nonblocking_handle_nonblock_budget(zcm->impl, max_msgs, max_us,
+                                                  timestamp_now, usr);
+#endif
+    assert(0 && "unreachable");
+}
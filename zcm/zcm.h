@@ -16,6 +16,15 @@ extern "C" {
 
 /* Important hardcoded values */
 #define ZCM_CHANNEL_MAXLEN 32
+
+/* Define ZCM_STATIC_INSTANCES to N for targets without a heap: zcm_create_trans(),
+   the nonblocking core and the generic serial transport then take their objects
+   from static pools of N each instead of calling malloc(). Creating fails once a
+   pool is used up, and the pools must only be used from one thread. Define
+   ZCM_STATIC_POOL_ATTR to place the pools, e.g. __attribute__((section(".sram2"))) */
+#ifndef ZCM_STATIC_POOL_ATTR
+#define ZCM_STATIC_POOL_ATTR
+#endif
 enum zcm_type {
     ZCM_BLOCKING,
     ZCM_NONBLOCKING
@@ -60,7 +69,8 @@ struct zcm_recv_buf_t
     uint32_t data_size;
 };
 
-/* Standard create/destroy functions. These will malloc() and free() the zcm_t object.
+/* Standard create/destroy functions. These will malloc() and free() the zcm_t object,
+   or take it from and return it to the static pool under ZCM_STATIC_INSTANCES.
    Sets zcm errno on failure */
 zcm_t *zcm_create(const char *url);
 zcm_t *zcm_create_trans(zcm_trans_t *zt);
@@ -102,6 +112,24 @@ int zcm_unsubscribe(zcm_t *zcm, zcm_sub_t *sub);
    Sets zcm errno on failure */
 int  zcm_publish(zcm_t *zcm, const char *channel, const void *data, uint32_t len);
 
+/* Blocking Mode Only: Zero-copy publishing. Returns a buffer of 'len' bytes to encode
+   a message into, which zcm_publish_commit() then queues without copying it.
+   Every buffer must be handed back with zcm_publish_commit() or zcm_publish_cancel()
+   before the zcm object is destroyed.
+   Returns NULL on failure
+   Sets zcm errno on failure */
+void *zcm_publish_loan(zcm_t *zcm, uint32_t len);
+
+/* Blocking Mode Only: Publish the first 'len' bytes of a buffer from zcm_publish_loan().
+   'len' may be less than the size that was asked for. The buffer is handed back even
+   when publishing fails and must not be used after this call.
+   Returns 0 on success, and -1 on failure
+   Sets zcm errno on failure */
+int  zcm_publish_commit(zcm_t *zcm, const char *channel, void *buf, uint32_t len);
+
+/* Blocking Mode Only: Hand back a buffer from zcm_publish_loan() without publishing it */
+void zcm_publish_cancel(zcm_t *zcm, void *buf);
+
 /* Blocking until all published messages have been sent even if the underlying
    transport is nonblocking. This should not be called concurrently with
    zcm_publish(). This function may cause all calls to zcm_publish() to block
@@ -114,10 +142,221 @@ void   zcm_start(zcm_t *zcm);
 void   zcm_stop(zcm_t *zcm);
 int    zcm_handle(zcm_t *zcm); /* returns 0 normally, and -1 when an error occurs. */
 
+/* Blocking Mode Only: For applications that run their own event loop (poll, epoll, libuv...)
+   instead of zcm_run() or zcm_handle(). Returns a file descriptor that is readable while
+   received messages wait to be dispatched, and starts receiving as zcm_handle() does.
+   Only read from by zcm_handle_ready(), and closed by zcm_destroy().
+   Returns -1 on failure, which includes while zcm_run() or zcm_start() dispatch messages
+   Sets zcm errno on failure */
+int zcm_get_fileno(zcm_t *zcm);
+
+/* Blocking Mode Only: Dispatch up to 'max_msgs' of the messages that were received, on the
+   calling thread, without waiting for more. Once none are left, the descriptor returned by
+   zcm_get_fileno() stops being readable until another message arrives.
+   Returns the number of messages dispatched, and -1 on failure
+   Sets zcm errno on failure */
+int zcm_handle_ready(zcm_t *zcm, uint32_t max_msgs);
+
+/* Blocking Mode Only: Selects the send queue, the receive queue or both */
+enum zcm_queue {
+    ZCM_SEND_QUEUE  = 1,
+    ZCM_RECV_QUEUE  = 2,
+    ZCM_BOTH_QUEUES = 3
+};
+
+/* Blocking Mode Only: What to do with a message that doesn't fit in a full queue */
+enum zcm_queue_policy {
+    ZCM_QUEUE_BLOCK,        /* wait for room (the default for receiving) */
+    ZCM_QUEUE_DROP_NEWEST,  /* drop the incoming message, zcm_publish() fails with
+                               ZCM_EAGAIN (the default for sending) */
+    ZCM_QUEUE_DROP_OLDEST,  /* drop the oldest queued message to make room */
+    ZCM_QUEUE_KEEP_LATEST   /* only keep the newest queued message of each channel,
+                               otherwise the same as ZCM_QUEUE_DROP_OLDEST */
+};
+
+/* Blocking Mode Only: Set how many messages a queue can hold (16 by default).
+   Must be called before the first zcm_publish() for the send queue and before
+   zcm_run(), zcm_start() or zcm_handle() for the receive queue.
+   Also settable from the url with "queue_size", "send_queue_size" and "recv_queue_size"
+   Returns 0 on success, and -1 on failure
+   Sets zcm errno on failure */
+int zcm_set_queue_size(zcm_t *zcm, enum zcm_queue queue, uint32_t size);
+
+/* Blocking Mode Only: Set what happens when a queue is full. May be called at any time.
+   Also settable from the url with "queue_policy", "send_queue_policy" and
+   "recv_queue_policy" set to one of "block", "drop_newest", "drop_oldest" or "keep_latest"
+   Returns 0 on success, and -1 on failure
+   Sets zcm errno on failure */
+int zcm_set_queue_policy(zcm_t *zcm, enum zcm_queue queue, enum zcm_queue_policy policy);
+
+/* Blocking Mode Only: Limit how many messages of one channel may wait in a queue
+   (0 removes the limit). Once a channel is at its limit, ZCM_QUEUE_DROP_OLDEST and
+   ZCM_QUEUE_KEEP_LATEST drop that channel's oldest message, while ZCM_QUEUE_BLOCK and
+   ZCM_QUEUE_DROP_NEWEST drop the incoming one. Only the exact channel name is matched.
+   Returns 0 on success, and -1 on failure
+   Sets zcm errno on failure */
+int zcm_set_channel_queue_size(zcm_t *zcm, enum zcm_queue queue,
+                               const char *channel, uint32_t size);
+
+/* Blocking Mode Only: How urgently the messages of a channel are dispatched */
+enum zcm_priority {
+    ZCM_PRIORITY_NORMAL,    /* in the order they were received (the default) */
+    ZCM_PRIORITY_HIGH       /* ahead of every normal priority message still waiting */
+};
+
+/* Blocking Mode Only: Set the priority of a channel, typically right before subscribing
+   to it. Received high priority messages wait in a receive queue of their own, which is
+   always drained first, so a flood of bulk data can't delay them. The queue size and
+   policies of ZCM_RECV_QUEUE apply to both queues. With several dispatch threads, high
+   priority messages still queue up behind their dispatch thread's earlier messages.
+   Only the exact channel name is matched. May be called at any time.
+   Returns 0 on success, and -1 on failure
+   Sets zcm errno on failure */
+int zcm_set_channel_priority(zcm_t *zcm, const char *channel, enum zcm_priority priority);
+
+/* Blocking Mode Only: Only keep the newest received message of a channel (0 turns it back
+   off), for consumers that don't care about anything older. Its messages don't queue up:
+   each one replaces the last in a slot of the channel's own, which is dispatched whenever
+   it holds a message that wasn't dispatched yet. So a channel whose callbacks fall behind
+   neither holds up the receiving of other channels nor spends time on stale messages.
+   Takes precedence over the channel's priority. With several dispatch threads, messages
+   still queue up for the channel's dispatch thread once taken out of the slot.
+   Only the exact channel name is matched. May be called at any time.
+   Returns 0 on success, and -1 on failure
+   Sets zcm errno on failure */
+int zcm_set_channel_conflate(zcm_t *zcm, const char *channel, int conflate);
+
+/* Blocking Mode Only: Dispatch messages from 'n' threads in zcm_run() and zcm_start()
+   (1 by default). Messages are spread over the threads by channel, so the callbacks of
+   one channel always run in order on the same thread while the callbacks of other
+   channels may run concurrently. zcm_handle() always dispatches on the calling thread.
+   Each thread has a queue as large as the receive queue, and the receive policy applies
+   to it when full: only ZCM_QUEUE_BLOCK holds up the other threads until there is room.
+   Messages waiting in there still count towards their channel's receive limit.
+   Must be called while not running. Also settable from the url with "dispatch_threads"
+   Returns 0 on success, and -1 on failure
+   Sets zcm errno on failure */
+int zcm_set_dispatch_threads(zcm_t *zcm, uint32_t n);
+
+/* Blocking Mode Only: With 'enable' set, time is only what the transport says it is. The
+   clock returned by zcm_get_utime() is moved up to the utime of every message before it is
+   dispatched, and published messages are stamped with it. Meant for replaying logs as fast
+   as they can be dispatched, e.g. with "file://replay.log?virtual_time=1", which also stops
+   the file transport from pacing playback. Messages should not be dropped for this to be
+   deterministic, which the default ZCM_QUEUE_BLOCK policy ensures.
+   Must be called while not running. Also settable from the url with "virtual_time"
+   Returns 0 on success, and -1 on failure
+   Sets zcm errno on failure */
+int zcm_set_virtual_time(zcm_t *zcm, int enable);
+
+/* Blocking Mode Only: The current time in microseconds, which is the time of day unless
+   zcm_set_virtual_time() was enabled. Returns 0 for a nonblocking ZCM interface */
+uint64_t zcm_get_utime(zcm_t *zcm);
+
+/* Blocking Mode Only: Why a message was dropped */
+enum zcm_drop_cause {
+    ZCM_DROP_SEND_QUEUE_FULL,    /* the send queue had no room, see zcm_set_queue_policy() */
+    ZCM_DROP_SEND_CHANNEL_LIMIT, /* its channel had as many messages in the send queue as
+                                    allowed, see zcm_set_channel_queue_size() */
+    ZCM_DROP_SEND_ERROR,         /* the transport failed to send it */
+    ZCM_DROP_RECV_QUEUE_FULL,    /* the same as above, for the receive queue or the queue
+                                    of a dispatch thread, see zcm_set_dispatch_threads() */
+    ZCM_DROP_RECV_CHANNEL_LIMIT,
+    ZCM_DROP_RECV_CONFLATED,     /* a newer message of its conflated channel replaced it,
+                                    see zcm_set_channel_conflate() */
+    ZCM__DROP_CAUSE_COUNT
+};
+
+/* Blocking Mode Only: A latency histogram in microseconds. Values below 16us have a
+   bucket each, above that every power of two is split into 8 buckets, so a value is
+   known to within 12.5%. Values above 2^40us all land in the last bucket. */
+#define ZCM_HISTOGRAM_BUCKETS 304
+typedef struct zcm_histogram_t zcm_histogram_t;
+struct zcm_histogram_t
+{
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+    uint64_t buckets[ZCM_HISTOGRAM_BUCKETS];
+};
+
+/* Returns the value (in us) that 'percentile' percent of the samples don't exceed,
+   rounded up to the end of its bucket, or 0 if the histogram is empty */
+uint64_t zcm_histogram_percentile(const zcm_histogram_t *h, double percentile);
+
+/* Blocking Mode Only: Statistics of one channel since the zcm object was created.
+   Channels beyond the first 1024 are accounted together under an empty name */
+typedef struct zcm_channel_stats_t zcm_channel_stats_t;
+struct zcm_channel_stats_t
+{
+    char channel[ZCM_CHANNEL_MAXLEN+1];
+    uint64_t published;       /* messages handed to zcm_publish(), even if dropped */
+    uint64_t published_bytes;
+    uint64_t sent;            /* messages the transport sent */
+    uint64_t sent_bytes;
+    uint64_t received;        /* messages the transport received */
+    uint64_t received_bytes;
+    uint64_t dispatched;      /* messages handed to at least one callback */
+    uint64_t dropped[ZCM__DROP_CAUSE_COUNT];
+    zcm_histogram_t send_latency;     /* from zcm_publish() to the transport sending it */
+    zcm_histogram_t dispatch_latency; /* from the transport receiving it to its dispatch,
+                                         only for transports that timestamp messages */
+};
+
+/* Counters a transport keeps for one of the peers it received from */
+#define ZCM_ADDRESS_MAXLEN 63
+typedef struct zcm_sender_stats_t zcm_sender_stats_t;
+struct zcm_sender_stats_t
+{
+    char address[ZCM_ADDRESS_MAXLEN+1]; /* as the transport names it, e.g. "ip:port" */
+    uint64_t messages_lost;
+    uint64_t fragments_reordered;   /* came after a higher numbered one of their message */
+    uint64_t fragments_duplicated;  /* of their message were received before */
+};
+
+/* Counters kept by the transport, transports that don't keep them leave them at 0 */
+typedef struct zcm_trans_stats_t zcm_trans_stats_t;
+struct zcm_trans_stats_t
+{
+    uint64_t packets_received;
+    uint64_t packets_discarded;   /* malformed or otherwise unusable packets */
+    uint64_t messages_lost;       /* skipped sequence numbers and incomplete messages */
+    uint64_t fragments_placed;    /* received straight into their reassembly buffer */
+    uint64_t fragments_misplaced; /* received into the wrong place and copied back out */
+    uint32_t nsenders;
+    zcm_sender_stats_t *senders;  /* free with zcm_free_stats() */
+};
+
+typedef struct zcm_stats_t zcm_stats_t;
+struct zcm_stats_t
+{
+    uint32_t send_queue_high_water; /* the most messages ever waiting in a queue */
+    uint32_t recv_queue_high_water;
+    zcm_trans_stats_t transport;
+    uint32_t nchannels;
+    zcm_channel_stats_t *channels;  /* free with zcm_free_stats() */
+};
+
+/* Blocking Mode Only: Take a snapshot of the statistics. Counting is always on, it only
+   costs a few uncontended writes per message.
+   Returns 0 on success, and -1 on failure
+   Sets zcm errno on failure */
+int  zcm_get_stats(zcm_t *zcm, zcm_stats_t *stats);
+void zcm_free_stats(zcm_stats_t *stats);
+
 /* Non-Blocking Mode Only: Functions checking and dispatching messages */
 /* Returns 1 if a message was dispatched, and 0 otherwise */
 int zcm_handle_nonblock(zcm_t *zcm);
 
+/* Non-Blocking Mode Only: Keep receiving and dispatching messages until the transport has
+   none left or the budget is spent: 'max_msgs' messages (0 for no limit) or, if
+   'timestamp_now' is given, 'max_us' microseconds as told by it. Trades the latency of
+   whatever else the caller's loop does for throughput, which zcm_handle_nonblock() caps
+   at one batch of messages per call.
+   Returns the number of messages dispatched */
+int zcm_handle_nonblock_budget(zcm_t *zcm, uint32_t max_msgs, uint64_t max_us,
+                               uint64_t (*timestamp_now)(void *usr), void *usr);
+
 /*
  * Version: M.m.u
  *   M: Major
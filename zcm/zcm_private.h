@@ -18,6 +18,12 @@ struct zcm_sub_t
     void *usr;
 };
 
+/* The bucket of zcm_histogram_t that 'value' goes into */
+uint32_t zcm_histogram_bucket(uint64_t value);
+
+/* The largest value that goes into 'bucket' */
+uint64_t zcm_histogram_bucket_max(uint32_t bucket);
+
 #ifdef __cplusplus
 }
 #endif